@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace vecs {
+
+	// Timings of the engine's core data structures against the standard containers they replaced. Each benchmark
+	// prints one line per operation and size with its time per operation, so runs can be compared by eye.
+	// Build in release, since debug builds time the sanitizers more than anything else
+	namespace Bench {
+
+		// Results get added to this so the compiler can't optimize away the work being timed
+		extern volatile uint64_t sink;
+		// Set by benchmarks that check their results when one comes out wrong, so the run exits with an error
+		extern bool failed;
+
+		// Runs function once and prints how long it took per operation. Returns how long it took in total, in nanoseconds
+		template<typename Function>
+		double time(std::string const& name, size_t size, size_t operations, Function&& function) {
+			auto start = std::chrono::steady_clock::now();
+			function();
+			std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+			std::printf("%-36s %9zu %12.2f ns/op\n", name.c_str(), size, elapsed.count() / operations);
+			return elapsed.count();
+		}
+
+		// The numbers [0, count) in a random order that's the same every run
+		std::vector<uint32_t> shuffled(size_t count);
+
+		void sparseSet();
+		void luaTable();
+		void luaValStream();
+	}
+}
@@ -0,0 +1,73 @@
+#include "Bench.h"
+
+#include "../src/lua/LuaVal.h"
+
+#include <map>
+
+using namespace vecs;
+
+namespace {
+	// Times setting, getting and iterating the same keys in the old and new table types
+	void compare(std::string const& keyType, std::vector<LuaVal> const& keys, std::vector<uint32_t> const& order) {
+		size_t size = keys.size();
+		std::map<LuaVal, LuaVal> map;
+		LuaTable table;
+
+		Bench::time("std::map set " + keyType, size, size, [&]() {
+			for (size_t i = 0; i < size; i++)
+				map[keys[i]] = LuaVal((double)i);
+		});
+		Bench::time("LuaTable set " + keyType, size, size, [&]() {
+			for (size_t i = 0; i < size; i++)
+				table[keys[i]] = LuaVal((double)i);
+		});
+
+		// Looked up in a random order, so the map can't get lucky with its cache
+		Bench::time("std::map get " + keyType, size, size, [&]() {
+			double sum = 0;
+			for (uint32_t i : order)
+				sum += map.find(keys[i])->second.as<double>();
+			Bench::sink += (uint64_t)sum;
+		});
+		Bench::time("LuaTable get " + keyType, size, size, [&]() {
+			double sum = 0;
+			for (uint32_t i : order)
+				sum += table.find(keys[i])->second.as<double>();
+			Bench::sink += (uint64_t)sum;
+		});
+
+		Bench::time("std::map iterate " + keyType, size, size, [&]() {
+			double sum = 0;
+			for (auto& kvp : map)
+				sum += kvp.second.as<double>();
+			Bench::sink += (uint64_t)sum;
+		});
+		Bench::time("LuaTable iterate " + keyType, size, size, [&]() {
+			double sum = 0;
+			for (auto kvp : table)
+				sum += kvp.second.as<double>();
+			Bench::sink += (uint64_t)sum;
+		});
+	}
+}
+
+// LuaVal's tables used to be a std::map<LuaVal, LuaVal>
+void Bench::luaTable() {
+	for (size_t size : { 1000, 10000, 100000, 1000000 }) {
+		std::vector<uint32_t> order = shuffled(size);
+
+		// Integer keys from 1, like lua arrays and vertex data, which go in the array part
+		std::vector<LuaVal> integers;
+		integers.reserve(size);
+		for (size_t i = 0; i < size; i++)
+			integers.emplace_back((double)(i + 1));
+		compare("(integer keys)", integers, order);
+
+		// String keys, like component fields, which go in the hash part
+		std::vector<LuaVal> strings;
+		strings.reserve(size);
+		for (size_t i = 0; i < size; i++)
+			strings.emplace_back(std::string("key") + std::to_string(i));
+		compare("(string keys)", strings, order);
+	}
+}
@@ -0,0 +1,94 @@
+#include "Bench.h"
+
+#include "../src/lua/LuaVal.h"
+#include "../src/lua/LuaValStream.h"
+
+#include <cstring>
+
+using namespace vecs;
+using namespace std::string_literals;
+
+namespace {
+	// Typed arrays compare by identity, so round trips have to compare their elements instead
+	bool sameArray(LuaVal const& a, LuaVal const& b) {
+		if (a.type != b.type || !a.isArray()) return false;
+		LuaArray const* aArray = a.as<LuaArray*>();
+		LuaArray const* bArray = b.as<LuaArray*>();
+		return aArray->size() == bArray->size()
+			&& std::memcmp(aArray->data(), bArray->data(), aArray->size() * aArray->getElementSize()) == 0;
+	}
+
+	// A chunk like terrain.lua saves, with its mesh as plain lua tables of numbers
+	LuaVal tableChunk(size_t vertices) {
+		LuaVal chunk = { { LuaVal("x"s), LuaVal(1.0) }, { LuaVal("y"s), LuaVal(-2.0) }, { LuaVal("z"s), LuaVal(3.0) } };
+		LuaVal vertexData = LuaVal(new LuaVal::MapType());
+		LuaVal indexData = LuaVal(new LuaVal::MapType());
+		for (size_t i = 0; i < vertices; i++) {
+			vertexData.set(LuaVal((double)(i + 1)), LuaVal(i * 0.25));
+			indexData.set(LuaVal((double)(i + 1)), LuaVal((double)(i % 65536)));
+		}
+		chunk.set(LuaVal("vertices"s), vertexData);
+		chunk.set(LuaVal("indices"s), indexData);
+		return chunk;
+	}
+
+	// The same chunk with its mesh in typed arrays
+	LuaVal arrayChunk(size_t vertices) {
+		LuaVal chunk = { { LuaVal("x"s), LuaVal(1.0) }, { LuaVal("y"s), LuaVal(-2.0) }, { LuaVal("z"s), LuaVal(3.0) } };
+		LuaVal vertexData = LuaVal::newArray(LUA_TYPE_FLOAT_ARRAY, vertices);
+		LuaVal indexData = LuaVal::newArray(LUA_TYPE_INT_ARRAY, vertices);
+		for (size_t i = 0; i < vertices; i++) {
+			vertexData.as<LuaArray*>()->set(i, i * 0.25);
+			indexData.as<LuaArray*>()->set(i, (double)(i % 65536));
+		}
+		chunk.set(LuaVal("vertices"s), vertexData);
+		chunk.set(LuaVal("indices"s), indexData);
+		return chunk;
+	}
+
+	// Lots of small component-like tables with repeating strings, which is mostly keys and headers
+	LuaVal records(size_t count) {
+		LuaVal list = LuaVal(new LuaVal::MapType());
+		for (size_t i = 0; i < count; i++) {
+			LuaVal record = {
+				{ LuaVal("name"s), LuaVal(i % 2 ? "stone"s : "dirt"s) },
+				{ LuaVal("position"s), LuaVal(glm::vec3((float)i, i * 2.0f, i * 3.0f)) },
+				{ LuaVal("alive"s), LuaVal(true) }
+			};
+			list.set(LuaVal("entity"s + std::to_string(i)), record);
+		}
+		return list;
+	}
+
+	// Checks the value comes back the same and prints how fast it was encoded and decoded
+	void roundTrip(std::string const& name, size_t size, LuaVal const& value) {
+		std::string data;
+		LuaVal decoded;
+		double encodeTime = Bench::time(name + " encode", size, size, [&]() {
+			data = LuaValWriter::encode(value);
+		});
+		double decodeTime = Bench::time(name + " decode", size, size, [&]() {
+			decoded = LuaValReader::decode(data);
+		});
+
+		bool same = decoded.type == LUA_TYPE_TABLE && decoded == value;
+		if (same && value.get("vertices").isArray())
+			same = sameArray(value.get("vertices"), decoded.get("vertices")) && sameArray(value.get("indices"), decoded.get("indices"));
+		if (!same) Bench::failed = true;
+
+		// bytes per nanosecond is GB/s, so this is MB/s
+		std::printf("%-36s %9zu %12zu bytes %9.1f MB/s encode %9.1f MB/s decode %s\n", (name + " round trip").c_str(), size,
+			data.size(), data.size() * 1000.0 / encodeTime, data.size() * 1000.0 / decodeTime, same ? "ok" : "MISMATCH");
+	}
+}
+
+// Snapshots, region files and LuaVal.encode all go through LuaValWriter and LuaValReader
+void Bench::luaValStream() {
+	for (size_t size : { 1000, 10000, 100000, 1000000 }) {
+		roundTrip("table chunk", size, tableChunk(size));
+		roundTrip("typed array chunk", size, arrayChunk(size));
+		// Records are a lot bigger than a vertex, so there's no need to go as high
+		if (size <= 100000)
+			roundTrip("records", size, records(size));
+	}
+}
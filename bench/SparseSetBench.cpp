@@ -0,0 +1,80 @@
+#include "Bench.h"
+
+#include "../src/ecs/SparseSet.h"
+
+#include <iterator>
+#include <set>
+
+using namespace vecs;
+
+namespace {
+	// How many ranges createParallel splits an archetype into
+	const size_t SPLITS = 64;
+}
+
+// Archetypes used to keep their entities in a std::set<uint32_t>
+void Bench::sparseSet() {
+	for (size_t size : { 10000, 100000, 1000000 }) {
+		std::vector<uint32_t> ids = shuffled(size);
+		std::set<uint32_t> set;
+		SparseSet sparse;
+
+		time("std::set insert", size, size, [&]() {
+			for (uint32_t id : ids)
+				set.insert(id);
+		});
+		time("SparseSet insert", size, size, [&]() {
+			for (uint32_t id : ids)
+				sparse.insert(id);
+		});
+
+		time("std::set contains", size, size, [&]() {
+			uint64_t found = 0;
+			for (uint32_t id : ids)
+				found += set.count(id);
+			sink += found;
+		});
+		time("SparseSet contains", size, size, [&]() {
+			uint64_t found = 0;
+			for (uint32_t id : ids)
+				found += sparse.contains(id);
+			sink += found;
+		});
+
+		time("std::set iterate", size, size, [&]() {
+			uint64_t sum = 0;
+			for (uint32_t id : set)
+				sum += id;
+			sink += sum;
+		});
+		time("SparseSet iterate", size, size, [&]() {
+			uint64_t sum = 0;
+			for (uint32_t id : sparse)
+				sum += id;
+			sink += sum;
+		});
+
+		// Finding where each parallel job starts
+		time("std::set split points", size, SPLITS, [&]() {
+			uint64_t sum = 0;
+			for (size_t i = 0; i < SPLITS; i++)
+				sum += *std::next(set.begin(), size * i / SPLITS);
+			sink += sum;
+		});
+		time("SparseSet split points", size, SPLITS, [&]() {
+			uint64_t sum = 0;
+			for (size_t i = 0; i < SPLITS; i++)
+				sum += sparse[size * i / SPLITS];
+			sink += sum;
+		});
+
+		time("std::set erase", size, size, [&]() {
+			for (uint32_t id : ids)
+				set.erase(id);
+		});
+		time("SparseSet erase", size, size, [&]() {
+			for (uint32_t id : ids)
+				sparse.erase(id);
+		});
+	}
+}
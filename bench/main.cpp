@@ -0,0 +1,38 @@
+#include "Bench.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <random>
+
+using namespace vecs;
+
+volatile uint64_t Bench::sink = 0;
+bool Bench::failed = false;
+
+std::vector<uint32_t> Bench::shuffled(size_t count) {
+	std::vector<uint32_t> numbers(count);
+	std::iota(numbers.begin(), numbers.end(), 0);
+	std::shuffle(numbers.begin(), numbers.end(), std::mt19937(1337));
+	return numbers;
+}
+
+int main(int argc, char** argv) {
+	// Pass a benchmark's name to only run that one, e.g. vecs-bench sparseSet
+	struct Benchmark {
+		const char* name;
+		void (*run)();
+	};
+	Benchmark benchmarks[] = {
+		{ "sparseSet", Bench::sparseSet },
+		{ "luaTable", Bench::luaTable },
+		{ "luaValStream", Bench::luaValStream }
+	};
+
+	for (auto& benchmark : benchmarks) {
+		if (argc > 1 && std::strcmp(argv[1], benchmark.name) != 0) continue;
+		std::printf("== %s ==\n", benchmark.name);
+		benchmark.run();
+	}
+	return Bench::failed ? 1 : 0;
+}
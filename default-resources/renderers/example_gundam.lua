@@ -15,10 +15,11 @@ return {
 		})
 
 		self.camera = archetype.new({ "Camera" })
-		self.gundams = archetype.new({ "Gundam" })
+		self.gundams = archetype.new({ "Gundam", "Transform" })
 	end,
 	dependencies = {
-		camera = "system"
+		camera = "system",
+		transforms = "system"
 	},
 	forwardDependencies = {
 		imgui = "renderer"
@@ -39,9 +40,8 @@ return {
 		end
 	end,
 	renderGundams = function(data, first, last)
-		data.gundams:lock_shared()
-		for id,gundam in data.gundams:getComponents("Gundam"):iterate_range(luaVal.new(first), luaVal.new(last)) do
-			local M = mat4.translate(vec3.new(gundam.x, gundam.y, gundam.z)) * mat4.rotate(gundam.rotation, vec3.new(0, 1, 0))
+		for id,_ in data.gundams:getComponents("Transform"):iterate_range(first, last) do
+			local M = world:getWorldMatrix(id)
 
 			local commandBuffer = data.renderer:startRendering()
 			data.renderer:pushConstantMat4(commandBuffer, shaderStages.Vertex, 0, data.viewProj)
@@ -55,6 +55,5 @@ return {
 			
 			data.renderer:finishRendering(commandBuffer)
 		end
-		data.gundams:unlock_shared()
 	end
 }
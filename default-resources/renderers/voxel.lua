@@ -50,18 +50,13 @@ return {
 			blockArchetypes[block.id] = block.getArchetype(map, blockUtils)
 		end
 		
-		-- save block archetypes to entity
-		createEntity({
-			Blocks = {
-				archetypes = blockArchetypes
-			}
-		})
+		-- save block archetypes for the terrain system
+		world.resources.blocks = blockArchetypes
 
 		-- setup uniform buffer
 		self.ubo = renderer:createUBO(shaderStages.Vertex, 4 * sizes.Float)
 		self.ubo:setDataFloats({ self.lightPos.x, self.lightPos.y, self.lightPos.z, self.ambient })
 
-		self.camera = archetype.new({ "Camera" })
 		self.chunksQuery = query.new({ "Chunk" })
 	end,
 	dependencies = {
@@ -72,37 +67,53 @@ return {
 		imgui = "renderer"
 	},
 	render = function(self, renderer)
-		if not self.camera:isEmpty() then
-			for id,c in self.camera:getComponents("Camera"):iterate() do
-				local viewProj = c.viewProjectionMatrix
-				local cullFrustum = frustum.new(viewProj)
+		local c = world.resources.camera
+		if c ~= nil then
+			local viewProj = c.viewProjectionMatrix
+			local cullFrustum = frustum.new(viewProj)
 
-				-- TODO sort by distance from player and attempt to perform occlusion culling
-				for key,archetype in pairs(self.chunksQuery:getArchetypes()) do
-					local data = luaVal.new({
-						chunks = archetype,
-						viewProj = viewProj,
-						cameraPos = c.position,
-						cullFrustum = cullFrustum,
-						renderer = renderer
-					})
-					jobs.createParallel(self.renderChunks, data, archetype, 64):submit()
+			local archetypes = {}
+			for key,archetype in pairs(self.chunksQuery:getArchetypes()) do
+				archetypes[#archetypes + 1] = archetype
+			end
+
+			-- the spatial index skips whole cells of chunks outside the frustum, so we only visit the ones that might be visible
+			-- TODO sort by distance from player and attempt to perform occlusion culling
+			local visible = world:queryFrustum(cullFrustum)
+			for first = 1, #visible, 64 do
+				local ids = {}
+				for i = first, math.min(first + 63, #visible) do
+					ids[#ids + 1] = visible[i]
 				end
+				local data = luaVal.new({
+					archetypes = archetypes,
+					ids = ids,
+					viewProj = viewProj,
+					cameraPos = c.position,
+					cullFrustum = cullFrustum,
+					renderer = renderer
+				})
+				jobs.create(self.renderChunks, data):submit()
 			end
 		end
 	end,
-	renderChunks = function(data, first, last)
+	renderChunks = function(data)
 		local commandBuffer = data.renderer:startRendering()
 		data.renderer:pushConstantMat4(commandBuffer, shaderStages.Vertex, 0, data.viewProj)
 		data.renderer:pushConstantMat4(commandBuffer, shaderStages.Vertex, sizes.Mat4, mat4.translate(vec3.new(0, 0, 0)))
 		data.renderer:pushConstantVec3(commandBuffer, shaderStages.Vertex, sizes.Mat4 * 2, data.cameraPos)
-		data.chunks:lock_shared()
-		for id,chunk in data.chunks:getComponents("Chunk"):iterate_range(luaVal.new(first), luaVal.new(last)) do
-			if chunk.valid and data.cullFrustum:isBoxVisible(chunk.minBounds, chunk.maxBounds) then
-				data.renderer:drawVertices(commandBuffer, chunk.vertexBuffer, chunk.indexBuffer, chunk.indexCount)
+		for i,id in data.ids:iterate() do
+			-- the index is a frame behind and holds anything with Bounds, so check it's still a chunk and still visible
+			for j,archetype in data.archetypes:iterate() do
+				local chunk = archetype:getComponents("Chunk")[id]
+				if chunk ~= nil then
+					if chunk.valid and data.cullFrustum:isBoxVisible(chunk.minBounds, chunk.maxBounds) then
+						data.renderer:drawVertices(commandBuffer, chunk.vertexBuffer, chunk.indexBuffer, chunk.indexCount)
+					end
+					break
+				end
 			end
 		end
-		data.chunks:unlock_shared()
 		data.renderer:finishRendering(commandBuffer)
 	end
 }
@@ -21,6 +21,11 @@ return {
 			camera.projectionMatrix:set(1, 1, camera.projectionMatrix:get(1, 1) * -1)
 			camera.viewProjectionMatrix = camera.projectionMatrix * self.getViewMatrix(camera.position, camera.position + camera.forward)
 		end
+		-- publish the camera as a world resource so other systems don't need to iterate over the camera archetype
+		for id,camera in self.camera:getComponents("Camera"):iterate() do
+			world.resources.camera = camera
+			break
+		end
 
 		createEntity({
 			AddCommandEvent = {
@@ -1,36 +1,35 @@
 return {
 	forwardDependencies = {
-		example_gundam = "renderer"
+		transforms = "system"
 	},
 	gridSize = 50,
 	preInit = function(self)
 		self.gundams = archetype.new({
-			"Gundam"
+			"Gundam",
+			"Transform"
 		})
 		self.gundams:createEntities(self.gridSize * self.gridSize)
 		local x = 0
 		local z = 0
-		for id,gundam in self.gundams:getComponents("Gundam"):iterate() do
-			gundam.x = 5 * x
-			gundam.y = 0
-			gundam.z = 5 * z
+		local gundams = self.gundams:getComponents("Gundam")
+		for id,transform in self.gundams:getComponents("Transform"):iterate() do
+			transform.position = vec3.new(5 * x, 0, 5 * z)
+			transform.rotation = vec3.new(0, math.random(), 0)
 			x = x + 1
 			if x == self.gridSize - 1 then
 				x = 0
 				z = z + 1
 			end
-			gundam.rotation = math.random()
-			gundam.rotSpeed = math.random(360)
+			gundams[id].rotSpeed = math.random(360)
 		end
 	end,
 	update = function(self)
 		jobs.createParallel(self.updateGundams, luaVal.new({ gundams = self.gundams }), self.gundams, 64):submit()
 	end,
 	updateGundams = function(data, first, last)
-		data.gundams:lock_shared()
-		for id,gundam in data.gundams:getComponents("Gundam"):iterate_range(luaVal.new(first), luaVal.new(last)) do
-			gundam.rotation = gundam.rotation + time.getDeltaTime() * gundam.rotSpeed
+		local gundams = data.gundams:getComponents("Gundam")
+		for id,transform in data.gundams:getComponents("Transform"):iterate_range(first, last) do
+			transform.rotation = transform.rotation + vec3.new(0, time.getDeltaTime() * gundams[id].rotSpeed, 0)
 		end
-		data.gundams:unlock_shared()
 	end
 }
@@ -46,13 +46,13 @@ return {
 		})
 
 		local addCommandEventArchetype = archetype.new({ "AddCommandEvent" })
-		local index,_ = addCommandEventArchetype:createEntities(5)
+		local ids = addCommandEventArchetype:createEntities(5)
 		local addCommantEvents = addCommandEventArchetype:getComponents("AddCommandEvent")
-		addCommantEvents[index] = { command = "currency", self = self, callback = self.setName, description = "Usage: currency {name}\n\tSets the name of the currency you're producing" }
-		addCommantEvents[index + 1] = { command = "addCurrency", self = self, callback = self.addCurrency, description = "Usage: addCurrency {amount}\n\tAdds {amount} currency" }
-		addCommantEvents[index + 2] = { command = "addProducers", self = self, callback = self.addProducers, description = "Usage: addProducers {amount}\n\tAdds {amount} producers" }
-		addCommantEvents[index + 3] = { command = "addTimeSlots", self = self, callback = self.addTimeSlots, description = "Usage: addTimeSlots {amount}\n\tAdds {amount} time slots" }
-		addCommantEvents[index + 4] = { command = "addRP", self = self, callback = self.addRP, description = "Usage: addRP {amount}\n\tAdds {amount} research points" }
+		addCommantEvents[ids[1]] = { command = "currency", self = self, callback = self.setName, description = "Usage: currency {name}\n\tSets the name of the currency you're producing" }
+		addCommantEvents[ids[2]] = { command = "addCurrency", self = self, callback = self.addCurrency, description = "Usage: addCurrency {amount}\n\tAdds {amount} currency" }
+		addCommantEvents[ids[3]] = { command = "addProducers", self = self, callback = self.addProducers, description = "Usage: addProducers {amount}\n\tAdds {amount} producers" }
+		addCommantEvents[ids[4]] = { command = "addTimeSlots", self = self, callback = self.addTimeSlots, description = "Usage: addTimeSlots {amount}\n\tAdds {amount} time slots" }
+		addCommantEvents[ids[5]] = { command = "addRP", self = self, callback = self.addRP, description = "Usage: addRP {amount}\n\tAdds {amount} research points" }
 	end,
 	postInit = function(self)
 		local registerTextureEventArchetype = archetype.new({ "RegisterTextureEvent" })
@@ -2,21 +2,17 @@ return {
 	loadDistance = 4,
 	chunkSize = 16,
 	seed = 1337,
+	-- generated chunks are saved here, in a folder for each seed
+	regionDirectory = "saves/regions",
 	forwardDependencies = {
 		voxel = "renderer"
 	},
 	init = function(self)
-		self.blocks = archetype.new({ "Blocks" })
-
 		-- create or find our seed
-		local seedArchetype = archetype.new({
-			"Seed"
-		})
-		if seedArchetype:isEmpty() then
-			local id,index = seedArchetype:createEntity()
-			seedArchetype:getComponents("Seed")[id].seed = self.seed
+		if world.resources.seed == nil then
+			world.resources.seed = self.seed
 		else
-			self.seed = seedArchetype:getComponents("Seed")[1].seed
+			self.seed = world.resources.seed
 		end
 
 		local terrainGens = {}
@@ -29,31 +25,73 @@ return {
 		-- sort our terrain generators by priority
 		-- we only need the priority for this sorting step,
 		-- so we store the generators in an array so we don't need to sort them for every generated chunk
-		self.terrainGens = {}
+		local sortedGens = {}
 		for _,generator in self.spairs(terrainGens, function(t, a, b) return t[a].priority < t[b].priority end) do
-			self.terrainGens[#self.terrainGens + 1] = generator
+			sortedGens[#sortedGens + 1] = generator
 		end
+		-- converted once here, so each chunk's job data shares it instead of copying every generator again
+		self.terrainGens = luaVal.new(sortedGens)
 
+		-- Bounds puts each chunk in the world's spatial index, so the voxel renderer can find the visible ones
 		self.chunkArchetype = archetype.new({
-			"Chunk"
+			"Chunk",
+			"Bounds"
 		})
 		-- TODO is storing 3D array of chunk indices going to be okay?
 		self.chunks = {}
-		if self.chunkArchetype:isEmpty() and not self.blocks:isEmpty() then
-			local blocks
-			for id,b in self.blocks:getComponents("Blocks"):iterate() do
-				blocks = b.archetypes
-				break
+		local blocks = world.resources.blocks
+		-- the chunks we had loaded last time are saved here when the world is cleaned up
+		self.snapshotFile = self.regionDirectory .. "/" .. self.seed .. "/chunks.snapshot"
+		if blocks ~= nil then
+			world:openRegions(self.regionDirectory .. "/" .. self.seed, blocks)
+			if self.chunkArchetype:isEmpty() then
+				world:loadSnapshot(self.snapshotFile)
+			end
+		end
+		if not self.chunkArchetype:isEmpty() and blocks ~= nil then
+			-- restored chunks get new ids and no buffers, so find each one and recreate its buffers from its saved mesh
+			for id,chunk in self.chunkArchetype:getComponents("Chunk"):iterate() do
+				if self.chunks[chunk.x] == nil then self.chunks[chunk.x] = {} end
+				if self.chunks[chunk.x][chunk.y] == nil then self.chunks[chunk.x][chunk.y] = {} end
+				self.chunks[chunk.x][chunk.y][chunk.z] = id
+				chunk.valid = false
+
+				local data = luaVal.new({
+					id = id,
+					chunks = self.chunkArchetype,
+					chunkSize = self.chunkSize,
+					terrainGens = self.terrainGens,
+					blocks = blocks,
+					addVertex = self.addVertex,
+					createBuffers = self.createBuffers,
+					generateChunk = self.generateChunk
+				})
+				jobs.create(self.restoreChunk, data):submit()
 			end
 
-			local id,index = self.chunkArchetype:createEntities((2 * self.loadDistance + 1) ^ 3)
+			-- the camera starts back at the origin, so generate any chunks around it the snapshot didn't have
+			local chunks = self.chunkArchetype:getComponents("Chunk")
+			for x = -self.loadDistance, self.loadDistance do
+				if self.chunks[x] == nil then self.chunks[x] = {} end
+				for y = -self.loadDistance, self.loadDistance do
+					if self.chunks[x][y] == nil then self.chunks[x][y] = {} end
+					for z = -self.loadDistance, self.loadDistance do
+						self:checkChunk(blocks, chunks, x, y, z)
+					end
+				end
+			end
+		elseif blocks ~= nil then
+			local ids = self.chunkArchetype:createEntities((2 * self.loadDistance + 1) ^ 3)
 			local chunks = self.chunkArchetype:getComponents("Chunk")
-			local currId = id
+			local nextId = 1
 			for x = -self.loadDistance, self.loadDistance do
 				self.chunks[x] = {}
 				for y = -self.loadDistance, self.loadDistance  do
 					self.chunks[x][y] = {}
 					for z = -self.loadDistance, self.loadDistance do
+						-- ids are reused after entities are deleted, so they aren't necessarily consecutive
+						local currId = ids[nextId]
+						nextId = nextId + 1
 						self.chunks[x][y][z] = currId
 						chunks[currId].x = x
 						chunks[currId].y = y
@@ -65,11 +103,10 @@ return {
 							chunkSize = self.chunkSize,
 							terrainGens = self.terrainGens,
 							blocks = blocks,
-							addVertex = self.addVertex
+							addVertex = self.addVertex,
+							createBuffers = self.createBuffers
 						})
 						jobs.create(self.generateChunk, data):submit()
-
-						currId = currId + 1
 					end
 				end
 			end
@@ -84,37 +121,36 @@ return {
 			}
 		})
 	end,
+	cleanup = function(self)
+		-- only chunk entities are saved, the other systems create their own entities again each time
+		if world.resources.blocks ~= nil then
+			world:saveSnapshot(self.snapshotFile, { "Chunk" })
+		end
+	end,
 	postInit = function(self)
-		self.camera = archetype.new({ "Camera" })
-		for id,camera in self.camera:getComponents("Camera"):iterate() do	
+		local camera = world.resources.camera
+		if camera ~= nil then
 			self.x = math.floor(camera.position.x / self.chunkSize)
 			self.y = math.floor(camera.position.y / self.chunkSize)
 			self.z = math.floor(camera.position.z / self.chunkSize)
-			break
 		end
 	end,
 	update = function(self)
-		for id,camera in self.camera:getComponents("Camera"):iterate() do
+		local camera = world.resources.camera
+		if camera ~= nil then
 			local x = math.floor(camera.position.x / self.chunkSize)
 			local y = math.floor(camera.position.y / self.chunkSize)
 			local z = math.floor(camera.position.z / self.chunkSize)
-			if (self.x ~= x or self.y ~= y or self.z ~= z) and not self.blocks:isEmpty() then
-				local blocks
-				for id,b in self.blocks:getComponents("Blocks"):iterate() do
-					blocks = b.archetypes
-					break
-				end
-
+			local blocks = world.resources.blocks
+			if (self.x ~= x or self.y ~= y or self.z ~= z) and blocks ~= nil then
 				-- unload chunks that are far away
 				local toRemove = {}
 				local chunks = self.chunkArchetype:getComponents("Chunk")
-				self.chunkArchetype:lock_shared()
 				for i,chunk in chunks:iterate() do
 					if chunk.valid and (math.abs(chunk.x - x) > self.loadDistance or math.abs(chunk.y - y) > self.loadDistance or math.abs(chunk.z - z) > self.loadDistance) then
 						table.insert(toRemove, i)
 					end
 				end
-				self.chunkArchetype:unlock_shared()
 				self.chunkArchetype:deleteEntities(toRemove)
 
 				-- load chunks that are nearby but don't currently exist
@@ -188,7 +224,6 @@ return {
 				self.y = y
 				self.z = z
 			end
-			break
 		end
 	end,
 	checkChunk = function(self, blocks, chunks, x, y, z)
@@ -206,6 +241,7 @@ return {
 				terrainGens = self.terrainGens,
 				blocks = blocks,
 				addVertex = self.addVertex,
+				createBuffers = self.createBuffers,
 				id = id
 			})
 			local job = jobs.create(self.generateChunk, data)
@@ -213,17 +249,40 @@ return {
 			job:submit()
 		end
 	end,
+	restoreChunk = function(data)
+		local chunk = data.chunks:getComponents("Chunk")[data.id]
+		-- chunks saved before they finished generating don't have a mesh yet
+		if chunk.vertices == nil or chunk.indices == nil then
+			data.generateChunk(data)
+			return
+		end
+		data.createBuffers(data.id, chunk, chunk.vertices, chunk.indices)
+	end,
 	generateChunk = function(data)
 		local size = data.chunkSize
 		local sizeSq = size ^ 2
 		local invalid = {}
 
-		data.chunks:lock_shared()
 		local chunk = data.chunks:getComponents("Chunk")[data.id]
-		data.chunks:unlock_shared()
 
 		chunk.minBounds = vec3.new(chunk.x * size, chunk.y * size, chunk.z * size)
 		chunk.maxBounds = vec3.new((chunk.x + 1) * size, (chunk.y + 1) * size, (chunk.z + 1) * size)
+		data.chunks:getComponents("Bounds")[data.id] = { min = chunk.minBounds, max = chunk.maxBounds }
+
+		-- if we've generated this chunk before we can skip straight to creating its buffers
+		local saved = world:loadChunk(chunk.x, chunk.y, chunk.z)
+		if saved ~= nil then
+			chunk.blocks = saved.blocks
+			chunk.vertexCount = saved.vertexCount
+			chunk.indexCount = saved.indexCount
+			-- kept on the chunk so snapshots can recreate its buffers without meshing it again
+			chunk.vertices = saved.vertices
+			chunk.indices = saved.indices
+			-- buffers can read the saved arrays directly, without copying them into lua tables first
+			data.createBuffers(data.id, chunk, saved.vertices, saved.indices)
+			return
+		end
+
 		chunk.blocks = {}
 
 		-- run our terrain generators
@@ -234,8 +293,9 @@ return {
 		-- TODO make the rest of this function a compute shader job?
 
 		-- create the block entities and add their faces to a mesh
-		local vertices = {}
-		local indices = {}
+		-- typed arrays store each number as 4 bytes, and can be uploaded to buffers without converting them
+		local vertices = luaVal.floatArray()
+		local indices = luaVal.intArray()
 		chunk.vertexCount = 0
 		chunk.indexCount = 0
 
@@ -420,24 +480,18 @@ return {
 
 								if backface then
 									-- Clockwise indices
-									-- first triangle
-									table.insert(indices, chunk.vertexCount)
-									table.insert(indices, chunk.vertexCount + 1)
-									table.insert(indices, chunk.vertexCount + 2)
-									-- second triangle
-									table.insert(indices, chunk.vertexCount + 2)
-									table.insert(indices, chunk.vertexCount + 3)
-									table.insert(indices, chunk.vertexCount)
+									indices:push(
+										-- first triangle
+										chunk.vertexCount, chunk.vertexCount + 1, chunk.vertexCount + 2,
+										-- second triangle
+										chunk.vertexCount + 2, chunk.vertexCount + 3, chunk.vertexCount)
 								else
 									-- Counter clockwise indices
-									-- first triangle
-									table.insert(indices, chunk.vertexCount)
-									table.insert(indices, chunk.vertexCount + 2)
-									table.insert(indices, chunk.vertexCount + 1)
-									-- second triangle
-									table.insert(indices, chunk.vertexCount + 2)
-									table.insert(indices, chunk.vertexCount)
-									table.insert(indices, chunk.vertexCount + 3)
+									indices:push(
+										-- first triangle
+										chunk.vertexCount, chunk.vertexCount + 2, chunk.vertexCount + 1,
+										-- second triangle
+										chunk.vertexCount + 2, chunk.vertexCount, chunk.vertexCount + 3)
 								end
 
 								chunk.vertexCount = chunk.vertexCount + 4
@@ -462,7 +516,20 @@ return {
 			end
 		end
 
-		-- save our mesh
+		-- save the chunk to disk in the background, so next time we don't need to generate or mesh it
+		world:saveChunk(chunk.x, chunk.y, chunk.z, {
+			blocks = chunk.blocks,
+			vertices = vertices,
+			indices = indices,
+			vertexCount = chunk.vertexCount,
+			indexCount = chunk.indexCount
+		})
+
+		chunk.vertices = vertices
+		chunk.indices = indices
+		data.createBuffers(data.id, chunk, vertices, indices)
+	end,
+	createBuffers = function(id, chunk, vertices, indices)
 		if chunk.indexCount > 0 then
 			chunk.vertexBuffer = buffer.new(bufferUsage.VertexBuffer, chunk.vertexCount * 12 * sizes.Float)
 			chunk.vertexBuffer:setDataFloats(vertices)
@@ -470,23 +537,15 @@ return {
 			chunk.indexBuffer:setDataInts(indices)
 			chunk.valid = true
 		else
-			data.chunks:deleteEntity(data.id)
+			commands.deleteEntity(id)
 		end
 	end,
 	addVertex = function(vertices, x, y, z, normals, normalsMod, texCoordX, texCoordY, texSize)
 		-- TODO way to further optimize information passed per-vertex?
-		table.insert(vertices, x)
-		table.insert(vertices, y)
-		table.insert(vertices, z)
-		table.insert(vertices, -normals[0] * normalsMod)
-		table.insert(vertices, -normals[1] * normalsMod)
-		table.insert(vertices, -normals[2] * normalsMod)
-		table.insert(vertices, texCoordX)
-		table.insert(vertices, texCoordY)
-		table.insert(vertices, texSize.p)
-		table.insert(vertices, texSize.q)
-		table.insert(vertices, texSize.s)
-		table.insert(vertices, texSize.t)
+		vertices:push(x, y, z,
+			-normals[0] * normalsMod, -normals[1] * normalsMod, -normals[2] * normalsMod,
+			texCoordX, texCoordY,
+			texSize.p, texSize.q, texSize.s, texSize.t)
 	end,
 	spairs = function(t, order)
 		-- function used for creating a sorted iterator of k,v pairs in a table
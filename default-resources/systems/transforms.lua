@@ -0,0 +1,8 @@
+return {
+	-- Computes the world matrix of every entity with a Transform component, parents before children,
+	-- which can then be read with world:getWorldMatrix(entity). Systems that move entities should forward
+	-- depend on us, and renderers that draw them should depend on us
+	update = function(self)
+		world:updateTransforms()
+	end
+}
@@ -19,13 +19,20 @@ return {
 			-- chunk is all air
 			return
 		elseif canFillChunk == nil then
-			local smallNoiseBuffer = noiseBuffer.new(chunkSize)
-			local largeNoiseBuffer = noiseBuffer.new(chunkSize)
 			-- we can't fill the chunk
 			-- generate noise and calculate each block
-			local noiseSet = self.terrainNoise:getNoiseSet(smallNoiseBuffer, chunk.x, chunk.y, chunk.z, chunkSize)
-			local largeNoiseSet = self.largeNoise:getNoiseSet(largeNoiseBuffer, chunk.x, chunk.y, chunk.z, chunkSize)
-			for point, density in pairs(noiseSet) do
+			-- the arrays are kept in this worker's globals and refilled for each chunk, since jobs on a worker
+			-- run one at a time and self is shared between workers
+			if baseNoiseSet == nil then
+				baseNoiseSet = luaVal.floatArray()
+				baseLargeNoiseSet = luaVal.floatArray()
+			end
+			local noiseSet = baseNoiseSet
+			local largeNoiseSet = baseLargeNoiseSet
+			self.terrainNoise:fillArray(noiseSet, chunk.x, chunk.y, chunk.z, chunkSize)
+			self.largeNoise:fillArray(largeNoiseSet, chunk.x, chunk.y, chunk.z, chunkSize)
+			for point = 1, #noiseSet do
+				local density = noiseSet[point]
 				local internalY = math.floor((point - 1) % (chunkSize * chunkSize) / chunkSize)
 				local archetype = chunkBiome.getArchetype(density, largeNoiseSet[point], chunk.y * chunkSize + internalY)
 				
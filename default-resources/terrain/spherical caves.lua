@@ -7,9 +7,12 @@ return {
 	end,
 	generateChunk = function(self, archetypes, chunkSize, chunk)
 		if chunk.y > -2 then return end
-		local caveNoiseBuffer = noiseBuffer.new(chunkSize)
-		local noiseSet = self.caveNoise:getNoiseSet(caveNoiseBuffer, chunk.x, chunk.y, chunk.z, chunkSize)
-		for point,density in pairs(noiseSet) do
+		-- reused for each chunk this worker generates, see base.lua
+		if sphericalCaveNoiseSet == nil then sphericalCaveNoiseSet = luaVal.floatArray() end
+		local noiseSet = sphericalCaveNoiseSet
+		self.caveNoise:fillArray(noiseSet, chunk.x, chunk.y, chunk.z, chunkSize)
+		for point = 1, #noiseSet do
+			local density = noiseSet[point]
 			if chunk.y < -3 then
 				if density < 0.01 then
 					chunk.blocks[point - 1] = nil
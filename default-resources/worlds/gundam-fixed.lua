@@ -2,6 +2,7 @@ return {
 	name = "Gundams Mix-Match",
 	systems = {
 		gundams = "systems/gundams.lua",
+		transforms = "systems/transforms.lua",
 		fixedangle = "systems/fixedangle.lua",
 		camera = "systems/camera.lua",
 		inventory = "systems/inventory.lua",
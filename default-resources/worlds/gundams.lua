@@ -2,6 +2,7 @@ return {
 	name = "Gundams",
 	systems = {
 		gundams = "systems/gundams.lua",
+		transforms = "systems/transforms.lua",
 		noclip = "systems/noclip.lua",
 		camera = "systems/camera.lua",
 		fps = "systems/fps.lua",
@@ -1,22 +1,45 @@
 #include "Archetype.h"
 
+#include "ComponentList.h"
 #include "World.h"
 #include "EntityQuery.h"
+#include "../engine/Debugger.h"
 #include "../lua/LuaVal.h"
 
+#include <algorithm>
+#include <cassert>
+
 using namespace vecs;
 
+namespace {
+	// The archetypes this thread holds shared, and how many times. It's rarely more than a couple
+	thread_local std::vector<std::pair<Archetype*, uint32_t>> sharedLocks;
+
+	bool heldShared(Archetype* archetype) {
+		for (auto& held : sharedLocks)
+			if (held.first == archetype)
+				return true;
+		return false;
+	}
+}
+
 Archetype::Archetype(World* world, std::unordered_set<std::string> componentTypes, LuaVal* sharedComponents) {
 	this->world = world;
 	this->componentTypes = componentTypes;
+	this->signature = ComponentRegistry::getSignature(componentTypes);
 
 	if (sharedComponents != nullptr) {
 		assert(sharedComponents->type == LUA_TYPE_TABLE);
-		this->sharedComponents = new LuaVal(std::get<LuaVal::MapType*>(sharedComponents->value));
+		// Our own copy, so the caller changing their table afterwards can't change which archetype we are
+		this->sharedComponents = new LuaVal(sharedComponents->clone());
+		for (auto kvp : *this->sharedComponents->as<LuaVal::MapType*>()) {
+			if (kvp.first.type == LUA_TYPE_STRING)
+				sharedSignature.set(ComponentRegistry::getId(kvp.first.as<std::string>()));
+		}
 	} else this->sharedComponents = nullptr;
 
 	for (auto component : componentTypes) {
-		components[component] = LuaVal({});
+		components[component] = new ComponentList(this);
 	}
 }
 
@@ -25,89 +48,318 @@ LuaVal Archetype::getSharedComponent(std::string componentType) {
 	return sharedComponents->get(componentType);
 }
 
-LuaVal Archetype::getComponentList(std::string componentType) {
-	return components[componentType];
+ComponentList* Archetype::getComponentList(std::string componentType) {
+	auto it = components.find(componentType);
+	if (it == components.end())
+		return nullptr;
+	return it->second;
 }
 
-// TODO do I need to lock_shared mutex when calling find or contains?
 bool Archetype::checkQuery(EntityQuery* query) {
-	for (std::string component_t : query->filter.required) {
-		if (componentTypes.find(component_t) == componentTypes.end())
-			return false;
-	}
-	for (std::string component_t : query->filter.disallowed)
-		if (componentTypes.find(component_t) != componentTypes.end())
-			return false;
-	if (sharedComponents == nullptr && query->sharedFilter.required.size() > 0) return false;
-	for (std::string component_t : query->sharedFilter.required) {
-		if (!sharedComponents->contains(component_t))
-			return false;
-	}
-	if (sharedComponents == nullptr) return true;
-	for (std::string component_t : query->sharedFilter.disallowed)
-		if (sharedComponents->contains(component_t))
-			return false;
+	// Our signatures never change after creation, so no locking is needed here
+	if ((signature & query->filter.required) != query->filter.required) return false;
+	if ((signature & query->filter.disallowed).any()) return false;
+	if ((sharedSignature & query->sharedFilter.required) != query->sharedFilter.required) return false;
+	if ((sharedSignature & query->sharedFilter.disallowed).any()) return false;
 	return true;
 }
 
-std::pair<uint32_t, uint32_t> Archetype::createEntities(uint32_t amount) {
-	uint32_t firstEntity = world->createEntities(amount);
-	uint32_t lastEntity = firstEntity + amount - 1;
-	uint32_t index = numEntities.fetch_add(amount);
+void Archetype::addQuery(EntityQuery* query) {
+	auto updated = std::make_shared<std::vector<EntityQuery*>>(*std::atomic_load(&queries));
+	updated->push_back(query);
+	std::atomic_store(&queries, std::shared_ptr<const std::vector<EntityQuery*>>(std::move(updated)));
+}
 
-	mutex.lock();
-	for (auto& kvp : components) {
-		for (uint32_t index = firstEntity; index <= lastEntity; index++) {
-			kvp.second.set(LuaVal((double)index), LuaVal({}));
+std::vector<uint32_t> Archetype::createEntities(uint32_t amount) {
+	std::unordered_map<std::string, std::vector<LuaVal>> columns;
+	return createEntities(amount, columns);
+}
+
+std::vector<uint32_t> Archetype::createEntities(uint32_t amount, LuaVal const& prototype) {
+	// Build the columns before taking our lock, so copying the prototype doesn't block anyone
+	std::unordered_map<std::string, std::vector<LuaVal>> columns;
+	if (prototype.type == LUA_TYPE_TABLE) {
+		for (auto& componentType : componentTypes) {
+			LuaVal value = prototype.get(componentType);
+			if (value.type == LUA_TYPE_NIL) continue;
+			auto& column = columns[componentType];
+			column.reserve(amount);
+			for (uint32_t i = 0; i < amount; i++)
+				column.emplace_back(value.clone());
 		}
 	}
-	for (uint32_t index = firstEntity; index <= lastEntity; index++) {
-		entities.insert(index);
+	return createEntities(amount, columns);
+}
+
+std::vector<uint32_t> Archetype::createEntities(uint32_t amount, std::unordered_map<std::string, std::vector<LuaVal>>& columns) {
+	if (!lockExclusive()) return {};
+	std::vector<uint32_t> created;
+	try {
+		created = world->createEntities(amount);
+	} catch (...) {
+		mutex.unlock();
+		throw;
 	}
+	uint32_t index = entities.size();
+	for (auto& kvp : components) {
+		auto& rows = kvp.second->rows;
+		rows.reserve(index + amount);
+		auto it = columns.find(kvp.first);
+		uint32_t i = 0;
+		if (it != columns.end())
+			for (; i < amount && i < it->second.size(); i++)
+				rows.emplace_back(std::move(it->second[i]));
+		for (; i < amount; i++)
+			rows.emplace_back(LuaVal({}));
+	}
+	entities.reserve(index + amount);
+	for (uint32_t entity : created)
+		entities.insert(entity);
+	for (auto& kvp : components)
+		kvp.second->updateVersions(index, index + amount);
+	numEntities = entities.size();
+	if (hasQueryCallbacks())
+		queueQueryEvent(true, created);
 	mutex.unlock();
-	return std::make_pair(firstEntity, index);
+	world->setEntityArchetypes(created, this);
+	return created;
 }
 
 void Archetype::addEntities(std::vector<uint32_t> entities) {
-	mutex.lock();
-	for (auto kvp : components) {
-		for (uint32_t index : entities)
-			kvp.second.set(LuaVal((double)index), LuaVal({}));
+	if (!lockExclusive()) return;
+	uint32_t index = this->entities.size();
+	for (uint32_t entity : entities) {
+		if (this->entities.contains(entity))
+			continue;
+		for (auto& kvp : components)
+			kvp.second->rows.emplace_back(LuaVal({}));
+		this->entities.insert(entity);
+	}
+	for (auto& kvp : components)
+		kvp.second->updateVersions(index, this->entities.size());
+	numEntities = this->entities.size();
+	if (hasQueryCallbacks()) {
+		std::vector<uint32_t> added(this->entities.begin() + index, this->entities.end());
+		queueQueryEvent(true, added);
 	}
-	for (uint32_t index : entities)
-		this->entities.insert(index);
 	mutex.unlock();
-	numEntities += entities.size();
+	world->setEntityArchetypes(entities, this);
 }
 
 void Archetype::removeEntities(std::vector<uint32_t> entities) {
-	mutex.lock();
-	for (uint32_t entity : entities) {
-		for (auto kvp : components) {
-			kvp.second.set_nil(LuaVal((double)entity));
-		}
-	}
-	for (uint32_t entity : entities) {
-		this->entities.erase(entity);
-	}
+	if (!lockExclusive()) return;
+	std::vector<uint32_t> removed;
+	for (uint32_t entity : entities)
+		if (eraseEntity(entity))
+			removed.push_back(entity);
+	numEntities = this->entities.size();
+	queueQueryEvent(false, removed);
 	mutex.unlock();
-	numEntities -= entities.size();
+	// Only release the ids we actually held, so one that's in another archetype or listed twice isn't recycled while in use
+	world->destroyEntities(removed);
 }
 
 void Archetype::clearEntities() {
-	mutex.lock();
-	for (auto kvp : components) {
-		kvp.second.clear();
+	if (!lockExclusive()) return;
+	std::vector<uint32_t> removed(entities.begin(), entities.end());
+	for (auto& kvp : components) {
+		kvp.second->rows.clear();
+		kvp.second->updateVersions(0, 0);
 	}
 	numEntities = 0;
 	entities.clear();
+	queueQueryEvent(false, removed);
 	mutex.unlock();
+	world->destroyEntities(removed);
+}
+
+void Archetype::setComponents(std::vector<uint32_t> const& entities, std::string const& componentType, std::vector<LuaVal> const& values) {
+	ComponentList* list = getComponentList(componentType);
+	if (list == nullptr) return;
+	lock_shared();
+	for (size_t i = 0; i < entities.size() && i < values.size(); i++) {
+		uint32_t row = this->entities.indexOf(entities[i]);
+		if (row != SparseSet::INVALID_INDEX)
+			list->setRow(row, values[i]);
+	}
+	unlock_shared();
+}
+
+Archetype* Archetype::getAddTransition(std::string const& componentType) {
+	uint32_t id = ComponentRegistry::getId(componentType);
+	if (signature.test(id)) return this;
+
+	transitionsMutex.lock();
+	auto it = addTransitions.find(id);
+	if (it != addTransitions.end()) {
+		Archetype* archetype = it->second;
+		transitionsMutex.unlock();
+		return archetype;
+	}
+	transitionsMutex.unlock();
+
+	std::unordered_set<std::string> types = componentTypes;
+	types.insert(componentType);
+	Archetype* archetype = world->getArchetype(types, sharedComponents);
+
+	transitionsMutex.lock();
+	addTransitions[id] = archetype;
+	transitionsMutex.unlock();
+	// Also cache the edge back to us
+	archetype->transitionsMutex.lock();
+	archetype->removeTransitions[id] = this;
+	archetype->transitionsMutex.unlock();
+	return archetype;
+}
+
+Archetype* Archetype::getRemoveTransition(std::string const& componentType) {
+	uint32_t id = ComponentRegistry::getId(componentType);
+	if (!signature.test(id)) return this;
+
+	transitionsMutex.lock();
+	auto it = removeTransitions.find(id);
+	if (it != removeTransitions.end()) {
+		Archetype* archetype = it->second;
+		transitionsMutex.unlock();
+		return archetype;
+	}
+	transitionsMutex.unlock();
+
+	std::unordered_set<std::string> types = componentTypes;
+	types.erase(componentType);
+	Archetype* archetype = world->getArchetype(types, sharedComponents);
+
+	transitionsMutex.lock();
+	removeTransitions[id] = archetype;
+	transitionsMutex.unlock();
+	// Also cache the edge back to us
+	archetype->transitionsMutex.lock();
+	archetype->addTransitions[id] = this;
+	archetype->transitionsMutex.unlock();
+	return archetype;
+}
+
+void Archetype::moveEntities(std::vector<uint32_t> const& entities, Archetype* destination, std::string const& componentType, std::vector<LuaVal> const& values) {
+	// If the destination is ourselves then the component already exists and we just need to set it
+	if (destination == this) {
+		if (!componentType.empty())
+			setComponents(entities, componentType, values);
+		return;
+	}
+
+	// Always lock the two archetypes in the same order so opposite moves can't deadlock
+	Archetype* first = this < destination ? this : destination;
+	Archetype* second = this < destination ? destination : this;
+	if (!first->lockExclusive()) return;
+	if (!second->lockExclusive()) {
+		first->mutex.unlock();
+		return;
+	}
+
+	std::vector<uint32_t> moved;
+	moved.reserve(entities.size());
+	uint32_t index = destination->entities.size();
+	for (size_t i = 0; i < entities.size(); i++) {
+		uint32_t entity = entities[i];
+		uint32_t row = this->entities.indexOf(entity);
+		if (row == SparseSet::INVALID_INDEX || destination->entities.contains(entity))
+			continue;
+
+		for (auto& kvp : destination->components) {
+			auto it = components.find(kvp.first);
+			if (it != components.end())
+				kvp.second->rows.emplace_back(std::move(it->second->rows[row]));
+			else if (kvp.first == componentType && i < values.size())
+				kvp.second->rows.emplace_back(values[i]);
+			else
+				kvp.second->rows.emplace_back(LuaVal({}));
+		}
+		destination->entities.insert(entity);
+		eraseEntity(entity);
+		moved.push_back(entity);
+	}
+	for (auto& kvp : destination->components)
+		kvp.second->updateVersions(index, destination->entities.size());
+	numEntities = this->entities.size();
+	destination->numEntities = destination->entities.size();
+
+	// Entities only enter or leave a query if just one of the two archetypes matches it
+	auto sourceQueries = std::atomic_load(&queries);
+	auto destinationQueries = std::atomic_load(&destination->queries);
+	for (EntityQuery* query : *sourceQueries)
+		if (query->hasCallbacks() && std::find(destinationQueries->begin(), destinationQueries->end(), query) == destinationQueries->end())
+			query->queueEvent(false, moved);
+	for (EntityQuery* query : *destinationQueries)
+		if (query->hasCallbacks() && std::find(sourceQueries->begin(), sourceQueries->end(), query) == sourceQueries->end())
+			query->queueEvent(true, moved);
+
+	second->mutex.unlock();
+	first->mutex.unlock();
+
+	world->setEntityArchetypes(moved, destination);
+}
+
+bool Archetype::eraseEntity(uint32_t entity) {
+	// The set moves its last entity into the removed entity's index, so we do the same with each row
+	uint32_t row = entities.erase(entity);
+	if (row == SparseSet::INVALID_INDEX)
+		return false;
+	for (auto& kvp : components) {
+		auto& rows = kvp.second->rows;
+		bool swapped = row != rows.size() - 1;
+		if (swapped)
+			rows[row] = std::move(rows.back());
+		rows.pop_back();
+		// The swapped in row counts as changed, so iterators over changed rows don't miss it
+		kvp.second->updateVersions(row, swapped ? row + 1 : row);
+	}
+	return true;
+}
+
+void Archetype::queueQueryEvent(bool added, std::vector<uint32_t> const& entities) {
+	for (EntityQuery* query : *std::atomic_load(&queries))
+		if (query->hasCallbacks())
+			query->queueEvent(added, entities);
+}
+
+bool Archetype::hasQueryCallbacks() {
+	auto snapshot = std::atomic_load(&queries);
+	return std::any_of(snapshot->begin(), snapshot->end(), [](EntityQuery* query) { return query->hasCallbacks(); });
+}
+
+bool Archetype::lockExclusive() {
+	// Waiting for the exclusive lock while this thread holds us shared would never return, which is easy to do by
+	// making structural changes from an each job or while iterating. Complain instead of hanging
+	if (heldShared(this)) {
+		Debugger::addLog(DEBUG_LEVEL_ERROR, "[WORLD] Entities can't be added to or removed from an archetype while it's being iterated on the same thread, use commands instead");
+		return false;
+	}
+	mutex.lock();
+	return true;
 }
 
 void Archetype::lock_shared() {
+	// Taking a shared_mutex again on a thread that already holds it can deadlock behind a waiting writer,
+	// and component access takes this inside scripts that already hold it, so we count instead
+	for (auto& held : sharedLocks) {
+		if (held.first == this) {
+			held.second++;
+			return;
+		}
+	}
 	mutex.lock_shared();
+	sharedLocks.emplace_back(this, 1);
 }
 
 void Archetype::unlock_shared() {
-	mutex.unlock_shared();
+	for (size_t i = 0; i < sharedLocks.size(); i++) {
+		if (sharedLocks[i].first != this) continue;
+		if (--sharedLocks[i].second == 0) {
+			sharedLocks[i] = sharedLocks.back();
+			sharedLocks.pop_back();
+			mutex.unlock_shared();
+		}
+		return;
+	}
+	assert(false && "Unlocking an archetype this thread doesn't hold");
 }
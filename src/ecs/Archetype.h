@@ -1,15 +1,20 @@
 #pragma once
 
 #include <atomic>
+#include <memory>
 #include <unordered_map>
 #include <array>
 #include <numeric>
-#include <set>
+#include <vector>
 #include <unordered_set>
+#include <mutex>
 #include <shared_mutex>
 
 #include <vulkan/vulkan.h>
 
+#include "ComponentRegistry.h"
+#include "SparseSet.h"
+
 #define SOL_ALL_SAFETIES_ON 1
 #define SOL_DEFAULT_PASS_ON_ERROR 1
 #include <sol\sol.hpp>
@@ -19,14 +24,18 @@ namespace vecs {
 	// Forward Declarations
 	class World;
 	struct Component;
+	class ComponentList;
 	class EntityQuery;
 	class LuaVal;
 	
 	class Archetype {
 	public:
 		std::unordered_set<std::string> componentTypes;
-		// TODO replace this with a bitset? (worse with a large number of small archetypes, better with small number of large archetypes)
-		std::set<uint32_t> entities;
+		// Bitsets of the ids of our component types and shared component types, used for matching queries
+		ComponentSignature signature;
+		ComponentSignature sharedSignature;
+		// The entity stored in each row of our component lists. The index of an entity in this set is its row
+		SparseSet entities;
 
 		LuaVal* sharedComponents;
 		std::atomic_uint32_t numEntities = 0;
@@ -34,26 +43,69 @@ namespace vecs {
 
 		Archetype(World* world, std::unordered_set<std::string> componentTypes, LuaVal* sharedComponents = nullptr);
 
+		World* getWorld() const { return world; }
+
 		LuaVal getSharedComponent(std::string componentType);
-		LuaVal getComponentList(std::string componentType);
+		ComponentList* getComponentList(std::string componentType);
 
 		bool checkQuery(EntityQuery* query);
+		// Called by the world when a query matches us, so we can tell it when entities enter or leave.
+		// The world serializes calls to this
+		void addQuery(EntityQuery* query);
 
-		// Returns pair of data representing the first entity's id and index within this archetype
-		std::pair<uint32_t, uint32_t> createEntities(uint32_t amount);
+		// Returns the new entities' ids in the order their rows were added. Destroyed ids are reused, so they aren't
+		// necessarily consecutive
+		std::vector<uint32_t> createEntities(uint32_t amount);
+		// Initializes each component from prototype, which maps component types to values. Tables are copied
+		// for each entity so they don't share state. Components not in the prototype start as empty tables
+		std::vector<uint32_t> createEntities(uint32_t amount, LuaVal const& prototype);
+		// Moves in a whole column of values per component type. Columns shorter than amount are padded with empty tables
+		std::vector<uint32_t> createEntities(uint32_t amount, std::unordered_map<std::string, std::vector<LuaVal>>& columns);
 
 		void addEntities(std::vector<uint32_t> entities);
+		// Removed rows are filled by moving the last row into their place, so row order isn't stable
 		void removeEntities(std::vector<uint32_t> entities);
 		void clearEntities();
 
+		// Sets a component for many entities with a single shared lock, so other rows can still be read and written.
+		// values is parallel to entities
+		void setComponents(std::vector<uint32_t> const& entities, std::string const& componentType, std::vector<LuaVal> const& values);
+
+		// Returns the archetype with the same components as this one but with the given component type added
+		// or removed. These are cached so repeated structural changes don't need to search the world's archetypes
+		Archetype* getAddTransition(std::string const& componentType);
+		Archetype* getRemoveTransition(std::string const& componentType);
+		// Moves entities and their components into another archetype, keeping their ids, with a single
+		// lock of each archetype. Components the destination has that we don't are set to the matching
+		// entry of values if componentType is that component, or an empty table otherwise
+		void moveEntities(std::vector<uint32_t> const& entities, Archetype* destination, std::string const& componentType = "", std::vector<LuaVal> const& values = {});
+
 		// Used for ensuring iterations over this entity don't occur whilst entities are added or removed
-		// This is used because some jobs may iterate over entities and last between frames
+		// This is used because some jobs may iterate over entities and last between frames.
+		// Component access and iteration lock us themselves, so holding this is only needed to keep several
+		// accesses consistent with each other. A thread can take it more than once without deadlocking
 		void lock_shared();
 		void unlock_shared();
 
 	private:
 		World* world;
 
-		std::unordered_map<std::string, LuaVal> components;
+		std::unordered_map<std::string, ComponentList*> components;
+
+		// Queries that match us. Like EntityQuery's archetype list this is an immutable snapshot that gets replaced
+		// when a query is added, so adding a query never has to wait on a job holding our lock
+		std::shared_ptr<const std::vector<EntityQuery*>> queries = std::make_shared<const std::vector<EntityQuery*>>();
+
+		std::unordered_map<uint32_t, Archetype*> addTransitions;
+		std::unordered_map<uint32_t, Archetype*> removeTransitions;
+		std::mutex transitionsMutex;
+
+		// Locks mutex exclusively, unless this thread already holds it shared, in which case it logs an error and returns false
+		bool lockExclusive();
+		// Removes an entity's row, without locking
+		bool eraseEntity(uint32_t entity);
+		// Queues added or removed events on each of our queries that has callbacks
+		void queueQueryEvent(bool added, std::vector<uint32_t> const& entities);
+		bool hasQueryCallbacks();
 	};
 }
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace vecs {
+
+	// An array stored as fixed-size blocks of 2^SHIFT elements rather than one contiguous allocation.
+	// Growing only ever allocates a new block, so existing elements are never copied or moved, and
+	// each block is a contiguous run that can be handed to a job or versioned as a unit
+	template<typename T, uint32_t SHIFT>
+	class BlockArray {
+	public:
+		static const uint32_t BLOCK_SIZE = 1u << SHIFT;
+		static const uint32_t BLOCK_MASK = BLOCK_SIZE - 1u;
+
+		BlockArray() {}
+		BlockArray(const BlockArray&) = delete;
+		BlockArray& operator=(const BlockArray&) = delete;
+
+		T& operator[](size_t index) { return blocks[index >> SHIFT][index & BLOCK_MASK]; }
+		T const& operator[](size_t index) const { return blocks[index >> SHIFT][index & BLOCK_MASK]; }
+		T& back() { return (*this)[count - 1]; }
+
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+		size_t numBlocks() const { return (count + BLOCK_SIZE - 1) >> SHIFT; }
+
+		template<typename... Args>
+		T& emplace_back(Args&&... args) {
+			if ((count >> SHIFT) >= blocks.size())
+				blocks.emplace_back(new T[BLOCK_SIZE]);
+			T& element = (*this)[count++];
+			element = T(std::forward<Args>(args)...);
+			return element;
+		}
+
+		void pop_back() {
+			assert(count > 0);
+			// Reset the element so whatever it held is released now rather than when it's overwritten.
+			// The block itself is kept around since it's likely to be refilled
+			(*this)[--count] = T();
+		}
+
+		void reserve(size_t amount) {
+			while ((blocks.size() << SHIFT) < amount)
+				blocks.emplace_back(new T[BLOCK_SIZE]);
+		}
+
+		void clear() {
+			blocks.clear();
+			count = 0;
+		}
+
+	private:
+		std::vector<std::unique_ptr<T[]>> blocks;
+		size_t count = 0;
+	};
+}
@@ -0,0 +1,191 @@
+#include "ComponentList.h"
+
+#include "Archetype.h"
+#include "World.h"
+#include "../util/StripedMutex.h"
+
+using namespace vecs;
+
+namespace {
+	// Shared by every component list, each row picks its stripe by its address
+	StripedMutex rowLocks;
+
+	// Writers can finish out of order, so a block's version is only ever raised
+	void stampBlock(std::atomic_uint32_t& blockVersion, uint32_t version) {
+		uint32_t current = blockVersion.load();
+		while (current < version && !blockVersion.compare_exchange_weak(current, version));
+	}
+}
+
+ComponentList::ComponentList(Archetype* archetype) {
+	this->archetype = archetype;
+}
+
+LuaVal ComponentList::get(uint32_t entity) const {
+	archetype->lock_shared();
+	uint32_t row = archetype->entities.indexOf(entity);
+	LuaVal value = row == SparseSet::INVALID_INDEX ? LuaVal() : getRow(row);
+	archetype->unlock_shared();
+	return value;
+}
+
+sol::object ComponentList::get_lua(uint32_t entity, sol::this_state const& s) const {
+	// Converted after unlocking, since that may run lua
+	return get(entity).asObject(s);
+}
+
+void ComponentList::set(uint32_t entity, LuaVal const& value) {
+	archetype->lock_shared();
+	uint32_t row = archetype->entities.indexOf(entity);
+	// Entities can only be added to an archetype through it, not by setting a component
+	assert(row != SparseSet::INVALID_INDEX);
+	setRow(row, value);
+	archetype->unlock_shared();
+}
+
+void ComponentList::set_lua(uint32_t entity, sol::object const& value) {
+	set(entity, LuaVal::asLuaVal(value));
+}
+
+bool ComponentList::contains(uint32_t entity) const {
+	archetype->lock_shared();
+	bool contains = archetype->entities.contains(entity);
+	archetype->unlock_shared();
+	return contains;
+}
+
+uint32_t ComponentList::getLength() const {
+	archetype->lock_shared();
+	uint32_t length = rows.size();
+	archetype->unlock_shared();
+	return length;
+}
+
+LuaVal ComponentList::getRow(uint32_t row) const {
+	std::shared_lock<std::shared_mutex> lock(rowLocks.get(&rows[row]));
+	return rows[row];
+}
+
+void ComponentList::setRow(uint32_t row, LuaVal const& value) {
+	{
+		std::unique_lock<std::shared_mutex> lock(rowLocks.get(&rows[row]));
+		rows[row] = value;
+	}
+	claimRow(row);
+	markChanged(row);
+}
+
+uint32_t ComponentList::getBlockVersion(uint32_t block) const {
+	return block < blockVersions.size() ? blockVersions[block].load() : 0;
+}
+
+void ComponentList::markChanged(uint32_t row) {
+	uint32_t block = row >> BLOCK_SHIFT;
+	if (block < blockVersions.size())
+		stampBlock(blockVersions[block], archetype->getWorld()->changeVersion.load());
+}
+
+void ComponentList::markChanged(uint32_t entity, LuaVal::MapType const* table) {
+	archetype->lock_shared();
+	uint32_t row = archetype->entities.indexOf(entity);
+	if (row != SparseSet::INVALID_INDEX) {
+		LuaVal value = getRow(row);
+		if (value.type == LUA_TYPE_TABLE && value.as<LuaVal::MapType*>() == table)
+			markChanged(row);
+	}
+	archetype->unlock_shared();
+}
+
+void ComponentList::claimRow(uint32_t row) {
+	LuaVal value = getRow(row);
+	if (value.type != LUA_TYPE_TABLE) return;
+	LuaVal::MapType* table = value.as<LuaVal::MapType*>();
+	std::unique_lock<std::shared_mutex> lock(LuaVal::getTableLock(table));
+	table->owner = this;
+	table->ownerEntity = archetype->entities[row];
+}
+
+void ComponentList::updateVersions(uint32_t start, uint32_t end) {
+	size_t numBlocks = rows.numBlocks();
+	// std::atomic can't be moved, so we grow and shrink one block at a time rather than resizing
+	while (blockVersions.size() < numBlocks)
+		blockVersions.emplace_back(0);
+	while (blockVersions.size() > numBlocks)
+		blockVersions.pop_back();
+
+	if (start >= end) return;
+	for (uint32_t row = start; row < end; row++)
+		claimRow(row);
+	uint32_t version = archetype->getWorld()->changeVersion.load();
+	for (uint32_t block = start >> BLOCK_SHIFT; block <= (end - 1) >> BLOCK_SHIFT && block < numBlocks; block++)
+		stampBlock(blockVersions[block], version);
+}
+
+uint32_t ComponentList::nextChangedRow(Iterator& it) const {
+	// Same as next, step back if the entity we last returned was swapped out of its row
+	if (it.entity != 0 && it.row - 1 < rows.size() && archetype->entities[it.row - 1] != it.entity)
+		it.row--;
+
+	while (it.row < it.end && it.row < rows.size()) {
+		uint32_t block = it.row >> BLOCK_SHIFT;
+		if (getBlockVersion(block) > it.version) {
+			uint32_t row = it.row++;
+			it.entity = archetype->entities[row];
+			return row;
+		}
+		// Skip the rest of the unchanged block
+		it.row = (block + 1) << BLOCK_SHIFT;
+	}
+	return SparseSet::INVALID_INDEX;
+}
+
+std::tuple<sol::object, sol::object> ComponentList::next(Archetype* archetype, ComponentList const* list, Iterator& it, sol::this_state const& s) {
+	// Each step locks the archetype on its own, so entities can be added or removed between steps
+	archetype->lock_shared();
+	// If the entity we last returned was removed then another entity was swapped into its row,
+	// so we step back to visit it. Entity 0 is invalid so it means we haven't returned anything yet
+	if (it.entity != 0 && it.row - 1 < list->rows.size() && archetype->entities[it.row - 1] != it.entity)
+		it.row--;
+
+	if (it.row < it.end && it.row < list->rows.size()) {
+		uint32_t row = it.row++;
+		it.entity = archetype->entities[row];
+		LuaVal value = list->getRow(row);
+		archetype->unlock_shared();
+		return std::make_tuple(sol::make_object(sol::state_view(s), it.entity), value.asObject(s));
+	}
+	archetype->unlock_shared();
+
+	sol::state_view lua(s);
+	return { sol::make_object(lua, sol::lua_nil), sol::make_object(lua, sol::lua_nil) };
+}
+
+std::tuple<sol::object, ComponentList::Iterator> ComponentList::iterate(sol::this_state const& s) const {
+	return iterate_range(0, rows.size(), s);
+}
+
+std::tuple<sol::object, ComponentList::Iterator> ComponentList::iterate_range(uint32_t start, uint32_t end, sol::this_state const& s) const {
+	auto func = [s, archetype = archetype, list = this](Iterator& it)->std::tuple<sol::object, sol::object> {
+		return next(archetype, list, it, s);
+	};
+	return std::make_tuple(sol::make_object(sol::state_view(s), func), Iterator{ start, end, 0, 0 });
+}
+
+std::tuple<sol::object, sol::object> ComponentList::nextChanged(Archetype* archetype, ComponentList const* list, Iterator& it, sol::this_state const& s) {
+	archetype->lock_shared();
+	uint32_t row = list->nextChangedRow(it);
+	LuaVal value = row == SparseSet::INVALID_INDEX ? LuaVal() : list->getRow(row);
+	archetype->unlock_shared();
+	if (row != SparseSet::INVALID_INDEX)
+		return std::make_tuple(sol::make_object(sol::state_view(s), it.entity), value.asObject(s));
+
+	sol::state_view lua(s);
+	return { sol::make_object(lua, sol::lua_nil), sol::make_object(lua, sol::lua_nil) };
+}
+
+std::tuple<sol::object, ComponentList::Iterator> ComponentList::changedSince(uint32_t version, sol::this_state const& s) const {
+	auto func = [s, archetype = archetype, list = this](Iterator& it)->std::tuple<sol::object, sol::object> {
+		return nextChanged(archetype, list, it, s);
+	};
+	return std::make_tuple(sol::make_object(sol::state_view(s), func), Iterator{ 0, (uint32_t)rows.size(), 0, version });
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "BlockArray.h"
+#include "../lua/LuaVal.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <tuple>
+#include <vector>
+
+#define SOL_ALL_SAFETIES_ON 1
+#define SOL_DEFAULT_PASS_ON_ERROR 1
+#include <sol\sol.hpp>
+
+namespace vecs {
+
+	// Forward Declarations
+	class Archetype;
+
+	// Stores one component type for every entity in an archetype. Rows are kept dense and in the
+	// same order as the archetype's entity list, so iterating walks contiguous memory instead of
+	// the nodes of a tree, and an entity's component is found through the archetype's row index.
+	// Rows are stored in fixed-size blocks (1024 rows, 16KiB of LuaVals) that each remember the world's
+	// change version when they were last written, so systems can skip over blocks that haven't changed since
+	// they last ran. Writing a component's table in place (e.g. chunk.valid = true) counts as writing its row,
+	// but writing a table nested inside it doesn't, so set the component or its field again after changing those.
+	// Parallel jobs are split along the same block boundaries.
+	// Each row is guarded by a striped lock, and the functions below also hold the archetype shared, so
+	// workers can write different rows while others iterate without anyone locking the whole archetype
+	class ComponentList {
+	public:
+		static const uint32_t BLOCK_SHIFT = 10;
+		static const uint32_t BLOCK_SIZE = 1u << BLOCK_SHIFT;
+
+		// State for iterating over the list from lua. We remember which entity we last returned
+		// so that deleting it mid-iteration (which swaps the last row into its place) doesn't
+		// cause the swapped in entity to be skipped
+		struct Iterator {
+			uint32_t row;
+			uint32_t end;
+			uint32_t entity;
+			// Only used when iterating changed rows
+			uint32_t version;
+		};
+
+		BlockArray<LuaVal, BLOCK_SHIFT> rows;
+
+		ComponentList(Archetype* archetype);
+
+		// get and set based on entity id
+		LuaVal get(uint32_t entity) const;
+		sol::object get_lua(uint32_t entity, sol::this_state const& s) const;
+		void set(uint32_t entity, LuaVal const& value);
+		void set_lua(uint32_t entity, sol::object const& value);
+		bool contains(uint32_t entity) const;
+		uint32_t getLength() const;
+
+		// Read and write a row directly, locking just that row. The archetype needs to be held shared, so the row can't move
+		LuaVal getRow(uint32_t row) const;
+		void setRow(uint32_t row, LuaVal const& value);
+
+		// iterate_range takes a range of rows [start, end), as created by jobs.createParallel
+		std::tuple<sol::object, Iterator> iterate(sol::this_state const& s) const;
+		std::tuple<sol::object, Iterator> iterate_range(uint32_t start, uint32_t end, sol::this_state const& s) const;
+		// Only visits rows in blocks written after the given version, e.g. a system's lastRunVersion.
+		// Blocks are coarse so some unchanged rows will be visited too
+		std::tuple<sol::object, Iterator> changedSince(uint32_t version, sol::this_state const& s) const;
+
+		uint32_t getBlockVersion(uint32_t block) const;
+		// Marks a row as written with the world's current change version. Call this after the write, so a
+		// reader taking a new version in between either sees the write now or sees the block as changed next time
+		void markChanged(uint32_t row);
+		// Marks the entity's row as changed if it still holds the table. LuaVal calls this when a table we own is written
+		void markChanged(uint32_t entity, LuaVal::MapType const* table);
+		// Resizes our block versions to fit our rows, and marks rows [start, end) as changed, taking ownership of
+		// any tables in them. Only call this when the archetype is locked exclusively and the rows' entities are
+		// in its entity list, as the number of blocks may change
+		void updateVersions(uint32_t start, uint32_t end);
+
+		// Advances the iterator to the next row in a block changed after it.version and returns it, or returns
+		// SparseSet::INVALID_INDEX once there are none left. EntityQuery uses this to iterate many archetypes
+		uint32_t nextChangedRow(Iterator& it) const;
+
+	private:
+		Archetype* archetype;
+		std::deque<std::atomic_uint32_t> blockVersions;
+
+		// Makes the table in a row, if there is one, mark the row as changed when it's written
+		void claimRow(uint32_t row);
+
+		static std::tuple<sol::object, sol::object> next(Archetype* archetype, ComponentList const* list, Iterator& it, sol::this_state const& s);
+		static std::tuple<sol::object, sol::object> nextChanged(Archetype* archetype, ComponentList const* list, Iterator& it, sol::this_state const& s);
+	};
+}
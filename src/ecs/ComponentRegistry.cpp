@@ -0,0 +1,59 @@
+#include "ComponentRegistry.h"
+
+#include <stdexcept>
+
+using namespace vecs;
+
+std::unordered_map<std::string, uint32_t> ComponentRegistry::ids = std::unordered_map<std::string, uint32_t>();
+std::vector<std::string> ComponentRegistry::names = std::vector<std::string>();
+std::shared_mutex ComponentRegistry::mutex;
+
+uint32_t ComponentRegistry::getId(std::string const& componentType) {
+	mutex.lock_shared();
+	auto it = ids.find(componentType);
+	if (it != ids.end()) {
+		uint32_t id = it->second;
+		mutex.unlock_shared();
+		return id;
+	}
+	mutex.unlock_shared();
+
+	mutex.lock();
+	// Check again in case another thread registered it while we were waiting for the lock
+	it = ids.find(componentType);
+	if (it != ids.end()) {
+		uint32_t id = it->second;
+		mutex.unlock();
+		return id;
+	}
+	if (names.size() >= MAX_COMPONENT_TYPES) {
+		mutex.unlock();
+		throw std::runtime_error("Unable to register component type \"" + componentType + "\", the maximum of " + std::to_string(MAX_COMPONENT_TYPES) + " component types has been reached");
+	}
+	uint32_t id = names.size();
+	ids[componentType] = id;
+	names.push_back(componentType);
+	mutex.unlock();
+	return id;
+}
+
+std::string ComponentRegistry::getName(uint32_t id) {
+	mutex.lock_shared();
+	std::string name = id < names.size() ? names[id] : "";
+	mutex.unlock_shared();
+	return name;
+}
+
+ComponentSignature ComponentRegistry::getSignature(std::unordered_set<std::string> const& componentTypes) {
+	ComponentSignature signature;
+	for (auto& componentType : componentTypes)
+		signature.set(getId(componentType));
+	return signature;
+}
+
+ComponentSignature ComponentRegistry::getSignature(std::vector<std::string> const& componentTypes) {
+	ComponentSignature signature;
+	for (auto& componentType : componentTypes)
+		signature.set(getId(componentType));
+	return signature;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace vecs {
+
+	// Upper limit on how many distinct component types can be used across all worlds
+	static const uint32_t MAX_COMPONENT_TYPES = 256;
+
+	// Set of component types, with the bit for each type's id set
+	typedef std::bitset<MAX_COMPONENT_TYPES> ComponentSignature;
+
+	// Hands out small integer ids for component type names, shared by every world,
+	// so that archetypes and queries can compare sets of components as bitsets instead of strings
+	class ComponentRegistry {
+	public:
+		// Returns the id for a component type, registering it if it hasn't been seen before
+		static uint32_t getId(std::string const& componentType);
+		static std::string getName(uint32_t id);
+
+		static ComponentSignature getSignature(std::unordered_set<std::string> const& componentTypes);
+		static ComponentSignature getSignature(std::vector<std::string> const& componentTypes);
+
+	private:
+		static std::unordered_map<std::string, uint32_t> ids;
+		static std::vector<std::string> names;
+		static std::shared_mutex mutex;
+	};
+}
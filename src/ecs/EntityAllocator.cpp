@@ -0,0 +1,141 @@
+#include "EntityAllocator.h"
+
+#include <stdexcept>
+#include <string>
+
+using namespace vecs;
+
+EntityAllocator::EntityAllocator() {
+	for (uint32_t i = 0; i < MAX_PAGES; i++)
+		pages[i] = nullptr;
+}
+
+EntityAllocator::~EntityAllocator() {
+	for (uint32_t i = 0; i < MAX_PAGES; i++)
+		delete[] pages[i].load();
+}
+
+uint32_t EntityAllocator::create() {
+	uint32_t entity;
+	if (popFree(entity))
+		return entity;
+	// New indices always have a generation of 0, so their handles equal their index
+	return allocateIndices(1);
+}
+
+std::vector<uint32_t> EntityAllocator::create(uint32_t amount) {
+	std::vector<uint32_t> entities;
+	entities.reserve(amount);
+	uint32_t entity;
+	while (entities.size() < amount && popFree(entity))
+		entities.push_back(entity);
+	if (entities.size() == amount)
+		return entities;
+
+	uint32_t remaining = amount - (uint32_t)entities.size();
+	uint32_t firstIndex;
+	try {
+		firstIndex = allocateIndices(remaining);
+	} catch (...) {
+		// Nobody has seen the handles we took yet, so they can go straight back on the free list
+		for (uint32_t reused : entities)
+			pushFree(getEntityIndex(reused));
+		throw;
+	}
+	for (uint32_t index = firstIndex; index < firstIndex + remaining; index++)
+		entities.push_back(index);
+	return entities;
+}
+
+void EntityAllocator::destroy(uint32_t entity) {
+	uint32_t index = getEntityIndex(entity);
+	Slot* slot = getSlot(index);
+	if (slot == nullptr) return;
+
+	uint32_t generation = getEntityGeneration(entity);
+	if (!slot->generation.compare_exchange_strong(generation, (generation + 1) & ENTITY_GENERATION_MASK, std::memory_order_acq_rel))
+		return;
+	slot->archetype.store(nullptr, std::memory_order_release);
+	pushFree(index);
+}
+
+bool EntityAllocator::isAlive(uint32_t entity) const {
+	Slot* slot = getSlot(getEntityIndex(entity));
+	return slot != nullptr && slot->generation.load(std::memory_order_acquire) == getEntityGeneration(entity);
+}
+
+Archetype* EntityAllocator::getArchetype(uint32_t entity) const {
+	Slot* slot = getSlot(getEntityIndex(entity));
+	if (slot == nullptr || slot->generation.load(std::memory_order_acquire) != getEntityGeneration(entity))
+		return nullptr;
+	return slot->archetype.load(std::memory_order_acquire);
+}
+
+void EntityAllocator::setArchetype(uint32_t entity, Archetype* archetype) {
+	Slot* slot = getSlot(getEntityIndex(entity));
+	if (slot == nullptr || slot->generation.load(std::memory_order_acquire) != getEntityGeneration(entity))
+		return;
+	slot->archetype.store(archetype, std::memory_order_release);
+}
+
+bool EntityAllocator::popFree(uint32_t& entity) {
+	uint64_t head = freeHead.load(std::memory_order_acquire);
+	while ((uint32_t)head != 0) {
+		uint32_t index = (uint32_t)head;
+		Slot* slot = getSlot(index);
+		uint64_t newHead = (((head >> 32) + 1) << 32) | slot->nextFree.load(std::memory_order_relaxed);
+		if (freeHead.compare_exchange_weak(head, newHead, std::memory_order_acq_rel, std::memory_order_acquire)) {
+			entity = (slot->generation.load(std::memory_order_relaxed) << ENTITY_INDEX_BITS) | index;
+			return true;
+		}
+	}
+	return false;
+}
+
+void EntityAllocator::pushFree(uint32_t index) {
+	Slot* slot = getSlot(index);
+	uint64_t head = freeHead.load(std::memory_order_relaxed);
+	uint64_t newHead;
+	do {
+		slot->nextFree.store((uint32_t)head, std::memory_order_relaxed);
+		newHead = (((head >> 32) + 1) << 32) | index;
+	} while (!freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed));
+}
+
+uint32_t EntityAllocator::allocateIndices(uint32_t amount) {
+	// Only advance nextIndex if the whole range fits, so running out once doesn't use up the indices for good
+	uint32_t firstIndex = nextIndex.load(std::memory_order_relaxed);
+	do {
+		if ((uint64_t)firstIndex + amount - 1 > ENTITY_INDEX_MASK)
+			throw std::runtime_error("Unable to create entities, all " + std::to_string(ENTITY_INDEX_MASK) + " entity indices have been allocated and not enough have been freed");
+	} while (!nextIndex.compare_exchange_weak(firstIndex, firstIndex + amount, std::memory_order_relaxed));
+	for (uint32_t index = firstIndex; index < firstIndex + amount; index++)
+		getOrCreateSlot(index);
+	return firstIndex;
+}
+
+EntityAllocator::Slot* EntityAllocator::getSlot(uint32_t index) const {
+	if (index == 0 || index > ENTITY_INDEX_MASK) return nullptr;
+	Slot* page = pages[index >> PAGE_SHIFT].load(std::memory_order_acquire);
+	if (page == nullptr) return nullptr;
+	return &page[index & (PAGE_SIZE - 1)];
+}
+
+EntityAllocator::Slot* EntityAllocator::getOrCreateSlot(uint32_t index) {
+	std::atomic<Slot*>& pageRef = pages[index >> PAGE_SHIFT];
+	Slot* page = pageRef.load(std::memory_order_acquire);
+	if (page == nullptr) {
+		Slot* newPage = new Slot[PAGE_SIZE];
+		for (uint32_t i = 0; i < PAGE_SIZE; i++) {
+			newPage[i].generation.store(0, std::memory_order_relaxed);
+			newPage[i].nextFree.store(0, std::memory_order_relaxed);
+			newPage[i].archetype.store(nullptr, std::memory_order_relaxed);
+		}
+		// Another thread may have created the page at the same time, in which case we use theirs
+		if (pageRef.compare_exchange_strong(page, newPage, std::memory_order_acq_rel))
+			page = newPage;
+		else
+			delete[] newPage;
+	}
+	return &page[index & (PAGE_SIZE - 1)];
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace vecs {
+
+	// Forward Declarations
+	class Archetype;
+
+	// Entity handles pack an index and a generation into 32 bits. Indices get reused after an entity is
+	// destroyed, and the generation is incremented each time so handles to the destroyed entity can be detected
+	static const uint32_t ENTITY_INDEX_BITS = 22;
+	static const uint32_t ENTITY_INDEX_MASK = (1u << ENTITY_INDEX_BITS) - 1u;
+	static const uint32_t ENTITY_GENERATION_MASK = (1u << (32 - ENTITY_INDEX_BITS)) - 1u;
+
+	inline uint32_t getEntityIndex(uint32_t entity) { return entity & ENTITY_INDEX_MASK; }
+	inline uint32_t getEntityGeneration(uint32_t entity) { return entity >> ENTITY_INDEX_BITS; }
+
+	// Hands out entity handles for a world and tracks which archetype each live entity is in.
+	// Destroyed indices go onto a lock-free free list so ids stay dense no matter how many
+	// short-lived entities (e.g. input events) get created over a session
+	class EntityAllocator {
+	public:
+		EntityAllocator();
+		~EntityAllocator();
+
+		// Returns a new entity handle, reusing a destroyed index if there is one
+		uint32_t create();
+		// Returns amount new entity handles, reusing destroyed indices before allocating new ones,
+		// so the handles are only consecutive if nothing was free
+		std::vector<uint32_t> create(uint32_t amount);
+		// Does nothing if the handle is stale
+		void destroy(uint32_t entity);
+		bool isAlive(uint32_t entity) const;
+
+		// Returns nullptr for stale handles or entities that aren't in an archetype yet
+		Archetype* getArchetype(uint32_t entity) const;
+		void setArchetype(uint32_t entity, Archetype* archetype);
+
+	private:
+		struct Slot {
+			std::atomic_uint32_t generation;
+			std::atomic_uint32_t nextFree;
+			std::atomic<Archetype*> archetype;
+		};
+
+		static const uint32_t PAGE_SHIFT = 12;
+		static const uint32_t PAGE_SIZE = 1u << PAGE_SHIFT;
+		static const uint32_t MAX_PAGES = (ENTITY_INDEX_MASK + 1u) >> PAGE_SHIFT;
+
+		// Slots are allocated a page at a time so they never move once created
+		std::atomic<Slot*> pages[MAX_PAGES];
+		// Start at 1 so that 0 can be used to represent an invalid entity
+		std::atomic_uint32_t nextIndex = 1;
+		// The low 32 bits are the index at the top of the free list (0 when empty),
+		// and the high 32 bits are incremented on every change to avoid the ABA problem
+		std::atomic_uint64_t freeHead = 0;
+
+		// Returns false if the free list is empty
+		bool popFree(uint32_t& entity);
+		void pushFree(uint32_t index);
+		// Reserves amount never used indices, throwing std::runtime_error if we've run out
+		uint32_t allocateIndices(uint32_t amount);
+		Slot* getSlot(uint32_t index) const;
+		Slot* getOrCreateSlot(uint32_t index);
+	};
+}
@@ -0,0 +1,47 @@
+#include "EntityCommandBuffer.h"
+
+#include "World.h"
+
+#include <algorithm>
+#include <iterator>
+
+using namespace vecs;
+
+uint32_t EntityCommandBuffer::createEntity(World* world, Archetype* archetype) {
+	uint32_t entity = world->createEntity();
+	record({ ENTITY_COMMAND_CREATE, world, entity, archetype, "", LuaVal() });
+	return entity;
+}
+
+void EntityCommandBuffer::deleteEntity(World* world, uint32_t entity) {
+	record({ ENTITY_COMMAND_DELETE, world, entity, nullptr, "", LuaVal() });
+}
+
+void EntityCommandBuffer::set(World* world, uint32_t entity, std::string const& componentType, LuaVal const& value) {
+	record({ ENTITY_COMMAND_SET, world, entity, nullptr, componentType, value });
+}
+
+void EntityCommandBuffer::addComponent(World* world, uint32_t entity, std::string const& componentType, LuaVal const& value) {
+	record({ ENTITY_COMMAND_ADD_COMPONENT, world, entity, nullptr, componentType, value });
+}
+
+void EntityCommandBuffer::removeComponent(World* world, uint32_t entity, std::string const& componentType) {
+	record({ ENTITY_COMMAND_REMOVE_COMPONENT, world, entity, nullptr, componentType, LuaVal() });
+}
+
+std::vector<EntityCommand> EntityCommandBuffer::take(World* world) {
+	std::vector<EntityCommand> taken;
+	mutex.lock();
+	// Commands for other worlds (e.g. one that's currently loading) stay in the buffer
+	auto it = std::stable_partition(commands.begin(), commands.end(), [world](EntityCommand const& command) { return command.world != world; });
+	taken.insert(taken.end(), std::make_move_iterator(it), std::make_move_iterator(commands.end()));
+	commands.erase(it, commands.end());
+	mutex.unlock();
+	return taken;
+}
+
+void EntityCommandBuffer::record(EntityCommand command) {
+	mutex.lock();
+	commands.emplace_back(std::move(command));
+	mutex.unlock();
+}
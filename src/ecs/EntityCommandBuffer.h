@@ -0,0 +1,57 @@
+#pragma once
+
+#include "../lua/LuaVal.h"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace vecs {
+
+	// Forward Declarations
+	class Archetype;
+	class World;
+
+	enum EntityCommandType {
+		ENTITY_COMMAND_CREATE,
+		ENTITY_COMMAND_DELETE,
+		ENTITY_COMMAND_SET,
+		ENTITY_COMMAND_ADD_COMPONENT,
+		ENTITY_COMMAND_REMOVE_COMPONENT
+	};
+
+	struct EntityCommand {
+		EntityCommandType type;
+		World* world;
+		uint32_t entity;
+		// Only used by create commands
+		Archetype* archetype;
+		// Only used by set, add and remove commands
+		std::string componentType;
+		LuaVal value;
+	};
+
+	// Records structural changes to entities made from jobs so they can be applied in bulk by the world
+	// at the end of its update, instead of each one taking an archetype's exclusive lock while other jobs
+	// are iterating over it. Each worker has its own buffer so recording never contends with other workers
+	class EntityCommandBuffer {
+	public:
+		// The entity id is reserved immediately, but it won't exist in the archetype until the commands are played back
+		uint32_t createEntity(World* world, Archetype* archetype);
+		void deleteEntity(World* world, uint32_t entity);
+		void set(World* world, uint32_t entity, std::string const& componentType, LuaVal const& value);
+		void addComponent(World* world, uint32_t entity, std::string const& componentType, LuaVal const& value);
+		void removeComponent(World* world, uint32_t entity, std::string const& componentType);
+
+		// Removes and returns all the commands recorded for the given world, in the order they were recorded
+		std::vector<EntityCommand> take(World* world);
+
+	private:
+		std::vector<EntityCommand> commands;
+		// Only contended when the world is taking our commands
+		std::mutex mutex;
+
+		void record(EntityCommand command);
+	};
+}
@@ -1,20 +1,214 @@
 #include "EntityQuery.h"
+
+#include "Archetype.h"
+#include "ComponentList.h"
 #include "World.h"
+#include "../engine/Debugger.h"
+#include "../lua/FunctionCache.h"
+#include "../lua/LuaVal.h"
 
 using namespace vecs;
 
 void ComponentFilter::with(std::string component) {
-	required.insert(component);
+	required.set(ComponentRegistry::getId(component));
 }
 
 void ComponentFilter::with(std::vector<std::string> components) {
-	required.insert(components.begin(), components.end());
+	required |= ComponentRegistry::getSignature(components);
 }
 
 void ComponentFilter::without(std::string component) {
-	disallowed.insert(component);
+	disallowed.set(ComponentRegistry::getId(component));
 }
 
 void ComponentFilter::without(std::vector<std::string> components) {
-	disallowed.insert(components.begin(), components.end());
+	disallowed |= ComponentRegistry::getSignature(components);
+}
+
+std::shared_ptr<const EntityQuery::ArchetypeList> EntityQuery::getArchetypes() const {
+	return std::atomic_load(&matchingArchetypes);
+}
+
+void EntityQuery::addArchetype(Archetype* archetype) {
+	// Writers are serialized by our mutex, readers just load whichever snapshot is current
+	archetypesMutex.lock();
+	auto archetypes = std::make_shared<ArchetypeList>(*std::atomic_load(&matchingArchetypes));
+	archetypes->push_back(archetype);
+	std::atomic_store(&matchingArchetypes, std::shared_ptr<const ArchetypeList>(std::move(archetypes)));
+	archetypesMutex.unlock();
+}
+
+std::tuple<sol::object, EntityQuery::ChangedIterator> EntityQuery::changedSince(std::string componentType, uint32_t version, sol::this_state const& s) {
+	// The iterator keeps the snapshot alive for as long as it's being used
+	auto func = [s, archetypes = getArchetypes(), componentType](ChangedIterator& it)->std::tuple<sol::object, sol::object> {
+		while (it.archetype < archetypes->size()) {
+			Archetype* archetype = (*archetypes)[it.archetype];
+			ComponentList* list = archetype->getComponentList(componentType);
+			if (list != nullptr) {
+				archetype->lock_shared();
+				ComponentList::Iterator rows{ it.row, UINT32_MAX, it.entity, it.version };
+				uint32_t row = list->nextChangedRow(rows);
+				it.row = rows.row;
+				it.entity = rows.entity;
+				LuaVal value = row == SparseSet::INVALID_INDEX ? LuaVal() : list->getRow(row);
+				archetype->unlock_shared();
+				if (row != SparseSet::INVALID_INDEX)
+					return std::make_tuple(sol::make_object(sol::state_view(s), it.entity), value.asObject(s));
+			}
+			// Move on to the next archetype
+			it.archetype++;
+			it.row = 0;
+			it.entity = 0;
+		}
+
+		sol::state_view lua(s);
+		return { sol::make_object(lua, sol::lua_nil), sol::make_object(lua, sol::lua_nil) };
+	};
+	return std::make_tuple(sol::make_object(sol::state_view(s), func), ChangedIterator{ 0, 0, 0, version });
+}
+
+void EntityQuery::each(std::vector<std::string> componentTypes, sol::function const& function, sol::this_state const& s) {
+	for (Archetype* archetype : *getArchetypes()) {
+		std::vector<ComponentList*> lists;
+		if (!getComponentLists(archetype, componentTypes, lists)) continue;
+		if (!eachRange(archetype, lists, 0, UINT32_MAX, function, nullptr, s)) return;
+	}
+}
+
+bool EntityQuery::getComponentLists(Archetype* archetype, std::vector<std::string> const& componentTypes, std::vector<ComponentList*>& lists) {
+	lists.clear();
+	lists.reserve(componentTypes.size());
+	for (auto& componentType : componentTypes) {
+		ComponentList* list = archetype->getComponentList(componentType);
+		if (list == nullptr) return false;
+		lists.push_back(list);
+	}
+	return true;
+}
+
+bool EntityQuery::eachRange(Archetype* archetype, std::vector<ComponentList*> const& lists, uint32_t start, uint32_t end, sol::protected_function const& function, LuaVal* data, lua_State* L) {
+	sol::state_view lua(L);
+	sol::this_state s{ L };
+	std::vector<sol::object> args;
+	args.reserve(lists.size() + 2);
+
+	uint32_t row = start;
+	uint32_t entity = 0;
+	std::vector<LuaVal> values(lists.size());
+	while (true) {
+		// Each row locks on its own, unless the caller already holds the archetype
+		archetype->lock_shared();
+		// Same as ComponentList::next, step back if the entity we last passed was removed and another swapped into its row
+		if (entity != 0 && row - 1 < archetype->entities.size() && archetype->entities[row - 1] != entity)
+			row--;
+		if (row >= end || row >= archetype->entities.size()) {
+			archetype->unlock_shared();
+			return true;
+		}
+
+		entity = archetype->entities[row];
+		for (size_t i = 0; i < lists.size(); i++)
+			values[i] = lists[i]->getRow(row);
+		archetype->unlock_shared();
+
+		args.clear();
+		if (data != nullptr)
+			args.push_back(sol::make_object(lua, data));
+		args.push_back(sol::make_object(lua, entity));
+		for (LuaVal const& value : values)
+			args.push_back(value.asObject(s));
+
+		auto result = function(sol::as_args(args));
+		if (!result.valid()) {
+			sol::error err = result;
+			Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA][QUERY] " + std::string(err.what()));
+			return false;
+		}
+		row++;
+	}
+}
+
+void EntityQuery::setOnAdd(sol::function const& function, LuaVal* data) {
+	eventsMutex.lock();
+	onAddFunction = function.dump();
+	// dispatchEvents works from its own copy, so the old data isn't in use
+	delete onAddData;
+	onAddData = new LuaVal(*data);
+	callbacksSet = true;
+	eventsMutex.unlock();
+}
+
+void EntityQuery::setOnRemove(sol::function const& function, LuaVal* data) {
+	eventsMutex.lock();
+	onRemoveFunction = function.dump();
+	// dispatchEvents works from its own copy, so the old data isn't in use
+	delete onRemoveData;
+	onRemoveData = new LuaVal(*data);
+	callbacksSet = true;
+	eventsMutex.unlock();
+}
+
+void EntityQuery::setNativeCallback(std::function<void(bool, std::vector<uint32_t> const&)> callback) {
+	eventsMutex.lock();
+	nativeCallback = callback;
+	callbacksSet = true;
+	eventsMutex.unlock();
+}
+
+void EntityQuery::queueEvent(bool added, std::vector<uint32_t> const& entities) {
+	if (entities.empty()) return;
+
+	eventsMutex.lock();
+	if (!nativeCallback && (added ? onAddData == nullptr : onRemoveData == nullptr)) {
+		eventsMutex.unlock();
+		return;
+	}
+	// Merge with the last event if it's the same kind, so the callback gets one bigger batch
+	if (!events.empty() && events.back().added == added)
+		events.back().entities.insert(events.back().entities.end(), entities.begin(), entities.end());
+	else events.push_back({ added, entities });
+	eventsMutex.unlock();
+}
+
+void EntityQuery::dispatchEvents(FunctionCache& functions) {
+	eventsMutex.lock();
+	if (events.empty()) {
+		eventsMutex.unlock();
+		return;
+	}
+	std::vector<QueryEvent> pending;
+	pending.swap(events);
+	// The callbacks can be replaced while we're calling them, so call copies taken under the lock
+	auto native = nativeCallback;
+	bool hasAdd = onAddData != nullptr;
+	bool hasRemove = onRemoveData != nullptr;
+	sol::bytecode addFunction = onAddFunction;
+	sol::bytecode removeFunction = onRemoveFunction;
+	LuaVal addData = hasAdd ? *onAddData : LuaVal();
+	LuaVal removeData = hasRemove ? *onRemoveData : LuaVal();
+	eventsMutex.unlock();
+
+	for (auto& event : pending) {
+		if (native)
+			native(event.added, event.entities);
+
+		// The native callback may be the only reason this event was queued
+		if (!(event.added ? hasAdd : hasRemove))
+			continue;
+		sol::bytecode& function = event.added ? addFunction : removeFunction;
+		// Lua gets its own copy, since it can hold onto it after our copies are gone
+		LuaVal data = event.added ? addData : removeData;
+
+		std::string error;
+		sol::protected_function loaded = functions.load(function.as_string_view(), error);
+		if (!loaded.valid()) {
+			Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA][QUERY] " + error);
+			continue;
+		}
+		auto result = loaded(std::move(data), sol::as_table(event.entities));
+		if (!result.valid()) {
+			sol::error err = result;
+			Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA][QUERY] " + std::string(err.what()));
+		}
+	}
 }
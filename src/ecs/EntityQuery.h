@@ -1,16 +1,28 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <typeindex>
 #include <set>
 #include <unordered_map>
 #include <unordered_set>
 #include <functional>
+#include <memory>
+#include <mutex>
+
+#include "ComponentRegistry.h"
+
+#define SOL_ALL_SAFETIES_ON 1
+#define SOL_DEFAULT_PASS_ON_ERROR 1
+#include <sol\sol.hpp>
 
 namespace vecs {
 
 	// Forward Declarations
 	class Archetype;
+	class ComponentList;
+	class FunctionCache;
+	class LuaVal;
 
 	// This class describes a filter for finding only specific entities
 	class ComponentFilter {
@@ -24,16 +36,77 @@ namespace vecs {
 		void without(std::vector<std::string> components);
 
 	private:
-		std::set<std::string> required;
-		std::set<std::string> disallowed;
+		ComponentSignature required;
+		ComponentSignature disallowed;
 	};
 
 	// This becomes a container to track entities matching the filter
 	class EntityQuery {
 	public:
+		// State for iterating changed rows across all our archetypes. The row fields mirror ComponentList::Iterator
+		struct ChangedIterator {
+			uint32_t archetype;
+			uint32_t row;
+			uint32_t entity;
+			uint32_t version;
+		};
+
+		typedef std::vector<Archetype*> ArchetypeList;
+
 		ComponentFilter filter;
 		ComponentFilter sharedFilter;
 
-		std::vector<Archetype*> matchingArchetypes;
+		// Returns an immutable snapshot of the archetypes matching us. Archetypes added after this is called won't
+		// be in it, but it's safe to keep using after they are, so readers never need to lock
+		std::shared_ptr<const ArchetypeList> getArchetypes() const;
+		// Publishes a new snapshot with the archetype added. Only the world calls this
+		void addArchetype(Archetype* archetype);
+
+		// Iterates the given component of every matching entity whose row was written after version,
+		// e.g. changedSince("Chunk", self.lastRunVersion) to only visit chunks changed since the system last ran
+		std::tuple<sol::object, ChangedIterator> changedSince(std::string componentType, uint32_t version, sol::this_state const& s);
+
+		// Calls function(entity, componentA, componentB, ...) for every entity in our archetypes that has all the given
+		// component types, looking up each archetype's component lists once rather than once per entity
+		void each(std::vector<std::string> componentTypes, sol::function const& function, sol::this_state const& s);
+
+		// Fills lists with the archetype's list for each component type, returning false if it's missing any of them
+		static bool getComponentLists(Archetype* archetype, std::vector<std::string> const& componentTypes, std::vector<ComponentList*>& lists);
+		// Calls function for each row in [start, end) with the entity and the row of each list, prepended with data if
+		// it isn't null (which is how jobs get their data). Returns false if the function errored
+		static bool eachRange(Archetype* archetype, std::vector<ComponentList*> const& lists, uint32_t start, uint32_t end, sol::protected_function const& function, LuaVal* data, lua_State* L);
+
+		// Lua functions to call with (data, entities) when entities enter or leave our archetypes, so systems can
+		// keep derived state up to date without re-scanning. They're called in batches at the end of the world's update
+		void setOnAdd(sol::function const& function, LuaVal* data);
+		void setOnRemove(sol::function const& function, LuaVal* data);
+		// Same as the lua callbacks but for native systems, called with whether the entities were added or removed
+		void setNativeCallback(std::function<void(bool, std::vector<uint32_t> const&)> callback);
+		bool hasCallbacks() const { return callbacksSet; }
+
+		// Archetypes call this as entities enter or leave, if we have callbacks
+		void queueEvent(bool added, std::vector<uint32_t> const& entities);
+		// Calls our callbacks for every queued event, in the order they happened
+		void dispatchEvents(FunctionCache& functions);
+
+	private:
+		// Replaced rather than modified, so readers holding an older snapshot are unaffected
+		std::shared_ptr<const ArchetypeList> matchingArchetypes = std::make_shared<const ArchetypeList>();
+		std::mutex archetypesMutex;
+
+		struct QueryEvent {
+			bool added;
+			std::vector<uint32_t> entities;
+		};
+
+		sol::bytecode onAddFunction;
+		LuaVal* onAddData = nullptr;
+		sol::bytecode onRemoveFunction;
+		LuaVal* onRemoveData = nullptr;
+		std::function<void(bool, std::vector<uint32_t> const&)> nativeCallback;
+		std::atomic_bool callbacksSet = false;
+
+		std::vector<QueryEvent> events;
+		std::mutex eventsMutex;
 	};
 }
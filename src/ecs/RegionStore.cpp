@@ -0,0 +1,369 @@
+#include "RegionStore.h"
+
+#include "../engine/Debugger.h"
+#include "../jobs/JobQueue.h"
+#include "../jobs/Worker.h"
+#include "../lua/LuaValStream.h"
+
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+
+using namespace vecs;
+
+namespace {
+	const char MAGIC[4] = { 'V', 'R', 'E', 'G' };
+	// Each slot is written as a 64 bit offset and a 32 bit size, after the magic and version
+	const uint64_t SLOT_SIZE = sizeof(uint64_t) + sizeof(uint32_t);
+	const uint64_t HEADER_SIZE = sizeof(MAGIC) + sizeof(uint32_t) + SLOT_SIZE * RegionStore::CHUNKS_PER_REGION;
+
+	template<typename T>
+	void writeRaw(std::ostream& file, T const& value) {
+		file.write((const char*)&value, sizeof(T));
+	}
+
+	template<typename T>
+	T readRaw(std::istream& file) {
+		T value{};
+		file.read((char*)&value, sizeof(T));
+		return value;
+	}
+}
+
+RegionStore::RegionStore(std::filesystem::path directory, LuaVal const& palette) {
+	this->directory = directory;
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+	if (error)
+		Debugger::addLog(DEBUG_LEVEL_ERROR, "[WORLD] Unable to create region directory " + directory.string() + ": " + error.message());
+
+	// Tables iterate in whatever order keys were added, so the keys are sorted to keep their indices stable
+	if (palette.type == LUA_TYPE_TABLE) {
+		for (auto kvp : *palette.as<LuaVal::MapType*>()) {
+			if (kvp.second.type == LUA_TYPE_ARCHETYPE)
+				paletteKeys.push_back(kvp.first);
+		}
+		std::sort(paletteKeys.begin(), paletteKeys.end());
+		for (auto& key : paletteKeys) {
+			Archetype* archetype = palette.as<LuaVal::MapType*>()->find(key)->second.as<Archetype*>();
+			paletteIndices[archetype] = (uint32_t)paletteArchetypes.size();
+			paletteArchetypes.push_back(archetype);
+		}
+	}
+}
+
+RegionStore::~RegionStore() {
+	flush();
+}
+
+glm::ivec3 RegionStore::getRegionPosition(glm::ivec3 position) {
+	// Shifting rounds towards negative infinity, so negative chunks end up in the right region
+	return glm::ivec3(position.x >> REGION_SHIFT, position.y >> REGION_SHIFT, position.z >> REGION_SHIFT);
+}
+
+uint32_t RegionStore::getSlotIndex(glm::ivec3 position) {
+	glm::ivec3 local = position & (REGION_SIZE - 1);
+	return (local.x * REGION_SIZE + local.y) * REGION_SIZE + local.z;
+}
+
+void RegionStore::save(Worker* worker, glm::ivec3 position, LuaVal const& chunk) {
+	pendingMutex.lock();
+	pending[position] = { chunk, nextSequence++ };
+	pendingMutex.unlock();
+
+	// The job keeps us alive, in case the world is unloaded before it runs
+	Job* job = worker->allocateJob();
+	job->type = JOB_TYPE_NATIVE;
+	job->world = worker->getWorld();
+	job->data = nullptr;
+	job->extra = new std::function<void()>([store = shared_from_this(), position]() { store->write(position); });
+	job->parent = nullptr;
+	job->unfinishedJobs = 1;
+	// Disk writes can take a while, so we don't want the frame to wait on them
+	job->persistent = true;
+	job->continuationCount = 0;
+	worker->pushJob(job);
+}
+
+LuaVal RegionStore::load(glm::ivec3 position) {
+	pendingMutex.lock();
+	auto it = pending.find(position);
+	if (it != pending.end()) {
+		// Copied so the caller can modify it without changing what gets written
+		LuaVal chunk = it->second.chunk.clone();
+		pendingMutex.unlock();
+		return chunk;
+	}
+	pendingMutex.unlock();
+
+	Region* region = getRegion(getRegionPosition(position));
+	if (region == nullptr)
+		return LuaVal();
+
+	std::string data;
+	region->mutex.lock();
+	Slot slot = region->slots[getSlotIndex(position)];
+	if (slot.size > 0 && openFile(region)) {
+		data.resize(slot.size);
+		region->file.seekg(slot.offset);
+		region->file.read(data.data(), slot.size);
+		if (!region->file) {
+			region->file.clear();
+			data.clear();
+		}
+	}
+	region->mutex.unlock();
+
+	if (data.empty())
+		return LuaVal();
+	return decode(data);
+}
+
+bool RegionStore::contains(glm::ivec3 position) {
+	pendingMutex.lock();
+	bool isPending = pending.count(position) > 0;
+	pendingMutex.unlock();
+	if (isPending)
+		return true;
+
+	Region* region = getRegion(getRegionPosition(position));
+	if (region == nullptr)
+		return false;
+	region->mutex.lock();
+	bool saved = region->slots[getSlotIndex(position)].size > 0;
+	region->mutex.unlock();
+	return saved;
+}
+
+void RegionStore::flush() {
+	pendingMutex.lock();
+	std::vector<glm::ivec3> positions;
+	positions.reserve(pending.size());
+	for (auto& kvp : pending)
+		positions.push_back(kvp.first);
+	pendingMutex.unlock();
+
+	for (auto& position : positions)
+		write(position);
+}
+
+RegionStore::Region* RegionStore::getRegion(glm::ivec3 regionPosition) {
+	std::lock_guard<std::mutex> lock(regionsMutex);
+	auto it = regions.find(regionPosition);
+	if (it != regions.end())
+		return it->second.get();
+
+	std::filesystem::path path = directory / (std::to_string(regionPosition.x) + "." + std::to_string(regionPosition.y) + "." + std::to_string(regionPosition.z) + ".region");
+	auto region = std::make_unique<Region>();
+	region->path = path;
+	if (!std::filesystem::exists(path)) {
+		// Create an empty region, with every slot's offset and size set to 0
+		std::ofstream create(path, std::ios::binary);
+		create.write(MAGIC, sizeof(MAGIC));
+		uint32_t version = VERSION;
+		create.write((const char*)&version, sizeof(version));
+		std::vector<char> slots(SLOT_SIZE * CHUNKS_PER_REGION, 0);
+		create.write(slots.data(), slots.size());
+	}
+
+	region->file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+	char magic[sizeof(MAGIC)] = {};
+	region->file.read(magic, sizeof(magic));
+	uint32_t version = readRaw<uint32_t>(region->file);
+	if (!region->file || !std::equal(magic, magic + sizeof(magic), MAGIC) || version == 0 || version > VERSION) {
+		Debugger::addLog(DEBUG_LEVEL_ERROR, "[WORLD] Unable to open region file " + path.string());
+		// Remember the failure so we don't try again for every chunk in the region
+		regions[regionPosition] = nullptr;
+		return nullptr;
+	}
+	for (uint32_t i = 0; i < CHUNKS_PER_REGION; i++) {
+		region->slots[i].offset = readRaw<uint64_t>(region->file);
+		region->slots[i].size = readRaw<uint32_t>(region->file);
+	}
+	if (version < VERSION) {
+		// Chunks we write from now on use the newer encoding, so older versions of the game shouldn't try to read them
+		region->file.seekp(sizeof(MAGIC));
+		writeRaw(region->file, (uint32_t)VERSION);
+		region->file.flush();
+	}
+	region->file.seekg(0, std::ios::end);
+	region->end = std::max((uint64_t)region->file.tellg(), HEADER_SIZE);
+
+	Region* result = region.get();
+	regions[regionPosition] = std::move(region);
+	markUsed(result);
+	return result;
+}
+
+bool RegionStore::openFile(Region* region) {
+	if (!region->file.is_open()) {
+		region->file.clear();
+		region->file.open(region->path, std::ios::binary | std::ios::in | std::ios::out);
+		if (!region->file.is_open()) {
+			Debugger::addLog(DEBUG_LEVEL_ERROR, "[WORLD] Unable to open region file " + region->path.string());
+			return false;
+		}
+	}
+	std::lock_guard<std::mutex> lock(regionsMutex);
+	markUsed(region);
+	return true;
+}
+
+void RegionStore::markUsed(Region* region) {
+	if (region->open)
+		openRegions.erase(region->recent);
+	openRegions.push_front(region);
+	region->recent = openRegions.begin();
+	region->open = true;
+
+	// We already hold regionsMutex, and regions in use lock theirs before taking it, so we only try to lock theirs.
+	// Ones that are in use are about to be marked used anyway
+	auto it = openRegions.end();
+	while (openRegions.size() > MAX_OPEN_REGIONS && --it != openRegions.begin()) {
+		Region* idle = *it;
+		if (!idle->mutex.try_lock())
+			continue;
+		idle->file.close();
+		idle->open = false;
+		it = openRegions.erase(it);
+		idle->mutex.unlock();
+	}
+}
+
+void RegionStore::compact(Region* region) {
+	std::vector<std::string> chunks(CHUNKS_PER_REGION);
+	for (uint32_t i = 0; i < CHUNKS_PER_REGION; i++) {
+		if (region->slots[i].size == 0) continue;
+		chunks[i].resize(region->slots[i].size);
+		region->file.seekg(region->slots[i].offset);
+		region->file.read(chunks[i].data(), chunks[i].size());
+		if (!region->file) {
+			// Leave it as it is, it's only wasting space
+			Debugger::addLog(DEBUG_LEVEL_ERROR, "[WORLD] Unable to read region file " + region->path.string() + " to compact it");
+			region->file.clear();
+			return;
+		}
+	}
+
+	// Written to a new file that replaces the old one, so nothing is lost if we're stopped partway through
+	Slot slots[CHUNKS_PER_REGION];
+	uint64_t end = HEADER_SIZE;
+	std::filesystem::path temporary = region->path;
+	temporary += ".tmp";
+	{
+		std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+		out.write(MAGIC, sizeof(MAGIC));
+		writeRaw(out, (uint32_t)VERSION);
+		for (uint32_t i = 0; i < CHUNKS_PER_REGION; i++) {
+			slots[i] = { chunks[i].empty() ? 0 : end, (uint32_t)chunks[i].size() };
+			end += chunks[i].size();
+			writeRaw(out, slots[i].offset);
+			writeRaw(out, slots[i].size);
+		}
+		for (auto& chunk : chunks)
+			out.write(chunk.data(), chunk.size());
+		if (!out) {
+			Debugger::addLog(DEBUG_LEVEL_ERROR, "[WORLD] Unable to write compacted region file " + temporary.string());
+			out.close();
+			std::error_code error;
+			std::filesystem::remove(temporary, error);
+			return;
+		}
+	}
+
+	// Files can't be replaced while they're open on every platform
+	region->file.close();
+	std::error_code error;
+	std::filesystem::rename(temporary, region->path, error);
+	if (error)
+		Debugger::addLog(DEBUG_LEVEL_ERROR, "[WORLD] Unable to replace region file " + region->path.string() + ": " + error.message());
+	else {
+		std::copy(slots, slots + CHUNKS_PER_REGION, region->slots);
+		region->end = end;
+	}
+	region->file.clear();
+	region->file.open(region->path, std::ios::binary | std::ios::in | std::ios::out);
+}
+
+void RegionStore::write(glm::ivec3 position) {
+	pendingMutex.lock();
+	auto it = pending.find(position);
+	if (it == pending.end()) {
+		// Already written, by flush or an earlier job
+		pendingMutex.unlock();
+		return;
+	}
+	PendingChunk chunk = it->second;
+	pendingMutex.unlock();
+
+	Region* region = getRegion(getRegionPosition(position));
+	if (region != nullptr) {
+		std::string data = encode(chunk.chunk);
+		uint32_t index = getSlotIndex(position);
+
+		region->mutex.lock();
+		if (chunk.sequence > region->sequences[index] && openFile(region)) {
+			region->file.seekp(region->end);
+			region->file.write(data.data(), data.size());
+			region->slots[index] = { region->end, (uint32_t)data.size() };
+			region->sequences[index] = chunk.sequence;
+			region->end += data.size();
+
+			// Only point the header at the chunk once it's written
+			region->file.flush();
+			region->file.seekp(sizeof(MAGIC) + sizeof(uint32_t) + SLOT_SIZE * index);
+			writeRaw(region->file, region->slots[index].offset);
+			writeRaw(region->file, region->slots[index].size);
+			region->file.flush();
+			if (!region->file) {
+				Debugger::addLog(DEBUG_LEVEL_ERROR, "[WORLD] Failed to write chunk to region file");
+				region->file.clear();
+			}
+
+			uint64_t used = 0;
+			for (auto& slot : region->slots)
+				used += slot.size;
+			uint64_t wasted = region->end - HEADER_SIZE - used;
+			if (wasted >= COMPACT_THRESHOLD && wasted > used)
+				compact(region);
+		}
+		region->mutex.unlock();
+	}
+
+	// A newer save may have replaced ours while we were writing, in which case its job still needs to write it
+	pendingMutex.lock();
+	it = pending.find(position);
+	if (it != pending.end() && it->second.sequence == chunk.sequence)
+		pending.erase(it);
+	pendingMutex.unlock();
+}
+
+std::string RegionStore::encode(LuaVal const& chunk) {
+	std::ostringstream out(std::ios::binary);
+	LuaValWriter writer(out);
+	writer.archetypeIndices = paletteIndices;
+	// The keys are saved with every chunk so they can be matched to whatever archetypes they refer to when loaded
+	writer.write((uint32_t)paletteKeys.size());
+	for (auto& key : paletteKeys)
+		writer.writeValue(key);
+	writer.writeValue(chunk);
+	return out.str();
+}
+
+LuaVal RegionStore::decode(std::string const& data) {
+	try {
+		LuaValReader reader(data.data(), data.size());
+		uint32_t numKeys = reader.read<uint32_t>();
+		for (uint32_t i = 0; i < numKeys; i++) {
+			LuaVal key = reader.readValue();
+			auto it = std::find(paletteKeys.begin(), paletteKeys.end(), key);
+			// Blocks that no longer exist are read as nil
+			reader.archetypes.push_back(it == paletteKeys.end() ? nullptr : paletteArchetypes[it - paletteKeys.begin()]);
+		}
+		return reader.readValue();
+	} catch (std::exception const& e) {
+		Debugger::addLog(DEBUG_LEVEL_ERROR, "[WORLD] Unable to read saved chunk: " + std::string(e.what()));
+		return LuaVal();
+	}
+}
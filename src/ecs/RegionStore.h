@@ -0,0 +1,118 @@
+#pragma once
+
+#include "../lua/LuaVal.h"
+#include "../util/IVec3Hash.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+namespace vecs {
+
+	// Forward Declarations
+	class Archetype;
+	class Worker;
+
+	// Saves chunks to disk so revisiting an area can read them back instead of generating them again.
+	// Chunks are grouped into region files of 8x8x8 chunks, each starting with a table of where each of its chunks
+	// is in the file. Saving a chunk appends it to the end of its region and updates its entry in the table, and once
+	// more of a region is old versions than current ones (and at least COMPACT_THRESHOLD), it's rewritten without them.
+	// So a region is never much bigger than twice its chunks. Only the MAX_OPEN_REGIONS most recently used region files
+	// are kept open, so exploring in one direction doesn't run out of file handles.
+	// Saves are written by a persistent job so the caller never waits on the disk, and loading a chunk that's
+	// still waiting to be written returns the pending version. Each chunk is a LuaVal table, where archetypes
+	// (i.e. blocks) are stored by their key in the palette, so saved chunks stay valid when blocks are added
+	class RegionStore : public std::enable_shared_from_this<RegionStore> {
+	public:
+		static const int32_t REGION_SHIFT = 3;
+		static const int32_t REGION_SIZE = 1 << REGION_SHIFT;
+		static const uint32_t CHUNKS_PER_REGION = REGION_SIZE * REGION_SIZE * REGION_SIZE;
+		// Versions follow LuaVal's encoding, which can read all of its older versions, so older files are still read
+		static const uint32_t VERSION = 3;
+		static const size_t MAX_OPEN_REGIONS = 16;
+		static const uint64_t COMPACT_THRESHOLD = 1 << 20;
+
+		// The palette is a table of keys to archetypes, such as world.resources.blocks
+		RegionStore(std::filesystem::path directory, LuaVal const& palette);
+		// Writes anything that's still pending
+		~RegionStore();
+
+		// Queues the chunk to be written, replacing any earlier version that hasn't been written yet.
+		// The chunk shouldn't be modified afterwards, since it's read when the job runs
+		void save(Worker* worker, glm::ivec3 position, LuaVal const& chunk);
+		// Returns nil if the chunk hasn't been saved. Blocks on disk I/O, so call this from a job
+		LuaVal load(glm::ivec3 position);
+		bool contains(glm::ivec3 position);
+
+		// Writes every pending chunk now, on the calling thread
+		void flush();
+
+	private:
+		struct Slot {
+			uint64_t offset;
+			uint32_t size;
+		};
+
+		struct Region {
+			std::mutex mutex;
+			std::filesystem::path path;
+			// Closed while the region is idle, and opened again by openFile
+			std::fstream file;
+			Slot slots[CHUNKS_PER_REGION];
+			// Sequence number of the save last written to each slot, so an older save finishing late doesn't replace it
+			uint64_t sequences[CHUNKS_PER_REGION] = {};
+			uint64_t end;
+			// Where we are in openRegions while our file is open. Guarded by regionsMutex
+			std::list<Region*>::iterator recent;
+			bool open = false;
+		};
+
+		struct PendingChunk {
+			LuaVal chunk;
+			uint64_t sequence;
+		};
+
+		std::filesystem::path directory;
+
+		// Palette keys in a stable order, and the index of each archetype in it
+		std::vector<LuaVal> paletteKeys;
+		std::vector<Archetype*> paletteArchetypes;
+		std::unordered_map<Archetype*, uint32_t> paletteIndices;
+
+		std::unordered_map<glm::ivec3, std::unique_ptr<Region>, IVec3Hash> regions;
+		// Regions with open files, most recently used first
+		std::list<Region*> openRegions;
+		std::mutex regionsMutex;
+
+		std::unordered_map<glm::ivec3, PendingChunk, IVec3Hash> pending;
+		uint64_t nextSequence = 1;
+		std::mutex pendingMutex;
+
+		static glm::ivec3 getRegionPosition(glm::ivec3 position);
+		static uint32_t getSlotIndex(glm::ivec3 position);
+
+		// Returns nullptr if the region file couldn't be opened
+		Region* getRegion(glm::ivec3 region);
+		// Opens the region's file again if it was closed for being idle, returning false if it couldn't be.
+		// Needs the region's mutex held
+		bool openFile(Region* region);
+		// Moves the region to the front of openRegions, and closes the least recently used files past
+		// MAX_OPEN_REGIONS that nobody is using. Needs regionsMutex held
+		void markUsed(Region* region);
+		// Rewrites the region with only the current version of each chunk. Needs the region's mutex held
+		void compact(Region* region);
+		// Writes the pending version of the chunk, if there still is one
+		void write(glm::ivec3 position);
+
+		std::string encode(LuaVal const& chunk);
+		LuaVal decode(std::string const& data);
+	};
+}
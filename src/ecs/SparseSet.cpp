@@ -0,0 +1,75 @@
+#include "SparseSet.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace vecs;
+
+bool SparseSet::contains(uint32_t id) const {
+	return indexOf(id) != INVALID_INDEX;
+}
+
+uint32_t SparseSet::indexOf(uint32_t id) const {
+	uint32_t* sparse = getSparse(id);
+	// Check the full handle matches since an older generation of the same index may be looked up
+	if (sparse == nullptr || *sparse == INVALID_INDEX || dense[*sparse] != id)
+		return INVALID_INDEX;
+	return *sparse;
+}
+
+uint32_t SparseSet::insert(uint32_t id) {
+	uint32_t* sparse = getOrCreateSparse(id);
+	if (*sparse != INVALID_INDEX) {
+		// Only one generation of an index can be alive at once
+		assert(dense[*sparse] == id);
+		return *sparse;
+	}
+	*sparse = dense.size();
+	dense.push_back(id);
+	return *sparse;
+}
+
+uint32_t SparseSet::erase(uint32_t id) {
+	uint32_t index = indexOf(id);
+	if (index == INVALID_INDEX)
+		return INVALID_INDEX;
+
+	uint32_t* sparse = getSparse(id);
+	uint32_t last = dense.back();
+	dense[index] = last;
+	*getSparse(last) = index;
+	dense.pop_back();
+	*sparse = INVALID_INDEX;
+	return index;
+}
+
+void SparseSet::clear() {
+	// Only reset the entries that are in use rather than every allocated page
+	for (uint32_t id : dense)
+		*getSparse(id) = INVALID_INDEX;
+	dense.clear();
+}
+
+void SparseSet::reserve(size_t amount) {
+	dense.reserve(amount);
+}
+
+uint32_t* SparseSet::getSparse(uint32_t id) const {
+	uint32_t index = getEntityIndex(id);
+	uint32_t page = index >> PAGE_SHIFT;
+	if (page >= pages.size() || !pages[page])
+		return nullptr;
+	return &pages[page][index & PAGE_MASK];
+}
+
+uint32_t* SparseSet::getOrCreateSparse(uint32_t id) {
+	uint32_t index = getEntityIndex(id);
+	uint32_t page = index >> PAGE_SHIFT;
+	if (page >= pages.size())
+		pages.resize(page + 1);
+	if (!pages[page]) {
+		pages[page] = std::unique_ptr<uint32_t[]>(new uint32_t[PAGE_SIZE]);
+		std::fill_n(pages[page].get(), PAGE_SIZE, INVALID_INDEX);
+	}
+	return &pages[page][index & PAGE_MASK];
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "EntityAllocator.h"
+
+namespace vecs {
+
+	// A set of entity ids stored as a dense array of ids plus a sparse lookup from id to its index in
+	// that array. Insertion, removal and lookup are all O(1), and iterating only touches the dense array.
+	// Removing an id moves the last id into its place, which lets archetypes keep their component rows
+	// in the same order as this set by doing the same swap on each row.
+	// The sparse lookup is keyed by the entity's index rather than its full handle, so it stays as small as the
+	// number of live entities. It's split into pages that are only allocated once an index within them is used
+	class SparseSet {
+	public:
+		static const uint32_t INVALID_INDEX = UINT32_MAX;
+
+		SparseSet() {}
+		SparseSet(const SparseSet&) = delete;
+		SparseSet& operator=(const SparseSet&) = delete;
+
+		bool contains(uint32_t id) const;
+		// Returns INVALID_INDEX if the id isn't in the set
+		uint32_t indexOf(uint32_t id) const;
+
+		// Returns the index the id was inserted at, or its existing index if it was already in the set
+		uint32_t insert(uint32_t id);
+		// Returns the index the id was removed from, which now holds what was the last id,
+		// or INVALID_INDEX if the id wasn't in the set
+		uint32_t erase(uint32_t id);
+		void clear();
+		void reserve(size_t amount);
+
+		size_t size() const { return dense.size(); }
+		bool empty() const { return dense.empty(); }
+		uint32_t operator[](size_t index) const { return dense[index]; }
+		std::vector<uint32_t>::const_iterator begin() const { return dense.begin(); }
+		std::vector<uint32_t>::const_iterator end() const { return dense.end(); }
+
+	private:
+		static const uint32_t PAGE_SHIFT = 12;
+		static const uint32_t PAGE_SIZE = 1u << PAGE_SHIFT;
+		static const uint32_t PAGE_MASK = PAGE_SIZE - 1u;
+
+		std::vector<uint32_t> dense;
+		std::vector<std::unique_ptr<uint32_t[]>> pages;
+
+		uint32_t* getSparse(uint32_t id) const;
+		uint32_t* getOrCreateSparse(uint32_t id);
+	};
+}
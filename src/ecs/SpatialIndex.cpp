@@ -0,0 +1,214 @@
+#include "SpatialIndex.h"
+
+#include "Archetype.h"
+#include "ComponentList.h"
+#include "EntityQuery.h"
+#include "World.h"
+#include "../lib/FrustumCull.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace vecs;
+
+namespace {
+	// Bounds with NaNs, infinities or min past max can't overlap anything sensibly
+	bool isValid(glm::vec3 const& min, glm::vec3 const& max) {
+		for (int i = 0; i < 3; i++)
+			if (!std::isfinite(min[i]) || !std::isfinite(max[i]) || min[i] > max[i])
+				return false;
+		return true;
+	}
+}
+
+SpatialIndex::SpatialIndex(World* world) {
+	this->world = world;
+}
+
+glm::ivec3 SpatialIndex::getCell(glm::vec3 position) {
+	// Converting a float that doesn't fit in an int32 is undefined, so clamp while it's still a float
+	glm::vec3 cell = glm::floor(position / CELL_SIZE);
+	glm::ivec3 result;
+	for (int i = 0; i < 3; i++)
+		result[i] = std::isnan(cell[i]) ? 0 : (int32_t)std::min(std::max(cell[i], (float)-MAX_CELL), (float)MAX_CELL);
+	return result;
+}
+
+void SpatialIndex::update() {
+	if (query == nullptr) {
+		query = new EntityQuery();
+		query->filter.with("Bounds");
+		// Entities entering the query get their blocks stamped, so we only need to hear about ones leaving it.
+		// This is called while the world dispatches query events, before we scan for changes below
+		query->setNativeCallback([this](bool added, std::vector<uint32_t> const& entities) {
+			if (added) return;
+			std::unique_lock<std::shared_mutex> lock(mutex);
+			for (uint32_t entity : entities)
+				erase(entity);
+		});
+		world->addQuery(query);
+	}
+
+	// Take the version before scanning, so anything written afterwards is guaranteed to be newer than it
+	uint32_t version = lastUpdateVersion;
+	lastUpdateVersion = world->changeVersion.fetch_add(1);
+
+	// Changes are gathered first so queries only wait on applying them, not on reading every changed row
+	struct Change {
+		uint32_t entity;
+		bool valid;
+		glm::vec3 min;
+		glm::vec3 max;
+	};
+	std::vector<Change> changes;
+	for (Archetype* archetype : *query->getArchetypes()) {
+		ComponentList* bounds = archetype->getComponentList("Bounds");
+		archetype->lock_shared();
+		ComponentList::Iterator it{ 0, (uint32_t)bounds->rows.size(), 0, version };
+		for (uint32_t row = bounds->nextChangedRow(it); row != SparseSet::INVALID_INDEX; row = bounds->nextChangedRow(it)) {
+			LuaVal value = bounds->getRow(row);
+			LuaVal min = value.type == LUA_TYPE_TABLE ? value.get("min") : LuaVal();
+			LuaVal max = value.type == LUA_TYPE_TABLE ? value.get("max") : LuaVal();
+			// Entities whose bounds aren't set yet (or aren't valid) just aren't in the index
+			if (min.type != LUA_TYPE_VEC3 || max.type != LUA_TYPE_VEC3 || !isValid(min.as<glm::vec3>(), max.as<glm::vec3>()))
+				changes.push_back({ it.entity, false });
+			else
+				changes.push_back({ it.entity, true, min.as<glm::vec3>(), max.as<glm::vec3>() });
+		}
+		archetype->unlock_shared();
+	}
+
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	for (auto& change : changes) {
+		if (change.valid)
+			insert(change.entity, change.min, change.max);
+		else
+			erase(change.entity);
+	}
+}
+
+void SpatialIndex::insert(uint32_t entity, glm::vec3 min, glm::vec3 max) {
+	glm::ivec3 minCell = getCell(min);
+	glm::ivec3 maxCell = getCell(max);
+
+	auto existing = entries.find(entity);
+	if (existing != entries.end()) {
+		// Moving within the same cells (which most small movements are) only needs the bounds updated
+		if (existing->second.minCell == minCell && existing->second.maxCell == maxCell) {
+			existing->second.min = min;
+			existing->second.max = max;
+			return;
+		}
+		erase(entity);
+	}
+
+	glm::ivec3 extent = maxCell - minCell + 1;
+	bool large = (uint64_t)extent.x * extent.y * extent.z > MAX_CELLS_PER_ENTITY;
+	entries[entity] = { min, max, minCell, maxCell, large };
+
+	if (large) {
+		largeEntities.push_back(entity);
+		return;
+	}
+	for (int32_t x = minCell.x; x <= maxCell.x; x++)
+		for (int32_t y = minCell.y; y <= maxCell.y; y++)
+			for (int32_t z = minCell.z; z <= maxCell.z; z++)
+				cells[glm::ivec3(x, y, z)].push_back(entity);
+}
+
+void SpatialIndex::erase(uint32_t entity) {
+	auto it = entries.find(entity);
+	if (it == entries.end()) return;
+	Entry& entry = it->second;
+
+	auto removeFrom = [entity](std::vector<uint32_t>& entities) {
+		auto position = std::find(entities.begin(), entities.end(), entity);
+		if (position == entities.end()) return;
+		*position = entities.back();
+		entities.pop_back();
+	};
+
+	if (entry.large)
+		removeFrom(largeEntities);
+	else {
+		for (int32_t x = entry.minCell.x; x <= entry.maxCell.x; x++)
+			for (int32_t y = entry.minCell.y; y <= entry.maxCell.y; y++)
+				for (int32_t z = entry.minCell.z; z <= entry.maxCell.z; z++) {
+					auto cell = cells.find(glm::ivec3(x, y, z));
+					if (cell == cells.end()) continue;
+					removeFrom(cell->second);
+					// Drop empty cells so frustum queries don't keep visiting them
+					if (cell->second.empty())
+						cells.erase(cell);
+				}
+	}
+	entries.erase(it);
+}
+
+template<typename CellTest, typename EntryTest>
+std::vector<uint32_t> SpatialIndex::collect(glm::ivec3 minCell, glm::ivec3 maxCell, CellTest cellTest, EntryTest entryTest) const {
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	std::vector<uint32_t> result;
+	auto visitCell = [&](glm::ivec3 const& position, std::vector<uint32_t> const& entities) {
+		glm::vec3 cellMin = glm::vec3(position) * CELL_SIZE;
+		if (!cellTest(cellMin, cellMin + CELL_SIZE)) return;
+		for (uint32_t entity : entities)
+			if (entryTest(entries.at(entity)))
+				result.push_back(entity);
+	};
+
+	// Walk the cells in range if there are fewer of those than there are non-empty cells, otherwise
+	// walk the non-empty cells and skip the ones out of range
+	// Counted as doubles since an unbounded range doesn't fit in an integer
+	glm::dvec3 extent = glm::dvec3(maxCell) - glm::dvec3(minCell) + 1.0;
+	if (extent.x * extent.y * extent.z <= (double)cells.size()) {
+		for (int32_t x = minCell.x; x <= maxCell.x; x++)
+			for (int32_t y = minCell.y; y <= maxCell.y; y++)
+				for (int32_t z = minCell.z; z <= maxCell.z; z++) {
+					auto cell = cells.find(glm::ivec3(x, y, z));
+					if (cell != cells.end())
+						visitCell(cell->first, cell->second);
+				}
+	} else {
+		for (auto& cell : cells)
+			if (glm::all(glm::greaterThanEqual(cell.first, minCell)) && glm::all(glm::lessThanEqual(cell.first, maxCell)))
+				visitCell(cell.first, cell.second);
+	}
+
+	std::sort(result.begin(), result.end());
+	result.erase(std::unique(result.begin(), result.end()), result.end());
+
+	for (uint32_t entity : largeEntities)
+		if (entryTest(entries.at(entity)))
+			result.push_back(entity);
+	return result;
+}
+
+std::vector<uint32_t> SpatialIndex::queryBox(glm::vec3 min, glm::vec3 max) const {
+	return collect(getCell(min), getCell(max),
+		[](glm::vec3 const& cellMin, glm::vec3 const& cellMax) { return true; },
+		[min, max](Entry const& entry) { return glm::all(glm::lessThanEqual(entry.min, max)) && glm::all(glm::greaterThanEqual(entry.max, min)); }
+	);
+}
+
+std::vector<uint32_t> SpatialIndex::querySphere(glm::vec3 center, float radius) const {
+	// Distance from the closest point of the box to the center, squared
+	auto overlaps = [center, radius](glm::vec3 const& min, glm::vec3 const& max) {
+		glm::vec3 offset = glm::clamp(center, min, max) - center;
+		return glm::dot(offset, offset) <= radius * radius;
+	};
+	return collect(getCell(center - radius), getCell(center + radius),
+		overlaps,
+		[overlaps](Entry const& entry) { return overlaps(entry.min, entry.max); }
+	);
+}
+
+std::vector<uint32_t> SpatialIndex::queryFrustum(Frustum const& frustum) const {
+	// Frustums with an infinite far plane have no useful bounds, so every non-empty cell is tested
+	glm::ivec3 minCell(-MAX_CELL);
+	glm::ivec3 maxCell(MAX_CELL);
+	return collect(minCell, maxCell,
+		[&frustum](glm::vec3 const& cellMin, glm::vec3 const& cellMax) { return frustum.IsBoxVisible(cellMin, cellMax); },
+		[&frustum](Entry const& entry) { return frustum.IsBoxVisible(entry.min, entry.max); }
+	);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include "../util/IVec3Hash.h"
+
+// Forward Declarations
+class Frustum;
+
+namespace vecs {
+
+	// Forward Declarations
+	class EntityQuery;
+	class World;
+
+	// Finds entities by where they are. Entities with a Bounds component ({ min = vec3, max = vec3 }) are put into
+	// each cell of a sparse grid that their bounds overlap, so a query only has to look at the entities in the
+	// cells it overlaps rather than every entity. Only cells with something in them are stored, so the world
+	// can be as big as it likes.
+	// The index is brought up to date at the end of each world update, re-inserting only the entities in
+	// Bounds blocks written since the last update (including writes like bounds.min = ...) and dropping entities
+	// that lost their Bounds. Queries will be a frame behind. Persistent jobs can still be querying while we
+	// update, so queries hold our lock shared, and updates gather their changes before locking it exclusively
+	class SpatialIndex {
+	public:
+		// Width of each grid cell in world units, which fits 2x2x2 of the terrain system's 16 block chunks
+		static constexpr float CELL_SIZE = 32.0f;
+		// Entities overlapping more cells than this are kept in a list that every query checks instead,
+		// so one huge entity doesn't fill thousands of cells
+		static const uint32_t MAX_CELLS_PER_ENTITY = 64;
+		// Cells are clamped to [-MAX_CELL, MAX_CELL] on each axis, so huge or infinite positions still give a
+		// cell we can step through without overflowing. Anything further out than that shares the edge cells
+		static const int32_t MAX_CELL = 1 << 20;
+
+		SpatialIndex(World* world);
+
+		// Only the world calls this, at the end of its update
+		void update();
+
+		// Each returns the entities whose bounds overlap the given shape, in no particular order
+		std::vector<uint32_t> queryBox(glm::vec3 min, glm::vec3 max) const;
+		std::vector<uint32_t> querySphere(glm::vec3 center, float radius) const;
+		std::vector<uint32_t> queryFrustum(Frustum const& frustum) const;
+
+		size_t size() const {
+			std::shared_lock<std::shared_mutex> lock(mutex);
+			return entries.size();
+		}
+
+	private:
+		struct Entry {
+			glm::vec3 min;
+			glm::vec3 max;
+			glm::ivec3 minCell;
+			glm::ivec3 maxCell;
+			bool large;
+		};
+
+		World* world;
+		EntityQuery* query = nullptr;
+		uint32_t lastUpdateVersion = 0;
+
+		std::unordered_map<uint32_t, Entry> entries;
+		std::unordered_map<glm::ivec3, std::vector<uint32_t>, IVec3Hash> cells;
+		std::vector<uint32_t> largeEntities;
+		// Guards entries, cells and largeEntities
+		mutable std::shared_mutex mutex;
+
+		// NaN positions go in cell 0, although update keeps bounds that aren't finite out of the index anyways
+		static glm::ivec3 getCell(glm::vec3 position);
+
+		// These need our lock held exclusively
+		void insert(uint32_t entity, glm::vec3 min, glm::vec3 max);
+		void erase(uint32_t entity);
+
+		// Collects every entity in cells [minCell, maxCell] that passes the test, plus any large ones.
+		// Entities are in every cell they overlap, so the result is sorted to remove duplicates. Locks us shared
+		template<typename CellTest, typename EntryTest>
+		std::vector<uint32_t> collect(glm::ivec3 minCell, glm::ivec3 maxCell, CellTest cellTest, EntryTest entryTest) const;
+	};
+}
@@ -0,0 +1,267 @@
+#include "TransformSystem.h"
+
+#include "Archetype.h"
+#include "ComponentList.h"
+#include "EntityQuery.h"
+#include "World.h"
+#include "../jobs/Worker.h"
+
+#include <algorithm>
+#include <functional>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace vecs;
+
+namespace {
+	const LuaVal positionKey(std::string("position"));
+	const LuaVal rotationKey(std::string("rotation"));
+	const LuaVal scaleKey(std::string("scale"));
+
+	glm::mat4 getLocalMatrix(LuaVal::MapType const& transform) {
+		glm::mat4 local(1.0f);
+		auto it = transform.find(positionKey);
+		if (it != transform.end() && it->second.type == LUA_TYPE_VEC3)
+			local = glm::translate(local, it->second.as<glm::vec3>());
+		it = transform.find(rotationKey);
+		if (it != transform.end()) {
+			if (it->second.type == LUA_TYPE_VEC3) {
+				glm::vec3 rotation = glm::radians(it->second.as<glm::vec3>());
+				local = glm::rotate(local, rotation.z, glm::vec3(0, 0, 1));
+				local = glm::rotate(local, rotation.y, glm::vec3(0, 1, 0));
+				local = glm::rotate(local, rotation.x, glm::vec3(1, 0, 0));
+			} else if (it->second.type == LUA_TYPE_NUMBER)
+				local = glm::rotate(local, glm::radians((float)it->second.as<double>()), glm::vec3(0, 0, 1));
+		}
+		it = transform.find(scaleKey);
+		if (it != transform.end() && it->second.type == LUA_TYPE_VEC3)
+			local = glm::scale(local, it->second.as<glm::vec3>());
+		return local;
+	}
+}
+
+TransformSystem::TransformSystem(World* world) {
+	this->world = world;
+}
+
+void TransformSystem::update(Worker* worker) {
+	if (query == nullptr) {
+		query = new EntityQuery();
+		query->filter.with("Transform");
+		// Entities entering the query get their rows stamped, which checkChanges notices, so we only need to hear about
+		// ones leaving it. Until the world dispatches this at the end of its update they're still computed, which is harmless
+		query->setNativeCallback([this](bool added, std::vector<uint32_t> const& entities) {
+			if (!added) removed = true;
+		});
+		world->addQuery(query);
+	}
+
+	// Take the version before scanning, so anything written afterwards is guaranteed to be newer than it
+	uint32_t version = lastUpdateVersion;
+	lastUpdateVersion = world->changeVersion.fetch_add(1);
+	if (removed.exchange(false) || checkChanges(version))
+		gatherNodes();
+
+	// Waiting on our jobs runs other jobs on this worker, which replaces its current job
+	Job* currentJob = worker->job;
+	for (size_t level = 0; level + 1 < levels.size(); level++) {
+		uint32_t start = levels[level];
+		uint32_t end = levels[level + 1];
+		// Small levels (which most hierarchies are past the roots) aren't worth the overhead of jobs
+		if (end - start <= JOB_SIZE) {
+			computeRange(start, end);
+			continue;
+		}
+
+		Job* levelJob = worker->allocateJob();
+		levelJob->type = JOB_TYPE_DUMMY;
+		levelJob->world = world;
+		levelJob->unfinishedJobs = (end - start + JOB_SIZE - 1) / JOB_SIZE;
+		levelJob->persistent = false;
+		levelJob->parent = nullptr;
+		levelJob->continuationCount = 0;
+
+		for (uint32_t jobStart = start; jobStart < end; jobStart += JOB_SIZE) {
+			uint32_t jobEnd = std::min(jobStart + JOB_SIZE, end);
+			Job* job = worker->allocateJob();
+			job->type = JOB_TYPE_NATIVE;
+			job->world = world;
+			job->data = nullptr;
+			job->extra = new std::function<void()>([this, jobStart, jobEnd]() { computeRange(jobStart, jobEnd); });
+			job->parent = levelJob;
+			job->unfinishedJobs = 1;
+			job->persistent = false;
+			job->continuationCount = 0;
+			worker->pushJob(job);
+		}
+
+		// The next level needs all of this level's matrices
+		while (levelJob->unfinishedJobs > 0)
+			worker->work();
+	}
+	worker->job = currentJob;
+}
+
+int32_t TransformSystem::getNode(uint32_t entity) const {
+	uint32_t index = getEntityIndex(entity);
+	if (index >= entityNodes.size() || entityNodes[index] == -1)
+		return -1;
+	int32_t node = entityNodes[index];
+	// The index may belong to a newer entity than the one the node was for
+	return nodes[node].entity == entity ? node : -1;
+}
+
+bool TransformSystem::getWorldMatrix(uint32_t entity, glm::mat4& matrix) const {
+	int32_t node = getNode(entity);
+	if (node == -1) return false;
+	matrix = worldMatrices[node];
+	return true;
+}
+
+bool TransformSystem::checkChanges(uint32_t version) {
+	for (Archetype* archetype : *query->getArchetypes()) {
+		ComponentList* transforms = archetype->getComponentList("Transform");
+		ComponentList* parents = archetype->getComponentList("Parent");
+		archetype->lock_shared();
+		// Any Parent written since our last update could have moved its entity to another level
+		if (parents != nullptr) {
+			ComponentList::Iterator it{ 0, (uint32_t)parents->rows.size(), 0, version };
+			if (parents->nextChangedRow(it) != SparseSet::INVALID_INDEX) {
+				archetype->unlock_shared();
+				return true;
+			}
+		}
+
+		// Transforms are mostly changed by writing their fields, which we read anyway, but new entities, entities that
+		// moved here from an archetype with a different Parent and replaced Transform tables all need handling
+		ComponentList::Iterator it{ 0, (uint32_t)transforms->rows.size(), 0, version };
+		for (uint32_t row = transforms->nextChangedRow(it); row != SparseSet::INVALID_INDEX; row = transforms->nextChangedRow(it)) {
+			int32_t node = getNode(it.entity);
+			LuaVal transform = transforms->getRow(row);
+			if (transform.type != LUA_TYPE_TABLE) {
+				// Rows that aren't tables are left out of the hierarchy
+				if (node == -1) continue;
+				archetype->unlock_shared();
+				return true;
+			}
+			LuaVal parent = parents != nullptr ? parents->getRow(row) : LuaVal();
+			LuaVal::MapType* parentComponent = parent.type == LUA_TYPE_TABLE ? parent.as<LuaVal::MapType*>() : nullptr;
+			if (node == -1 || nodes[node].parentComponent != parentComponent) {
+				archetype->unlock_shared();
+				return true;
+			}
+			nodes[node].transform = transform.as<LuaVal::MapType*>();
+		}
+		archetype->unlock_shared();
+	}
+	return false;
+}
+
+void TransformSystem::gatherNodes() {
+	struct Entry {
+		uint32_t entity;
+		LuaVal::MapType* transform;
+		LuaVal::MapType* parentComponent;
+		uint32_t parentEntity;
+	};
+	std::vector<Entry> entries;
+	// Holds each entity's entry until they're sorted, then its node
+	entityNodes.clear();
+
+	for (Archetype* archetype : *query->getArchetypes()) {
+		ComponentList* transforms = archetype->getComponentList("Transform");
+		ComponentList* parents = archetype->getComponentList("Parent");
+		archetype->lock_shared();
+		entries.reserve(entries.size() + transforms->rows.size());
+		for (uint32_t row = 0; row < transforms->rows.size(); row++) {
+			LuaVal transform = transforms->getRow(row);
+			if (transform.type != LUA_TYPE_TABLE) continue;
+
+			uint32_t parentEntity = 0;
+			LuaVal parent = parents != nullptr ? parents->getRow(row) : LuaVal();
+			LuaVal::MapType* parentComponent = nullptr;
+			if (parent.type == LUA_TYPE_TABLE) {
+				parentComponent = parent.as<LuaVal::MapType*>();
+				LuaVal entity = parent.get("entity");
+				if (entity.type == LUA_TYPE_NUMBER)
+					parentEntity = (uint32_t)entity.as<double>();
+			}
+			uint32_t entity = archetype->entities[row];
+			uint32_t index = getEntityIndex(entity);
+			if (index >= entityNodes.size())
+				entityNodes.resize(index + 1, -1);
+			entityNodes[index] = entries.size();
+			entries.push_back({ entity, transform.as<LuaVal::MapType*>(), parentComponent, parentEntity });
+		}
+		archetype->unlock_shared();
+	}
+
+	std::vector<int32_t> parentEntries(entries.size(), -1);
+	for (uint32_t i = 0; i < entries.size(); i++) {
+		if (entries[i].parentEntity == 0) continue;
+		uint32_t index = getEntityIndex(entries[i].parentEntity);
+		// Entities whose parent doesn't exist or doesn't have a Transform are treated as roots
+		if (index >= entityNodes.size() || entityNodes[index] == -1) continue;
+		int32_t parent = entityNodes[index];
+		if (entries[parent].entity == entries[i].parentEntity && parent != (int32_t)i)
+			parentEntries[i] = parent;
+	}
+	// Find each entry's depth by walking up to the nearest resolved ancestor (or a root) and back down again.
+	// -1 means unresolved and -2 means we're in the middle of resolving it, which lets us detect and break cycles
+	std::vector<int32_t> depths(entries.size(), -1);
+	std::vector<uint32_t> stack;
+	int32_t maxDepth = -1;
+	for (uint32_t i = 0; i < entries.size(); i++) {
+		uint32_t current = i;
+		while (depths[current] == -1) {
+			depths[current] = -2;
+			stack.push_back(current);
+			int32_t parent = parentEntries[current];
+			if (parent == -1) break;
+			if (depths[parent] == -2) {
+				parentEntries[current] = -1;
+				break;
+			}
+			current = parent;
+		}
+		while (!stack.empty()) {
+			uint32_t entry = stack.back();
+			stack.pop_back();
+			int32_t parent = parentEntries[entry];
+			depths[entry] = parent == -1 ? 0 : depths[parent] + 1;
+			maxDepth = std::max(maxDepth, depths[entry]);
+		}
+	}
+
+	// Counting sort by depth, so each level is contiguous and every parent comes before its children
+	levels.assign(maxDepth + 2, 0);
+	for (int32_t depth : depths)
+		levels[depth + 1]++;
+	for (size_t level = 1; level < levels.size(); level++)
+		levels[level] += levels[level - 1];
+
+	std::vector<uint32_t> offsets(levels.begin(), levels.end() - 1);
+	std::vector<uint32_t> sortedIndices(entries.size());
+	for (uint32_t i = 0; i < entries.size(); i++)
+		sortedIndices[i] = offsets[depths[i]]++;
+
+	nodes.resize(entries.size());
+	for (uint32_t i = 0; i < entries.size(); i++) {
+		nodes[sortedIndices[i]] = { entries[i].entity, entries[i].transform, entries[i].parentComponent, parentEntries[i] == -1 ? -1 : (int32_t)sortedIndices[parentEntries[i]] };
+		entityNodes[getEntityIndex(entries[i].entity)] = sortedIndices[i];
+	}
+	worldMatrices.resize(nodes.size());
+}
+
+void TransformSystem::computeRange(uint32_t start, uint32_t end) {
+	for (uint32_t i = start; i < end; i++) {
+		Node& node = nodes[i];
+		glm::mat4 local;
+		{
+			// Scripts may be writing the same transform on other workers
+			std::shared_lock<std::shared_mutex> lock(LuaVal::getTableLock(node.transform));
+			local = getLocalMatrix(*node.transform);
+		}
+		worldMatrices[i] = node.parent == -1 ? local : worldMatrices[node.parent] * local;
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "../lua/LuaVal.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+namespace vecs {
+
+	// Forward Declarations
+	class EntityQuery;
+	class World;
+	class Worker;
+
+	// Computes world matrices for every entity with a Transform component. A Transform is a table with optional
+	// position (vec3), rotation (vec3 of euler angles in degrees, or a number for a rotation around the z axis
+	// like sprites use) and scale (vec3) fields. Entities that also have a Parent component ({ entity = id })
+	// are transformed relative to that entity.
+	// The hierarchy is kept sorted by depth between updates, and only sorted again when entities gain or lose a
+	// Transform or their Parent changes. The matrices are kept in one contiguous column in the same order, which
+	// renderers read with getWorldMatrix (world:getWorldMatrix(entity) in lua) instead of building them in lua
+	class TransformSystem {
+	public:
+		// Number of transforms computed by each job
+		static const uint32_t JOB_SIZE = 256;
+
+		TransformSystem(World* world);
+
+		// Parents are always computed before their children, one level of the hierarchy at a time,
+		// with each level split into jobs. Returns once every world matrix has been written
+		void update(Worker* worker);
+
+		// Copies the entity's world matrix as of the last update into matrix, returning false if it didn't have a
+		// Transform then. Only safe to call from systems and renderers that depend on the transforms system
+		bool getWorldMatrix(uint32_t entity, glm::mat4& matrix) const;
+
+	private:
+		// Transforms are sorted so each level of the hierarchy is contiguous, roots first
+		struct Node {
+			uint32_t entity;
+			LuaVal::MapType* transform;
+			// The Parent component we were sorted with, so we notice it being removed or replaced
+			LuaVal::MapType* parentComponent;
+			// Index of our parent's node, or -1 for roots
+			int32_t parent;
+		};
+
+		World* world;
+		EntityQuery* query = nullptr;
+		uint32_t lastUpdateVersion = 0;
+		// Set when entities leave our query, so the nodes get sorted again
+		std::atomic_bool removed = false;
+
+		std::vector<Node> nodes;
+		// nodes[levels[i], levels[i + 1]) are the nodes at depth i
+		std::vector<uint32_t> levels;
+		// World matrix of each node, in the same order as nodes
+		std::vector<glm::mat4> worldMatrices;
+		// The node of each entity by its index, or -1. Entity indices are reused so this stays about as big as nodes
+		std::vector<int32_t> entityNodes;
+
+		int32_t getNode(uint32_t entity) const;
+		// Refreshes the transforms of changed rows, returning true if the hierarchy needs sorting again
+		bool checkChanges(uint32_t version);
+		void gatherNodes();
+		void computeRange(uint32_t start, uint32_t end);
+	};
+}
@@ -1,16 +1,21 @@
 #include "World.h"
 
 #include "Archetype.h"
+#include "ComponentList.h"
+#include "EntityCommandBuffer.h"
 #include "EntityQuery.h"
+#include "RegionStore.h"
 #include "WorldLoadStatus.h"
 #include "../engine/Device.h"
 #include "../engine/Engine.h"
 #include "../events/EventManager.h"
 #include "../jobs/Worker.h"
+#include "../lua/LuaVal.h"
 
 using namespace vecs;
 
 World::World(Engine* engine, std::string filename, WorldLoadStatus* status, bool waitUntilLoaded) : worker(engine, this) {
+	this->engine = engine;
 	device = engine->device;
 	this->status = status;
 	status->currentStep = WORLD_LOAD_STEP_SETUP;
@@ -52,6 +57,7 @@ World::World(Engine* engine, std::string filename, WorldLoadStatus* status, bool
 }
 
 World::World(Engine* engine, sol::table worldConfig, WorldLoadStatus* status, bool waitUntilLoaded) : worker(engine, this) {
+	this->engine = engine;
 	device = engine->device;
 	this->status = status;
 	status->currentStep = WORLD_LOAD_STEP_SETUP;
@@ -76,70 +82,147 @@ World::World(Engine* engine, sol::table worldConfig, WorldLoadStatus* status, bo
 	} else if (status->isCancelled) cleanup();
 }
 
-uint32_t World::createEntities(uint32_t amount) {
-	uint32_t firstEntity = nextEntity.fetch_add(amount);
-	return firstEntity;
+uint32_t World::createEntity() {
+	return entityAllocator.create();
+}
+
+std::vector<uint32_t> World::createEntities(uint32_t amount) {
+	return entityAllocator.create(amount);
+}
+
+void World::destroyEntities(std::vector<uint32_t> const& entities) {
+	for (uint32_t entity : entities)
+		entityAllocator.destroy(entity);
 }
 
 uint32_t World::createEntity(LuaVal* components) {
 	std::unordered_set<std::string> componentTypes;
-	LuaVal::MapType componentMap = *std::get<LuaVal::MapType*>(components->value);
+	LuaVal::MapType componentMap = *components->as<LuaVal::MapType*>();
 	for (auto kvp : componentMap) {
 		if (kvp.first.type == LUA_TYPE_STRING)
-			componentTypes.insert(std::get<std::string>(kvp.first.value));
+			componentTypes.insert(kvp.first.as<std::string>());
 	}
 	Archetype* archetype = getArchetype(componentTypes);
-	auto entity = archetype->createEntities(1);
+	std::vector<uint32_t> created = archetype->createEntities(1);
+	if (created.empty()) return 0;
+	uint32_t entity = created.front();
 	for (auto kvp : componentMap) {
-		archetype->getComponentList(std::get<std::string>(kvp.first.value)).set(LuaVal((double)entity.first), kvp.second);
+		archetype->getComponentList(kvp.first.as<std::string>())->set(entity, kvp.second);
 	}
-	return entity.first;
+	return entity;
 }
 
 Archetype* World::getArchetype(std::unordered_set<std::string> componentTypes, LuaVal* sharedComponents) {
+	ComponentSignature signature = ComponentRegistry::getSignature(componentTypes);
+	size_t hash = getArchetypeHash(signature, sharedComponents);
+
 	archetypesMutex.lock_shared();
-	auto itr = std::find_if(archetypes.begin(), archetypes.end(), [&componentTypes, &sharedComponents](Archetype* archetype) {
-		// Check if they have the same number of non-shared components
-		if (archetype->componentTypes.size() != componentTypes.size()) return false;
-		// Check if the non-shared components they have are the same
-		if (archetype->componentTypes != componentTypes) return false;
-		// Check if shared components are the same. If so there's nothing left to check so we can just return true
-		if (archetype->sharedComponents == sharedComponents) return true;
+	Archetype* archetype = findArchetype(hash, signature, sharedComponents);
+	archetypesMutex.unlock_shared();
+	if (archetype != nullptr)
+		return archetype;
+
+	archetypesMutex.lock();
+	// Check again in case another thread created it while we were waiting for the lock
+	archetype = findArchetype(hash, signature, sharedComponents);
+	if (archetype != nullptr) {
+		archetypesMutex.unlock();
+		return archetype;
+	}
+	// Create a new archetype and add it to any entity queries it matches before anyone else can find it,
+	// so no entities can be added to it that its queries don't know about. Matching is just a few bitset
+	// operations, and the queries publish new snapshots rather than making readers wait
+	archetype = new Archetype(this, componentTypes, sharedComponents);
+	for (auto query : queries) {
+		if (archetype->checkQuery(query)) {
+			query->addArchetype(archetype);
+			archetype->addQuery(query);
+		}
+	}
+	archetypes.push_back(archetype);
+	// Indexed by its own copy of the shared components, in case the caller's table changed since we hashed it
+	archetypeIndex.emplace(getArchetypeHash(signature, archetype->sharedComponents), archetype);
+	archetypesMutex.unlock();
+
+	return archetype;
+}
+
+size_t World::getArchetypeHash(ComponentSignature const& signature, LuaVal* sharedComponents) {
+	size_t hash = std::hash<ComponentSignature>{}(signature);
+	if (sharedComponents != nullptr)
+		hash ^= LuaValHash(*sharedComponents) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+	return hash;
+}
+
+Archetype* World::findArchetype(size_t hash, ComponentSignature const& signature, LuaVal* sharedComponents) {
+	auto range = archetypeIndex.equal_range(hash);
+	for (auto it = range.first; it != range.second; it++) {
+		Archetype* archetype = it->second;
+		if (archetype->signature != signature) continue;
+		// Check if shared components are the same. If so there's nothing left to check so we can just return it
+		if (archetype->sharedComponents == sharedComponents) return archetype;
 		// Check if either archetype doesn't have shared components and the other does
 		// Note we know they don't both equal nullptr because of the earlier check for them being the same
-		if (archetype->sharedComponents == nullptr || sharedComponents == nullptr) return false;
+		if (archetype->sharedComponents == nullptr || sharedComponents == nullptr) continue;
 		// Check if the shared components are the same
-		return *archetype->sharedComponents == *sharedComponents;
-	});
-
-	if (itr == archetypes.end()) {
-		archetypesMutex.unlock_shared();
-		archetypesMutex.lock();
-		// Create a new archetype
-		Archetype* archetype = archetypes.emplace_back(new Archetype(this, componentTypes, sharedComponents));
-		archetypesMutex.unlock();
+		if (*archetype->sharedComponents == *sharedComponents) return archetype;
+	}
+	return nullptr;
+}
 
-		// Add it to any entity queries it matches
-		for (auto query : queries) {
-			if (archetype->checkQuery(query))
-				query->matchingArchetypes.push_back(archetype);
-		}
+Archetype* World::getEntityArchetype(uint32_t entity) {
+	return entityAllocator.getArchetype(entity);
+}
 
-		return archetype;
+void World::setEntityArchetypes(std::vector<uint32_t> const& entities, Archetype* archetype) {
+	for (uint32_t entity : entities)
+		entityAllocator.setArchetype(entity, archetype);
+}
+
+void World::addComponent(std::vector<uint32_t> const& entities, std::string const& componentType, std::vector<LuaVal> const& values) {
+	// Group the entities by their current archetype
+	std::unordered_map<Archetype*, std::pair<std::vector<uint32_t>, std::vector<LuaVal>>> batches;
+	for (size_t i = 0; i < entities.size(); i++) {
+		Archetype* archetype = entityAllocator.getArchetype(entities[i]);
+		if (archetype == nullptr) continue;
+		auto& batch = batches[archetype];
+		batch.first.push_back(entities[i]);
+		batch.second.push_back(i < values.size() ? values[i] : LuaVal({}));
+	}
+
+	for (auto& kvp : batches)
+		kvp.first->moveEntities(kvp.second.first, kvp.first->getAddTransition(componentType), componentType, kvp.second.second);
+}
+
+void World::removeComponent(std::vector<uint32_t> const& entities, std::string const& componentType) {
+	// Group the entities by their current archetype
+	std::unordered_map<Archetype*, std::vector<uint32_t>> batches;
+	for (uint32_t entity : entities) {
+		Archetype* archetype = entityAllocator.getArchetype(entity);
+		if (archetype != nullptr)
+			batches[archetype].push_back(entity);
 	}
-	archetypesMutex.unlock_shared();
 
-	return *itr;
+	for (auto& kvp : batches) {
+		Archetype* destination = kvp.first->getRemoveTransition(componentType);
+		if (destination != kvp.first)
+			kvp.first->moveEntities(kvp.second, destination);
+	}
 }
 
 void World::addQuery(EntityQuery* query) {
+	// Hold the lock so no archetype can be created between us checking the existing ones and being added to the list
+	archetypesMutex.lock();
 	queries.push_back(query);
 
 	// Check what archetypes match this query
 	for (auto archetype : archetypes) {
-		if (archetype->checkQuery(query))
-			query->matchingArchetypes.push_back(archetype);
+		if (archetype->checkQuery(query)) {
+			query->addArchetype(archetype);
+			archetype->addQuery(query);
+		}
 	}
+	archetypesMutex.unlock();
 }
 
 void World::update(double deltaTime) {
@@ -148,6 +231,21 @@ void World::update(double deltaTime) {
 
 	dependencyGraph.execute(&worker);
 
+	// All of this frame's jobs are done so nothing is iterating over our archetypes
+	// (besides persistent jobs which must hold a shared lock), making this a safe point for structural changes
+	playbackCommands();
+
+	// Let queries know which entities entered or left them this frame.
+	// The callbacks may create queries, so we dispatch from a copy of the list
+	archetypesMutex.lock_shared();
+	std::vector<EntityQuery*> queries = this->queries;
+	archetypesMutex.unlock_shared();
+	for (auto query : queries)
+		query->dispatchEvents(worker.functions);
+
+	// Relies on this frame's query events having been dispatched, so entities that lost their Bounds are gone
+	spatialIndex.update();
+
 	// Delete GLFW events
 	mouseMoveEventArchetype->clearEntities();
 	leftMousePressEventArchetype->clearEntities();
@@ -160,6 +258,74 @@ void World::update(double deltaTime) {
 	keyReleaseEventArchetype->clearEntities();
 }
 
+void World::playbackCommands() {
+	std::vector<EntityCommand> commands = worker.commands->take(this);
+	for (auto workerThread : engine->jobManager.workerThreads) {
+		auto workerCommands = workerThread->commands->take(this);
+		commands.insert(commands.end(), std::make_move_iterator(workerCommands.begin()), std::make_move_iterator(workerCommands.end()));
+	}
+	if (commands.empty()) return;
+
+	// Commands are grouped so each archetype is only locked once per kind of command. They get applied in phases:
+	// first creations, then added and removed components, then sets, and finally deletions
+	std::unordered_map<Archetype*, std::vector<uint32_t>> creates;
+	std::unordered_map<std::string, std::pair<std::vector<uint32_t>, std::vector<LuaVal>>> adds;
+	std::unordered_map<std::string, std::vector<uint32_t>> removes;
+	std::vector<EntityCommand*> sets;
+	std::vector<uint32_t> deletes;
+	for (auto& command : commands) {
+		switch (command.type) {
+		case ENTITY_COMMAND_CREATE:
+			creates[command.archetype].push_back(command.entity);
+			break;
+		case ENTITY_COMMAND_ADD_COMPONENT: {
+			auto& add = adds[command.componentType];
+			add.first.push_back(command.entity);
+			add.second.push_back(command.value);
+			break;
+		}
+		case ENTITY_COMMAND_REMOVE_COMPONENT:
+			removes[command.componentType].push_back(command.entity);
+			break;
+		case ENTITY_COMMAND_SET:
+			sets.push_back(&command);
+			break;
+		case ENTITY_COMMAND_DELETE:
+			deletes.push_back(command.entity);
+			break;
+		}
+	}
+
+	for (auto& kvp : creates)
+		kvp.first->addEntities(kvp.second);
+	for (auto& kvp : adds)
+		addComponent(kvp.second.first, kvp.first, kvp.second.second);
+	for (auto& kvp : removes)
+		removeComponent(kvp.second, kvp.first);
+
+	// Sets need to know what archetype each entity ended up in
+	std::unordered_map<Archetype*, std::unordered_map<std::string, std::pair<std::vector<uint32_t>, std::vector<LuaVal>>>> setsByArchetype;
+	for (auto command : sets) {
+		Archetype* archetype = getEntityArchetype(command->entity);
+		if (archetype == nullptr) continue;
+		auto& set = setsByArchetype[archetype][command->componentType];
+		set.first.push_back(command->entity);
+		set.second.push_back(command->value);
+	}
+	for (auto& archetypeSets : setsByArchetype)
+		for (auto& kvp : archetypeSets.second)
+			archetypeSets.first->setComponents(kvp.second.first, kvp.first, kvp.second.second);
+
+	std::unordered_map<Archetype*, std::vector<uint32_t>> deletesByArchetype;
+	for (auto entity : deletes) {
+		Archetype* archetype = getEntityArchetype(entity);
+		if (archetype != nullptr)
+			deletesByArchetype[archetype].push_back(entity);
+	}
+	for (auto& kvp : deletesByArchetype)
+		kvp.first->removeEntities(kvp.second);
+}
+
 void World::windowRefresh(int imageCount) {
 	dependencyGraph.windowRefresh(imageCount);
 	worker.createInheritanceInfo();
@@ -173,7 +339,13 @@ void World::addBuffer(Buffer buffer) {
 
 void World::cleanup() {
 	// Destroy our systems and sub-renderers
-	dependencyGraph.cleanup();
+	dependencyGraph.cleanup(&worker);
+
+	// Our persistent jobs won't run once we're gone, so write any chunks they were going to save now
+	if (auto store = std::atomic_load(&regions)) {
+		store->flush();
+		std::atomic_store(&regions, std::shared_ptr<RegionStore>());
+	}
 
 	// Destroy our worker
 	worker.cleanup();
@@ -220,8 +392,8 @@ void World::setupEvents() {
 bool World::mouseMoveEventCallback(MouseMoveEvent* event) {
 	if (isDisposed) return false;
 	if (!isValid) return true;
-	mouseMoveEventArchetype->getComponentList("MouseMoveEvent").set(
-		(double)mouseMoveEventArchetype->createEntities(1).first,
+	mouseMoveEventArchetype->getComponentList("MouseMoveEvent")->set(
+		mouseMoveEventArchetype->createEntities(1).front(),
 		{ { (std::string)"xPos", event->xPos }, { (std::string)"yPos", event->yPos } }
 	);
 	return true;
@@ -230,8 +402,8 @@ bool World::mouseMoveEventCallback(MouseMoveEvent* event) {
 bool World::leftMousePressEventCallback(LeftMousePressEvent* event) {
 	if (isDisposed) return false;
 	if (!isValid) return true;
-	leftMousePressEventArchetype->getComponentList("LeftMousePressEvent").set(
-		(double)leftMousePressEventArchetype->createEntities(1).first,
+	leftMousePressEventArchetype->getComponentList("LeftMousePressEvent")->set(
+		leftMousePressEventArchetype->createEntities(1).front(),
 		{ { (std::string)"mods", (double)event->mods } }
 	);
 	return true;
@@ -240,8 +412,8 @@ bool World::leftMousePressEventCallback(LeftMousePressEvent* event) {
 bool World::leftMouseReleaseEventCallback(LeftMouseReleaseEvent* event) {
 	if (isDisposed) return false;
 	if (!isValid) return true;
-	leftMouseReleaseEventArchetype->getComponentList("LeftMouseReleaseEvent").set(
-		(double)leftMouseReleaseEventArchetype->createEntities(1).first,
+	leftMouseReleaseEventArchetype->getComponentList("LeftMouseReleaseEvent")->set(
+		leftMouseReleaseEventArchetype->createEntities(1).front(),
 		{ { (std::string)"mods", (double)event->mods } }
 	);
 	return true;
@@ -250,8 +422,8 @@ bool World::leftMouseReleaseEventCallback(LeftMouseReleaseEvent* event) {
 bool World::rightMousePressEventCallback(RightMousePressEvent* event) {
 	if (isDisposed) return false;
 	if (!isValid) return true;
-	rightMousePressEventArchetype->getComponentList("RightMousePressEvent").set(
-		(double)rightMousePressEventArchetype->createEntities(1).first,
+	rightMousePressEventArchetype->getComponentList("RightMousePressEvent")->set(
+		rightMousePressEventArchetype->createEntities(1).front(),
 		{ { (std::string)"mods", (double)event->mods } }
 	);
 	return true;
@@ -260,8 +432,8 @@ bool World::rightMousePressEventCallback(RightMousePressEvent* event) {
 bool World::rightMouseReleaseEventCallback(RightMouseReleaseEvent* event) {
 	if (isDisposed) return false;
 	if (!isValid) return true;
-	rightMouseReleaseEventArchetype->getComponentList("RightMouseReleaseEvent").set(
-		(double)rightMouseReleaseEventArchetype->createEntities(1).first,
+	rightMouseReleaseEventArchetype->getComponentList("RightMouseReleaseEvent")->set(
+		rightMouseReleaseEventArchetype->createEntities(1).front(),
 		{ { (std::string)"mods", (double)event->mods } }
 	);
 	return true;
@@ -270,8 +442,8 @@ bool World::rightMouseReleaseEventCallback(RightMouseReleaseEvent* event) {
 bool World::horizontalScrollEventCallback(HorizontalScrollEvent* event) {
 	if (isDisposed) return false;
 	if (!isValid) return true;
-	horizontalScrollEventArchetype->getComponentList("HorizontalScrollEvent").set(
-		(double)horizontalScrollEventArchetype->createEntities(1).first,
+	horizontalScrollEventArchetype->getComponentList("HorizontalScrollEvent")->set(
+		horizontalScrollEventArchetype->createEntities(1).front(),
 		{ { (std::string)"xOffset", event->xOffset } }
 	);
 	return true;
@@ -280,8 +452,8 @@ bool World::horizontalScrollEventCallback(HorizontalScrollEvent* event) {
 bool World::verticalScrollEventCallback(VerticalScrollEvent* event) {
 	if (isDisposed) return false;
 	if (!isValid) return true;
-	verticalScrollEventArchetype->getComponentList("VerticalScrollEvent").set(
-		(double)verticalScrollEventArchetype->createEntities(1).first,
+	verticalScrollEventArchetype->getComponentList("VerticalScrollEvent")->set(
+		verticalScrollEventArchetype->createEntities(1).front(),
 		{ { (std::string)"yOffset", event->yOffset } }
 	);
 	return true;
@@ -290,8 +462,8 @@ bool World::verticalScrollEventCallback(VerticalScrollEvent* event) {
 bool World::keyPressEventCallback(KeyPressEvent* event) {
 	if (isDisposed) return false;
 	if (!isValid) return true;
-	keyPressEventArchetype->getComponentList("KeyPressEvent").set(
-		(double)keyPressEventArchetype->createEntities(1).first,
+	keyPressEventArchetype->getComponentList("KeyPressEvent")->set(
+		keyPressEventArchetype->createEntities(1).front(),
 		{ { (std::string)"key", (double)event->key }, { (std::string)"mods", (double)event->mods }, { (std::string)"scancode", (double)event->scancode } }
 	);
 	return true;
@@ -300,8 +472,8 @@ bool World::keyPressEventCallback(KeyPressEvent* event) {
 bool World::keyReleaseEventCallback(KeyReleaseEvent* event) {
 	if (isDisposed) return false;
 	if (!isValid) return true;
-	keyReleaseEventArchetype->getComponentList("KeyReleaseEvent").set(
-		(double)keyReleaseEventArchetype->createEntities(1).first,
+	keyReleaseEventArchetype->getComponentList("KeyReleaseEvent")->set(
+		keyReleaseEventArchetype->createEntities(1).front(),
 		{ { (std::string)"key", (double)event->key }, { (std::string)"mods", (double)event->mods }, { (std::string)"scancode", (double)event->scancode } }
 	);
 	return true;
@@ -310,8 +482,8 @@ bool World::keyReleaseEventCallback(KeyReleaseEvent* event) {
 bool World::windowResizeEventCallback(WindowResizeEvent* event) {
 	if (isDisposed) return false;
 	if (!isValid) return true;
-	windowResizeEventArchetype->getComponentList("WindowResizeEvent").set(
-		(double)windowResizeEventArchetype->createEntities(1).first,
+	windowResizeEventArchetype->getComponentList("WindowResizeEvent")->set(
+		windowResizeEventArchetype->createEntities(1).front(),
 		{ { (std::string)"width", (double)event->width }, { (std::string)"height", (double)event->height } }
 	);
 	return true;
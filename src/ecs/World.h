@@ -2,8 +2,14 @@
 
 #include <vulkan/vulkan.h>
 #include <imnodes.h>
+#include <unordered_map>
 #include <unordered_set>
 
+#include "ComponentRegistry.h"
+#include "EntityAllocator.h"
+#include "SpatialIndex.h"
+#include "TransformSystem.h"
+#include "WorldResources.h"
 #include "../engine/Buffer.h"
 #include "../events/GLFWEvents.h"
 #include "../jobs/DependencyGraph.h"
@@ -20,10 +26,13 @@ namespace vecs {
 	class EntityQuery;
 	class WorldLoadStatus;
 	class LuaVal;
+	class RegionStore;
 
 	// The World contains subrenderers and systems
 	// and handles updating them as appropriate
 	class World {
+	// Needs to see every archetype, including the event ones it shouldn't save
+	friend class WorldSnapshot;
 	public:
 		sol::table config;
 
@@ -36,8 +45,25 @@ namespace vecs {
 		// imnodes context
 		imnodes::EditorContext* nodeEditorContext;
 
-		// Start at 1 so that 0 can be used to represent an invalid entity
-		std::atomic_uint32_t nextEntity = 1;
+		// Stamped onto component blocks when they're written. Each system or renderer run increments it,
+		// so comparing against the version a system last ran at tells it which blocks it hasn't seen
+		std::atomic_uint32_t changeVersion = 1;
+
+		// Hands out entity ids and tracks which archetype each entity is in
+		EntityAllocator entityAllocator;
+
+		// Global state that doesn't need to be an entity, accessed from lua through world.resources
+		WorldResources resources;
+
+		// Computes world matrices for entities with Transform components, when world:updateTransforms() is called
+		TransformSystem transforms{ this };
+
+		// Finds entities with Bounds components by position, through world:queryBox, querySphere and queryFrustum
+		SpatialIndex spatialIndex{ this };
+
+		// Where chunks are saved to and loaded from, once world:openRegions() is called. Use std::atomic_load to read it,
+		// since jobs may be reading it when it's set
+		std::shared_ptr<RegionStore> regions;
 
 		double deltaTime = 0;
 
@@ -50,11 +76,24 @@ namespace vecs {
 		World(Engine* engine, std::string filename, WorldLoadStatus* status, bool waitUntilLoaded = false);
 		World(Engine* engine, sol::table worldConfig, WorldLoadStatus* status, bool waitUntilLoaded = false);
 
-		uint32_t createEntities(uint32_t amount = 1);
+		uint32_t createEntity();
+		// Reuses destroyed ids before allocating new ones, so the ids aren't necessarily consecutive
+		std::vector<uint32_t> createEntities(uint32_t amount);
+		// Releases entity ids to be reused. Archetypes call this when entities are removed from them
+		void destroyEntities(std::vector<uint32_t> const& entities);
 		uint32_t createEntity(LuaVal* components);
 
 		Archetype* getArchetype(std::unordered_set<std::string> componentTypes, LuaVal* sharedComponents = nullptr);
 
+		// Track which archetype each entity is in. Archetypes call these as entities are added or moved
+		Archetype* getEntityArchetype(uint32_t entity);
+		void setEntityArchetypes(std::vector<uint32_t> const& entities, Archetype* archetype);
+
+		// Add or remove a component from existing entities, moving them to a different archetype but keeping their ids.
+		// Entities are grouped by the archetype they're in, so each pair of archetypes is only locked once per call
+		void addComponent(std::vector<uint32_t> const& entities, std::string const& componentType, std::vector<LuaVal> const& values);
+		void removeComponent(std::vector<uint32_t> const& entities, std::string const& componentType);
+
 		void addQuery(EntityQuery* query);
 
 		void update(double deltaTime);
@@ -65,15 +104,20 @@ namespace vecs {
 		void cleanup();
 
 	private:
+		Engine* engine;
 		Device* device;
 		
 		// Store a list of filters added by our systems. Each tracks which entities meet a specific
 		// criteria of components it needs and/or disallows, and contains pointers for functions
-		// to run whenever an entity is added to or removed from the filtered entity list
+		// to run whenever an entity is added to or removed from the filtered entity list.
+		// Guarded by archetypesMutex, since adding either a query or an archetype needs to check the other list
 		std::vector<EntityQuery*> queries;
 
 		// Each unique set of components is managed by an archetype
 		std::vector<Archetype*> archetypes;
+		// Archetypes indexed by a hash of their component signature and the contents of their shared components,
+		// so finding an archetype only compares against archetypes that are very likely to match
+		std::unordered_multimap<size_t, Archetype*> archetypeIndex;
 		std::shared_mutex archetypesMutex;
 
 		std::vector<Buffer> buffers;
@@ -91,6 +135,13 @@ namespace vecs {
 		Archetype* keyReleaseEventArchetype;
 		Archetype* windowResizeEventArchetype;
 
+		static size_t getArchetypeHash(ComponentSignature const& signature, LuaVal* sharedComponents);
+		// Must be called with archetypesMutex locked
+		Archetype* findArchetype(size_t hash, ComponentSignature const& signature, LuaVal* sharedComponents);
+
+		// Applies the structural changes recorded in every worker's command buffer for this world
+		void playbackCommands();
+
 		void setupEvents();
 		bool mouseMoveEventCallback(MouseMoveEvent* event);
 		bool leftMousePressEventCallback(LeftMousePressEvent* event);
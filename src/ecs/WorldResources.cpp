@@ -0,0 +1,53 @@
+#include "WorldResources.h"
+
+#include "../lua/LuaVal.h"
+
+using namespace vecs;
+
+WorldResources::WorldResources() {
+	slots = std::make_shared<const SlotMap>();
+}
+
+WorldResources::~WorldResources() {
+	for (auto& kvp : *slots)
+		delete kvp.second;
+}
+
+LuaVal WorldResources::get(std::string const& name) const {
+	auto snapshot = std::atomic_load(&slots);
+	auto it = snapshot->find(name);
+	if (it == snapshot->end())
+		return LuaVal();
+	// Holding our own reference keeps the value alive while we copy it, even if it's replaced meanwhile
+	std::shared_ptr<const LuaVal> value = std::atomic_load(it->second);
+	return value == nullptr ? LuaVal() : *value;
+}
+
+void WorldResources::set(std::string const& name, LuaVal const& value) {
+	std::shared_ptr<const LuaVal> newValue = value.type == LUA_TYPE_NIL ? nullptr : std::make_shared<const LuaVal>(value);
+
+	writeMutex.lock();
+	auto snapshot = std::atomic_load(&slots);
+	auto it = snapshot->find(name);
+	std::shared_ptr<const LuaVal>* slot;
+	if (it != snapshot->end())
+		slot = it->second;
+	else {
+		// Publish a new map with the slot added. Writers are rare so copying the whole map is fine
+		slot = new std::shared_ptr<const LuaVal>();
+		auto updated = std::make_shared<SlotMap>(*snapshot);
+		updated->emplace(name, slot);
+		std::atomic_store(&slots, std::shared_ptr<const SlotMap>(std::move(updated)));
+	}
+	std::atomic_store(slot, std::move(newValue));
+	writeMutex.unlock();
+}
+
+std::vector<std::string> WorldResources::getNames() const {
+	auto snapshot = std::atomic_load(&slots);
+	std::vector<std::string> names;
+	names.reserve(snapshot->size());
+	for (auto& kvp : *snapshot)
+		names.push_back(kvp.first);
+	return names;
+}
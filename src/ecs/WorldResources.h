@@ -0,0 +1,40 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vecs {
+
+	// Forward Declarations
+	class LuaVal;
+
+	// Singleton values that belong to the world rather than to any entity, like the camera or the block archetypes.
+	// Reading one is a snapshot lookup and an atomic shared_ptr load, with no locking and no archetype iteration.
+	// Setting one publishes a new value, and the old one is freed once the last reader (which could be a
+	// persistent job that outlives the frame) lets go of it
+	class WorldResources {
+	public:
+		WorldResources();
+		~WorldResources();
+		WorldResources(const WorldResources&) = delete;
+		WorldResources& operator=(const WorldResources&) = delete;
+
+		// Returns nil if the resource hasn't been set
+		LuaVal get(std::string const& name) const;
+		// Setting a resource to nil removes it
+		void set(std::string const& name, LuaVal const& value);
+		// Names of every resource that has been set, including ones that have since been set to nil
+		std::vector<std::string> getNames() const;
+
+	private:
+		// Each slot is only accessed through std::atomic_load and std::atomic_store
+		typedef std::unordered_map<std::string, std::shared_ptr<const LuaVal>*> SlotMap;
+
+		// Slots are never removed, so once a name has a slot readers can keep using it
+		std::shared_ptr<const SlotMap> slots;
+		std::mutex writeMutex;
+	};
+}
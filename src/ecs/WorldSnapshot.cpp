@@ -0,0 +1,208 @@
+#include "WorldSnapshot.h"
+
+#include "Archetype.h"
+#include "ComponentList.h"
+#include "World.h"
+#include "../engine/Debugger.h"
+#include "../lua/LuaVal.h"
+#include "../lua/LuaValStream.h"
+#include "../util/MappedFile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace vecs;
+
+namespace {
+	const char MAGIC[4] = { 'V', 'E', 'C', 'S' };
+	const LuaVal entityKey(std::string("entity"));
+
+	// An archetype's entities as read from a snapshot, before they're added to the world
+	struct ArchetypeData {
+		Archetype* archetype;
+		std::vector<uint32_t> entities;
+		std::unordered_map<std::string, std::vector<LuaVal>> columns;
+	};
+}
+
+bool WorldSnapshot::save(World* world, std::filesystem::path const& path, std::vector<std::string> const& componentTypes) {
+	// Event archetypes are cleared each frame, so there's no point saving them
+	std::unordered_set<Archetype*> eventArchetypes = {
+		world->mouseMoveEventArchetype, world->leftMousePressEventArchetype, world->leftMouseReleaseEventArchetype,
+		world->rightMousePressEventArchetype, world->rightMouseReleaseEventArchetype, world->horizontalScrollEventArchetype,
+		world->verticalScrollEventArchetype, world->keyPressEventArchetype, world->keyReleaseEventArchetype,
+		world->windowResizeEventArchetype
+	};
+	std::vector<Archetype*> archetypes;
+	std::unordered_map<Archetype*, uint32_t> archetypeIndices;
+	world->archetypesMutex.lock_shared();
+	for (Archetype* archetype : world->archetypes) {
+		if (eventArchetypes.count(archetype)) continue;
+		archetypeIndices[archetype] = (uint32_t)archetypes.size();
+		archetypes.push_back(archetype);
+	}
+	world->archetypesMutex.unlock_shared();
+
+	// Write to a temporary file first so a failed save doesn't ruin the last good one
+	std::filesystem::path tempPath = path;
+	tempPath += ".tmp";
+	std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+	if (!out) {
+		Debugger::addLog(DEBUG_LEVEL_ERROR, "[WORLD] Unable to open " + tempPath.string() + " to save snapshot");
+		return false;
+	}
+
+	LuaValWriter writer(out);
+	writer.archetypeIndices = std::move(archetypeIndices);
+	out.write(MAGIC, sizeof(MAGIC));
+	writer.write((uint32_t)VERSION);
+
+	// Component types are sorted so an archetype's columns are always written in the same order
+	std::vector<std::vector<std::string>> archetypeTypes;
+	writer.write((uint32_t)archetypes.size());
+	for (Archetype* archetype : archetypes) {
+		std::vector<std::string> types(archetype->componentTypes.begin(), archetype->componentTypes.end());
+		std::sort(types.begin(), types.end());
+		writer.write((uint32_t)types.size());
+		for (auto& type : types)
+			writer.writeString(type);
+		writer.writeValue(archetype->sharedComponents == nullptr ? LuaVal() : *archetype->sharedComponents);
+		archetypeTypes.push_back(std::move(types));
+	}
+
+	// Resources belong to the whole world, so they're only saved along with all of it
+	std::vector<std::string> resourceNames = componentTypes.empty() ? world->resources.getNames() : std::vector<std::string>();
+	writer.write((uint32_t)resourceNames.size());
+	for (auto& name : resourceNames) {
+		writer.writeString(name);
+		writer.writeValue(world->resources.get(name));
+	}
+
+	for (size_t i = 0; i < archetypes.size(); i++) {
+		Archetype* archetype = archetypes[i];
+		bool included = componentTypes.empty() || std::any_of(componentTypes.begin(), componentTypes.end(),
+			[archetype](std::string const& type) { return archetype->componentTypes.count(type) > 0; });
+		if (!included) {
+			writer.write((uint32_t)0);
+			continue;
+		}
+		archetype->lock_shared();
+		writer.write((uint32_t)archetype->entities.size());
+		for (uint32_t entity : archetype->entities)
+			writer.write(entity);
+		for (auto& type : archetypeTypes[i]) {
+			ComponentList* list = archetype->getComponentList(type);
+			for (uint32_t row = 0; row < archetype->entities.size(); row++)
+				writer.writeValue(list->getRow(row));
+		}
+		archetype->unlock_shared();
+	}
+
+	out.close();
+	if (!out) {
+		Debugger::addLog(DEBUG_LEVEL_ERROR, "[WORLD] Failed to write snapshot to " + tempPath.string());
+		return false;
+	}
+	std::error_code error;
+	std::filesystem::rename(tempPath, path, error);
+	if (error) {
+		Debugger::addLog(DEBUG_LEVEL_ERROR, "[WORLD] Unable to replace " + path.string() + ": " + error.message());
+		return false;
+	}
+	return true;
+}
+
+bool WorldSnapshot::load(World* world, std::filesystem::path const& path) {
+	std::error_code exists;
+	if (!std::filesystem::exists(path, exists))
+		return false;
+	MappedFile file;
+	if (!file.open(path)) {
+		Debugger::addLog(DEBUG_LEVEL_ERROR, "[WORLD] Unable to open snapshot " + path.string());
+		return false;
+	}
+
+	std::vector<ArchetypeData> archetypes;
+	std::vector<std::pair<std::string, LuaVal>> resources;
+	try {
+		LuaValReader reader(file.data(), file.size());
+		for (char c : MAGIC)
+			if (reader.read<char>() != c)
+				throw std::runtime_error("File isn't a snapshot");
+		uint32_t version = reader.read<uint32_t>();
+		if (version == 0 || version > VERSION)
+			throw std::runtime_error("Snapshot is version " + std::to_string(version) + " but only up to version " + std::to_string(VERSION) + " is supported");
+
+		std::vector<std::vector<std::string>> archetypeTypes;
+		uint32_t numArchetypes = reader.read<uint32_t>();
+		for (uint32_t i = 0; i < numArchetypes; i++) {
+			std::vector<std::string> types(reader.read<uint32_t>());
+			for (auto& type : types)
+				type = reader.readString();
+			LuaVal sharedComponents = reader.readValue();
+			// Finding the archetype rather than always creating one means block archetypes and the like match up
+			// with the ones systems already made, or the ones they'll make
+			Archetype* archetype = world->getArchetype(std::unordered_set<std::string>(types.begin(), types.end()),
+				sharedComponents.type == LUA_TYPE_TABLE ? &sharedComponents : nullptr);
+			reader.archetypes.push_back(archetype);
+			archetypes.push_back({ archetype });
+			archetypeTypes.push_back(std::move(types));
+		}
+
+		uint32_t numResources = reader.read<uint32_t>();
+		for (uint32_t i = 0; i < numResources; i++) {
+			std::string name(reader.readString());
+			resources.emplace_back(std::move(name), reader.readValue());
+		}
+
+		for (uint32_t i = 0; i < numArchetypes; i++) {
+			ArchetypeData& data = archetypes[i];
+			data.entities.resize(reader.read<uint32_t>());
+			for (auto& entity : data.entities)
+				entity = reader.read<uint32_t>();
+			for (auto& type : archetypeTypes[i]) {
+				std::vector<LuaVal>& column = data.columns[type];
+				column.reserve(data.entities.size());
+				for (size_t row = 0; row < data.entities.size(); row++)
+					column.push_back(reader.readValue());
+			}
+		}
+	} catch (std::exception const& e) {
+		Debugger::addLog(DEBUG_LEVEL_ERROR, "[WORLD] Unable to load snapshot " + path.string() + ": " + e.what());
+		return false;
+	}
+
+	// Everything was read successfully, so now it's safe to change the world
+	for (auto& resource : resources)
+		world->resources.set(resource.first, resource.second);
+
+	std::unordered_map<uint32_t, uint32_t> newEntities;
+	std::vector<LuaVal> parents;
+	for (ArchetypeData& data : archetypes) {
+		if (data.entities.empty()) continue;
+		auto parentColumn = data.columns.find("Parent");
+		if (parentColumn != data.columns.end())
+			parents.insert(parents.end(), parentColumn->second.begin(), parentColumn->second.end());
+
+		std::vector<uint32_t> created = data.archetype->createEntities((uint32_t)data.entities.size(), data.columns);
+		for (uint32_t i = 0; i < data.entities.size(); i++)
+			newEntities[data.entities[i]] = created[i];
+	}
+
+	// The Parent tables are shared with the rows we just created, so updating them here updates the components
+	for (LuaVal& parent : parents) {
+		if (parent.type != LUA_TYPE_TABLE) continue;
+		LuaVal::MapType* table = parent.as<LuaVal::MapType*>();
+		auto entity = table->find(entityKey);
+		if (entity == table->end() || entity->second.type != LUA_TYPE_NUMBER) continue;
+		auto newEntity = newEntities.find((uint32_t)entity->second.as<double>());
+		if (newEntity != newEntities.end())
+			entity->second = LuaVal((double)newEntity->second);
+	}
+
+	return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace vecs {
+
+	// Forward Declarations
+	class World;
+
+	// Saves every archetype in a world, along with their entities' components and the world's resources, to a binary
+	// file that can be loaded back in later instead of generating everything again. Loading memory maps the file
+	// and creates each archetype's entities in one batch.
+	// The file starts with "VECS" and a version number. Archetypes are stored as their component types and shared
+	// components, followed by the resources, followed by each archetype's entities as one column per component type.
+	// Values that only make sense while the engine is running (buffers, textures, renderers and so on) are saved
+	// as nil, so systems need to recreate those after a load. Tables that appear more than once are only saved
+	// once, so shared and cyclic tables come back the same way.
+	// Loaded entities get new ids, and the entity field of Parent components is updated to match. Anything else
+	// storing entity ids will need to find them again.
+	// A system can save just its own entities by passing the component types it owns, which saves the entities of
+	// archetypes with any of them and no resources. Every archetype is still saved, so components referring to
+	// other archetypes (like terrain's blocks) load. See systems/terrain.lua, which saves its chunks in cleanup
+	class WorldSnapshot {
+	public:
+		// Versions follow LuaVal's encoding, which can read all of its older versions, so older snapshots still load
+		static const uint32_t VERSION = 3;
+
+		// Each returns false if it failed, after logging why. A failed load may have created archetypes, but no entities or resources.
+		// Loading a snapshot that doesn't exist returns false without logging, so callers can just fall back to generating things
+		static bool save(World* world, std::filesystem::path const& path, std::vector<std::string> const& componentTypes = {});
+		static bool load(World* world, std::filesystem::path const& path);
+	};
+}
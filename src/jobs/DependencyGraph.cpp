@@ -47,7 +47,7 @@ Job* DependencyGraph::load(Engine* engine, Worker* worker, sol::table config, Wo
 		} else continue;
 
 		// Setup dependency node load status
-		LuaVal::MapType* systemMap = std::get<LuaVal::MapType*>(system.value);
+		LuaVal::MapType* systemMap = system.as<LuaVal::MapType*>();
 		DependencyNodeLoadStatus* nodeStatus = new DependencyNodeLoadStatus(kvp.first.as<std::string>(),
 			system.get("preInit").type == LUA_TYPE_FUNCTION ? DEPENDENCY_FUNCTION_WAITING : DEPENDENCY_FUNCTION_NOT_AVAILABLE,
 			system.get("init").type == LUA_TYPE_FUNCTION ? DEPENDENCY_FUNCTION_WAITING : DEPENDENCY_FUNCTION_NOT_AVAILABLE,
@@ -80,7 +80,7 @@ Job* DependencyGraph::load(Engine* engine, Worker* worker, sol::table config, Wo
 		} else continue;
 
 		// Setup dependency node load status
-		LuaVal::MapType* systemMap = std::get<LuaVal::MapType*>(subrenderer.value);
+		LuaVal::MapType* systemMap = subrenderer.as<LuaVal::MapType*>();
 		DependencyNodeLoadStatus* nodeStatus = new DependencyNodeLoadStatus(kvp.first.as<std::string>(),
 			subrenderer.get("preInit").type == LUA_TYPE_FUNCTION ? DEPENDENCY_FUNCTION_WAITING : DEPENDENCY_FUNCTION_NOT_AVAILABLE,
 			subrenderer.get("init").type == LUA_TYPE_FUNCTION ? DEPENDENCY_FUNCTION_WAITING : DEPENDENCY_FUNCTION_NOT_AVAILABLE,
@@ -259,9 +259,9 @@ void DependencyGraph::windowRefresh(int imageCount) {
 		node->windowRefresh(imageCount);
 }
 
-void DependencyGraph::cleanup() {
+void DependencyGraph::cleanup(Worker* worker) {
 	for (auto node : nodes) {
-		node->cleanup();
+		node->cleanup(worker);
 	}
 }
 
@@ -274,7 +274,7 @@ void DependencyNode::preInit(Worker* worker) {
 	else {
 		LuaVal preInit = config.get("preInit");
 		if (preInit.type == LUA_TYPE_FUNCTION) {
-			sol::load_result loadResult = worker->lua.load(std::get<sol::bytecode>(preInit.value).as_string_view());
+			sol::load_result loadResult = worker->lua.load(preInit.getBytecode());
 			if (!loadResult.valid()) {
 				sol::error err = loadResult;
 				Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] " + std::string(err.what()));
@@ -312,7 +312,7 @@ void DependencyNode::init(Worker* worker) {
 
 	LuaVal init = config.get("init");
 	if (init.type == LUA_TYPE_FUNCTION) {
-		sol::load_result loadResult = worker->lua.load(std::get<sol::bytecode>(init.value).as_string_view());
+		sol::load_result loadResult = worker->lua.load(init.getBytecode());
 		if (!loadResult.valid()) {
 			sol::error err = loadResult;
 			Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] " + std::string(err.what()));
@@ -353,7 +353,7 @@ void DependencyNode::postInit(Worker* worker) {
 
 	LuaVal init = config.get("postInit");
 	if (init.type == LUA_TYPE_FUNCTION) {
-		sol::load_result loadResult = worker->lua.load(std::get<sol::bytecode>(init.value).as_string_view());
+		sol::load_result loadResult = worker->lua.load(init.getBytecode());
 		if (!loadResult.valid()) {
 			sol::error err = loadResult;
 			Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] " + std::string(err.what()));
@@ -389,7 +389,7 @@ void DependencyNode::postInit(Worker* worker) {
 void DependencyNode::createEdges(std::map<std::string, DependencyNode*> systemsMap, std::map<std::string, DependencyNode*> renderersMap) {
 	LuaVal dependenciesTable = config.get("dependencies");
 	if (dependenciesTable.type == LUA_TYPE_TABLE) {
-		for (auto kvp : *std::get<LuaVal::MapType*>(dependenciesTable.value)) {
+		for (auto kvp : *dependenciesTable.as<LuaVal::MapType*>()) {
 			if (kvp.first.type != LUA_TYPE_STRING) {
 				Debugger::addLog(DEBUG_LEVEL_WARN, "Dependencies dictionary contained non-string key");
 				continue;
@@ -400,15 +400,15 @@ void DependencyNode::createEdges(std::map<std::string, DependencyNode*> systemsM
 			}
 
 			DependencyNode* dependency;
-			std::string dependencyType = std::get<std::string>(kvp.second.value);
+			std::string dependencyType = kvp.second.as<std::string>();
 			if (dependencyType == "system")
-				dependency = systemsMap[std::get<std::string>(kvp.first.value)];
+				dependency = systemsMap[kvp.first.as<std::string>()];
 			else if (dependencyType == "renderer")
-				dependency = renderersMap[std::get<std::string>(kvp.first.value)];
+				dependency = renderersMap[kvp.first.as<std::string>()];
 			else continue;
 
 			if (dependency == nullptr) {
-				Debugger::addLog(DEBUG_LEVEL_WARN, status->name + " dependency " + std::get<std::string>(kvp.first.value) + " (" + dependencyType + ") not found!");
+				Debugger::addLog(DEBUG_LEVEL_WARN, status->name + " dependency " + kvp.first.as<std::string>() + " (" + dependencyType + ") not found!");
 				continue;
 			}
 
@@ -419,7 +419,7 @@ void DependencyNode::createEdges(std::map<std::string, DependencyNode*> systemsM
 
 	LuaVal forwardDependenciesTable = config.get("forwardDependencies");
 	if (forwardDependenciesTable.type == LUA_TYPE_TABLE) {
-		for (auto kvp : *std::get<LuaVal::MapType*>(forwardDependenciesTable.value)) {
+		for (auto kvp : *forwardDependenciesTable.as<LuaVal::MapType*>()) {
 			if (kvp.first.type != LUA_TYPE_STRING) {
 				Debugger::addLog(DEBUG_LEVEL_WARN, "Forward dependencies dictionary contained non-string key");
 				continue;
@@ -430,15 +430,15 @@ void DependencyNode::createEdges(std::map<std::string, DependencyNode*> systemsM
 			}
 
 			DependencyNode* dependent;
-			std::string dependencyType = std::get<std::string>(kvp.second.value);
+			std::string dependencyType = kvp.second.as<std::string>();
 			if (dependencyType == "system")
-				dependent = systemsMap[std::get<std::string>(kvp.first.value)];
+				dependent = systemsMap[kvp.first.as<std::string>()];
 			else if (dependencyType == "renderer")
-				dependent = renderersMap[std::get<std::string>(kvp.first.value)];
+				dependent = renderersMap[kvp.first.as<std::string>()];
 			else continue;
 
 			if (dependent == nullptr) {
-				Debugger::addLog(DEBUG_LEVEL_WARN, status->name + " forward dependency " + std::get<std::string>(kvp.first.value) + " (" + dependencyType + ") not found!");
+				Debugger::addLog(DEBUG_LEVEL_WARN, status->name + " forward dependency " + kvp.first.as<std::string>() + " (" + dependencyType + ") not found!");
 				continue;
 			}
 
@@ -455,15 +455,15 @@ void DependencyNode::startFrame(Worker* worker) {
 
 	LuaVal startFrame = config.get("startFrame");
 	if (startFrame.type == LUA_TYPE_FUNCTION) {
-		auto loadResult = worker->lua.load(std::get<sol::bytecode>(startFrame.value).as_string_view());
-		if (!loadResult.valid()) {
-			sol::error err = loadResult;
-			Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] " + std::string(err.what()));
+		std::string error;
+		sol::protected_function function = worker->functions.load(startFrame.getInterned(), error);
+		if (!function.valid()) {
+			Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] " + error);
 			// TODO cancel world loading and future jobs
 			return;
 		}
 
-		auto result = loadResult(config, subrenderer);
+		auto result = function(config, subrenderer);
 		if (!result.valid()) {
 			sol::error err = result;
 			Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] " + std::string(err.what()));
@@ -476,14 +476,20 @@ void DependencyNode::startFrame(Worker* worker) {
 void DependencyNode::execute(Worker* worker) {
 	LuaVal update = type == DEPENDENCY_NODE_TYPE_SYSTEM ? config.get("update") : config.get("render");
 	if (update.type == LUA_TYPE_FUNCTION) {
-		auto loadResult = worker->lua.load(std::get<sol::bytecode>(update.value).as_string_view());
-		if (!loadResult.valid()) {
-			sol::error err = loadResult;
-			Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] " + std::string(err.what()));
+		// Give the node the version it last ran at so it can skip components that haven't changed since,
+		// then take a new one. Anything written from now on, including by systems running alongside us, is stamped
+		// after the increment so it's newer than the version we keep. Our own writes will show up next run too
+		config.set(LuaVal(std::string("lastRunVersion")), LuaVal((double)lastRunVersion));
+		lastRunVersion = worker->getWorld()->changeVersion.fetch_add(1);
+
+		std::string error;
+		sol::protected_function function = worker->functions.load(update.getInterned(), error);
+		if (!function.valid()) {
+			Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] " + error);
 			return;
 		}
 
-		auto result = type == DEPENDENCY_NODE_TYPE_RENDERER ? loadResult(config, subrenderer) : loadResult(config);
+		auto result = type == DEPENDENCY_NODE_TYPE_RENDERER ? function(config, subrenderer) : function(config);
 
 		if (!result.valid()) {
 			sol::error err = result;
@@ -498,7 +504,24 @@ void DependencyNode::windowRefresh(int imageCount) {
 		subrenderer->windowRefresh(imageCount);
 }
 
-void DependencyNode::cleanup() {
+void DependencyNode::cleanup(Worker* worker) {
+	// Nodes that never finished initializing may not have anything to clean up, e.g. if the world was cancelled while loading
+	bool initialized = status->initStatus == DEPENDENCY_FUNCTION_COMPLETE || status->initStatus == DEPENDENCY_FUNCTION_NOT_AVAILABLE;
+	LuaVal cleanup = config.get("cleanup");
+	if (initialized && cleanup.type == LUA_TYPE_FUNCTION) {
+		std::string error;
+		sol::protected_function function = worker->functions.load(cleanup.getInterned(), error);
+		if (!function.valid())
+			Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] " + error);
+		else {
+			auto result = type == DEPENDENCY_NODE_TYPE_RENDERER ? function(config, subrenderer) : function(config);
+			if (!result.valid()) {
+				sol::error err = result;
+				Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] " + std::string(err.what()));
+			}
+		}
+	}
+
 	if (subrenderer != nullptr)
 		subrenderer->cleanup();
 }
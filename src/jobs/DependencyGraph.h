@@ -54,7 +54,8 @@ namespace vecs {
 		void execute(Worker* worker);
 		void windowRefresh(int imageCount);
 
-		void cleanup();
+		// Runs the node's cleanup function if it has one and finished initializing, e.g. to save state before the world is destroyed
+		void cleanup(Worker* worker);
 
 	private:
 		DependencyGraph* graph;
@@ -63,6 +64,9 @@ namespace vecs {
 		DependencyNodeLoadStatus* status;
 
 		SubRenderer* subrenderer = nullptr;
+
+		// The world's change version when we last executed, or 0 if we haven't yet
+		uint32_t lastRunVersion = 0;
 	};
 
 	class DependencyGraph {
@@ -80,7 +84,7 @@ namespace vecs {
 		void execute(Worker* worker);
 		void windowRefresh(int imageCount);
 
-		void cleanup();
+		void cleanup(Worker* worker);
 
 	private:
 		Engine* engine;
@@ -33,7 +33,10 @@ namespace vecs {
 		JOB_TYPE_CASCADE,
 		// Lua-created jobs
 		JOB_TYPE_PARALLEL,
-		JOB_TYPE_NORMAL
+		JOB_TYPE_EACH,
+		JOB_TYPE_NORMAL,
+		// Used for splitting native work across workers. extra is a std::function<void()>* that gets deleted once it's ran
+		JOB_TYPE_NATIVE
 	};
 
 	struct ParallelData {
@@ -43,6 +46,14 @@ namespace vecs {
 		bool inBuffer = true;
 	};
 
+	// Used by query:eachParallel. Each job walks a range of rows [start, end) of one archetype
+	struct EachData {
+		Archetype* archetype;
+		std::vector<std::string> componentTypes;
+		uint32_t start;
+		uint32_t end;
+	};
+
 	struct Job {
 	public:
 		World* world;
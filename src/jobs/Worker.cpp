@@ -1,5 +1,8 @@
 #include "Worker.h"
 
+#include "../ecs/Archetype.h"
+#include "../ecs/EntityCommandBuffer.h"
+#include "../ecs/EntityQuery.h"
 #include "../ecs/World.h"
 #include "../ecs/WorldLoadStatus.h"
 #include "../engine/Device.h"
@@ -14,6 +17,8 @@
 #include "../lua/RenderingBindings.h"
 #include "../lua/UtilityBindings.h"
 
+#include <functional>
+
 using namespace vecs;
 
 // Used to keep workers asleep when there's no job to work on
@@ -23,6 +28,7 @@ std::mutex wakeMutex;
 Worker::Worker(Engine* engine, World* world) : queue(this), persistentQueue(this) {
 	this->engine = engine;
 	this->world = world;
+	commands = std::make_unique<EntityCommandBuffer>();
 
 	// Mark jobs as in a buffer
 	for (int i = 0; i < MAX_JOB_COUNT; i++) {
@@ -30,6 +36,9 @@ Worker::Worker(Engine* engine, World* world) : queue(this), persistentQueue(this
 	}
 }
 
+// Defined here so the command buffer's type is complete when it's destroyed
+Worker::~Worker() {}
+
 World* Worker::getWorld() {
 	if (job != nullptr)
 		return job->world;
@@ -262,12 +271,12 @@ bool Worker::work(Job* job) {
 		}
 		case JOB_TYPE_PARALLEL: {
 			auto parData = (ParallelData*)job->extra;
-			auto loadResult = lua.load(job->function.as_string_view());
-			if (!loadResult.valid()) {
-				sol::error err = loadResult;
-				Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA][JOB] " + std::string(err.what()));
+			std::string error;
+			sol::protected_function function = functions.load(job->function.as_string_view(), error);
+			if (!function.valid()) {
+				Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA][JOB] " + error);
 			} else {
-				auto result = loadResult(job->data, parData->start, parData->end);
+				auto result = function(job->data, parData->start, parData->end);
 				if (!result.valid()) {
 					sol::error err = result;
 					Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA][JOB] " + std::string(err.what()));
@@ -280,13 +289,37 @@ bool Worker::work(Job* job) {
 				delete parData;
 			break;
 		}
+		case JOB_TYPE_EACH: {
+			auto eachData = (EachData*)job->extra;
+			std::string error;
+			sol::protected_function function = functions.load(job->function.as_string_view(), error);
+			if (!function.valid()) {
+				Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA][JOB] " + error);
+			} else {
+				std::vector<ComponentList*> lists;
+				if (EntityQuery::getComponentLists(eachData->archetype, eachData->componentTypes, lists)) {
+					// eachRange locks each row on its own and lets go before calling the function, so the function can make
+					// structural changes to the archetype without deadlocking
+					EntityQuery::eachRange(eachData->archetype, lists, eachData->start, eachData->end, function, job->data, lua.lua_state());
+				}
+			}
+			delete job->data;
+			delete eachData;
+			break;
+		}
+		case JOB_TYPE_NATIVE: {
+			auto function = (std::function<void()>*)job->extra;
+			(*function)();
+			delete function;
+			break;
+		}
 		case JOB_TYPE_NORMAL: {
-			auto loadResult = lua.load(job->function.as_string_view());
-			if (!loadResult.valid()) {
-				sol::error err = loadResult;
-				Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA][JOB] " + std::string(err.what()));
+			std::string error;
+			sol::protected_function function = functions.load(job->function.as_string_view(), error);
+			if (!function.valid()) {
+				Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA][JOB] " + error);
 			} else {
-				auto result = loadResult(job->data);
+				auto result = function(job->data);
 				if (!result.valid()) {
 					sol::error err = result;
 					Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA][JOB] " + std::string(err.what()));
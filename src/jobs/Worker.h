@@ -4,16 +4,19 @@
 #define SOL_ALL_SAFETIES_ON 1
 #include <sol\sol.hpp>
 
+#include <memory>
 #include <mutex>
 #include <vulkan/vulkan.h>
 
 #include "JobQueue.h"
+#include "../lua/FunctionCache.h"
 
 namespace vecs {
 
 	// Forward Declarations
 	class Device;
 	class Engine;
+	class EntityCommandBuffer;
 	class JobManager;
 	class World;
 
@@ -22,6 +25,8 @@ namespace vecs {
 		Engine* engine;
 
 		sol::state lua;
+		// Functions loaded into lua from bytecode, so each only has to be loaded once
+		FunctionCache functions{ lua };
 
 		VkCommandPool commandPool;
 		VkQueue graphicsQueue;
@@ -31,10 +36,14 @@ namespace vecs {
 		Job* job = nullptr;
 		bool stealPersistent = true;
 
+		// Structural changes to entities made by jobs on this worker, applied at the end of the world's update
+		std::unique_ptr<EntityCommandBuffer> commands;
+
 		ParallelData parallelDataPool[MAX_JOB_COUNT];
 		uint32_t allocatedParallelData = 0;
 
 		Worker(Engine* engine, World* world = nullptr);
+		~Worker();
 
 		World* getWorld();
 		virtual Job* allocateJob();
@@ -1,9 +1,16 @@
 #include "ECSBindings.h"
 
 #include "../ecs/Archetype.h"
+#include "../ecs/ComponentList.h"
+#include "../ecs/EntityCommandBuffer.h"
 #include "../ecs/EntityQuery.h"
+#include "../ecs/RegionStore.h"
 #include "../ecs/World.h"
+#include "../ecs/WorldSnapshot.h"
+#include "../engine/Debugger.h"
 #include "../jobs/Worker.h"
+#include "../lib/FrustumCull.h"
+#include "JobBindings.h"
 
 void vecs::ECSBindings::setupState(sol::state& lua, Worker* worker) {
 	lua.new_usertype<Archetype>("archetype",
@@ -15,8 +22,34 @@ void vecs::ECSBindings::setupState(sol::state& lua, Worker* worker) {
 		"isEmpty", [](Archetype& archetype) -> bool { return archetype.numEntities == 0; },
 		"getComponents", &Archetype::getComponentList,
 		"getSharedComponent", [](Archetype& archetype, std::string component_t) -> LuaVal { return archetype.getSharedComponent(component_t); },
-		"createEntity", [](Archetype& archetype) -> std::pair<uint32_t, uint32_t> { return archetype.createEntities(1); },
-		"createEntities", & Archetype::createEntities,
+		"createEntity", [](Archetype& archetype) -> uint32_t {
+			// Nothing gets created if the archetype is locked by this thread
+			std::vector<uint32_t> created = archetype.createEntities(1);
+			return created.empty() ? 0 : created.front();
+		},
+		// These return an array of the new entities' ids, which aren't necessarily consecutive since destroyed ids get reused
+		"createEntities", sol::overload(
+			[](Archetype& archetype, uint32_t amount) { return sol::as_table(archetype.createEntities(amount)); },
+			// e.g. createEntities(100, { Gundam = { y = 0 } }) gives each entity its own copy of each component in the prototype
+			[](Archetype& archetype, uint32_t amount, sol::table prototype) {
+				return sol::as_table(archetype.createEntities(amount, LuaVal::fromTable(prototype)));
+			}
+		),
+		// Takes a table of component types to arrays of values, creating one entity per element
+		"createEntitiesFromColumns", [](Archetype& archetype, sol::table columns) {
+			std::unordered_map<std::string, std::vector<LuaVal>> values;
+			uint32_t amount = 0;
+			for (auto kvp : columns) {
+				sol::table array = kvp.second.as<sol::table>();
+				auto& column = values[kvp.first.as<std::string>()];
+				size_t size = array.size();
+				column.reserve(size);
+				for (size_t i = 1; i <= size; i++)
+					column.emplace_back(LuaVal::asLuaVal(array.get<sol::object>(i)));
+				amount = std::max(amount, (uint32_t)size);
+			}
+			return sol::as_table(archetype.createEntities(amount, values));
+		},
 		"deleteEntity", [](Archetype& archetype, uint32_t entity) { archetype.removeEntities({ entity }); },
 		"deleteEntities", & Archetype::removeEntities,
 		"clearEntities", &Archetype::clearEntities,
@@ -24,6 +57,15 @@ void vecs::ECSBindings::setupState(sol::state& lua, Worker* worker) {
 		"unlock_shared", &Archetype::unlock_shared,
 		sol::meta_function::length, [](Archetype& archetype) -> uint32_t { return archetype.numEntities.load(); }
 	);
+	lua.new_usertype<ComponentList>("componentList",
+		sol::no_constructor,
+		"iterate", &ComponentList::iterate,
+		"iterate_range", &ComponentList::iterate_range,
+		"changedSince", &ComponentList::changedSince,
+		sol::meta_function::index, &ComponentList::get_lua,
+		sol::meta_function::new_index, &ComponentList::set_lua,
+		sol::meta_function::length, &ComponentList::getLength
+	);
 	lua.new_usertype<EntityQuery>("query",
 		"new", sol::factories(
 			[worker](std::vector<std::string> required) -> EntityQuery* {
@@ -40,33 +82,157 @@ void vecs::ECSBindings::setupState(sol::state& lua, Worker* worker) {
 				return query;
 			}
 		),
-		"getArchetypes", [](const EntityQuery& query) -> sol::as_table_t<std::vector<Archetype*>> { return query.matchingArchetypes; }
+		"getArchetypes", [](const EntityQuery& query) -> sol::as_table_t<std::vector<Archetype*>> { return *query.getArchetypes(); },
+		"changedSince", &EntityQuery::changedSince,
+		"each", &EntityQuery::each,
+		"eachParallel", [worker](EntityQuery* query, std::vector<std::string> componentTypes, sol::function jobFunction, LuaVal* data, double maxEntityCount) -> Job* {
+			return JobBindings::createParallelEach(worker, query, componentTypes, jobFunction, data, maxEntityCount);
+		},
+		"onAdd", &EntityQuery::setOnAdd,
+		"onRemove", &EntityQuery::setOnRemove
+	);
+	// Structural changes to existing entities. These take either a single entity or a table of entities,
+	// and moving many entities at once is much cheaper than moving them one at a time
+	lua["world"] = lua.create_table_with(
+		"addComponent", sol::overload(
+			[worker](sol::table self, uint32_t entity, std::string componentType, sol::object value) {
+				worker->getWorld()->addComponent({ entity }, componentType, { LuaVal::asLuaVal(value) });
+			},
+			[worker](sol::table self, std::vector<uint32_t> entities, std::string componentType, sol::object value) {
+				// Convert the value for each entity so they don't all end up sharing the same table
+				std::vector<LuaVal> values;
+				values.reserve(entities.size());
+				for (size_t i = 0; i < entities.size(); i++)
+					values.emplace_back(LuaVal::asLuaVal(value));
+				worker->getWorld()->addComponent(entities, componentType, values);
+			}
+		),
+		"removeComponent", sol::overload(
+			[worker](sol::table self, uint32_t entity, std::string componentType) {
+				worker->getWorld()->removeComponent({ entity }, componentType);
+			},
+			[worker](sol::table self, std::vector<uint32_t> entities, std::string componentType) {
+				worker->getWorld()->removeComponent(entities, componentType);
+			}
+		),
+		// Computes the world matrix of every entity with a Transform. See systems/transforms.lua
+		"updateTransforms", [worker](sol::table self) {
+			worker->getWorld()->transforms.update(worker);
+		},
+		// The entity's world matrix from the last updateTransforms, or nil if it doesn't have a Transform
+		"getWorldMatrix", [worker](sol::table self, uint32_t entity) -> sol::optional<glm::mat4> {
+			glm::mat4 matrix;
+			if (!worker->getWorld()->transforms.getWorldMatrix(entity, matrix))
+				return sol::nullopt;
+			return matrix;
+		},
+		// Each returns an array of the entities whose Bounds overlap the shape, as of the end of the last frame
+		"queryBox", [worker](sol::table self, glm::vec3 min, glm::vec3 max) {
+			return sol::as_table(worker->getWorld()->spatialIndex.queryBox(min, max));
+		},
+		"querySphere", [worker](sol::table self, glm::vec3 center, float radius) {
+			return sol::as_table(worker->getWorld()->spatialIndex.querySphere(center, radius));
+		},
+		"queryFrustum", [worker](sol::table self, Frustum const& frustum) {
+			return sol::as_table(worker->getWorld()->spatialIndex.queryFrustum(frustum));
+		},
+		// Saves or restores the world's archetypes, entities and resources. Both return whether they succeeded.
+		// Passing component types only saves entities with one of them, e.g. world:saveSnapshot(filename, { "Chunk" })
+		"saveSnapshot", [worker](sol::table self, std::string filename, sol::optional<std::vector<std::string>> componentTypes) -> bool {
+			return WorldSnapshot::save(worker->getWorld(), filename, componentTypes.value_or(std::vector<std::string>()));
+		},
+		"loadSnapshot", [worker](sol::table self, std::string filename) -> bool {
+			return WorldSnapshot::load(worker->getWorld(), filename);
+		},
+		// Chunks saved with saveChunk are written to region files in the directory by a background job.
+		// Archetypes in them are saved as their key in the palette, e.g. world:openRegions("saves/regions", world.resources.blocks)
+		"openRegions", [worker](sol::table self, std::string directory, sol::table palette) {
+			World* world = worker->getWorld();
+			std::atomic_store(&world->regions, std::make_shared<RegionStore>(directory, LuaVal::fromTable(palette)));
+		},
+		"saveChunk", [worker](sol::table self, int x, int y, int z, sol::object chunk) {
+			auto store = std::atomic_load(&worker->getWorld()->regions);
+			if (store == nullptr) {
+				Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] Unable to save chunk, world:openRegions hasn't been called");
+				return;
+			}
+			store->save(worker, glm::ivec3(x, y, z), LuaVal::asLuaVal(chunk));
+		},
+		// Returns nil if the chunk hasn't been saved. This reads from disk, so it's best called from a job
+		"loadChunk", [worker](sol::table self, int x, int y, int z, sol::this_state s) -> sol::object {
+			auto store = std::atomic_load(&worker->getWorld()->regions);
+			if (store == nullptr)
+				return sol::make_object(sol::state_view(s), sol::lua_nil);
+			return store->load(glm::ivec3(x, y, z)).asObject(s);
+		}
+	);
+	// world.resources.name reads or sets one of the world's resources. We look up the world on each access
+	// since the worker may be moved to a different world
+	sol::table resources = lua.create_table();
+	resources[sol::metatable_key] = lua.create_table_with(
+		"__index", [worker](sol::table self, std::string name, sol::this_state s) -> sol::object {
+			return worker->getWorld()->resources.get(name).asObject(s);
+		},
+		"__newindex", [worker](sol::table self, std::string name, sol::object value) {
+			worker->getWorld()->resources.set(name, LuaVal::asLuaVal(value));
+		}
+	);
+	lua["world"]["resources"] = resources;
+	// Deferred versions of structural changes, for use inside jobs. These are recorded into the worker's command
+	// buffer and applied at the end of the world's update, so they never wait on other jobs iterating the archetypes
+	lua["commands"] = lua.create_table_with(
+		"createEntity", sol::overload(
+			[worker](Archetype* archetype) -> uint32_t {
+				return worker->commands->createEntity(worker->getWorld(), archetype);
+			},
+			[worker](Archetype* archetype, sol::table components) -> uint32_t {
+				World* world = worker->getWorld();
+				uint32_t entity = worker->commands->createEntity(world, archetype);
+				for (auto kvp : components)
+					worker->commands->set(world, entity, kvp.first.as<std::string>(), LuaVal::asLuaVal(kvp.second));
+				return entity;
+			}
+		),
+		"deleteEntity", [worker](uint32_t entity) { worker->commands->deleteEntity(worker->getWorld(), entity); },
+		"set", [worker](uint32_t entity, std::string componentType, sol::object value) {
+			worker->commands->set(worker->getWorld(), entity, componentType, LuaVal::asLuaVal(value));
+		},
+		"addComponent", [worker](uint32_t entity, std::string componentType, sol::object value) {
+			worker->commands->addComponent(worker->getWorld(), entity, componentType, LuaVal::asLuaVal(value));
+		},
+		"removeComponent", [worker](uint32_t entity, std::string componentType) {
+			worker->commands->removeComponent(worker->getWorld(), entity, componentType);
+		}
 	);
 	// Note: note ideal for creating large amounts of similar entities. Use an archetype
 	// This is just a convenience function for creating a single entity quickly
 	// I don't create a new usertype because uint8_t is already marked non-constructible
 	lua["createEntity"] = sol::overload(
-		[worker](sol::table components) -> std::pair<uint32_t, uint32_t> {
+		[worker](sol::table components) -> uint32_t {
 			std::unordered_set<std::string> componentTypes;
 			for (auto kvp : components) {
 				componentTypes.insert(kvp.first.as<std::string>());
 			}
 			Archetype* archetype = worker->getWorld()->getArchetype(componentTypes);
-			auto entity = archetype->createEntities(1);
+			std::vector<uint32_t> created = archetype->createEntities(1);
+			if (created.empty()) return 0;
+			uint32_t entity = created.front();
 			for (auto kvp : components) {
-				archetype->getComponentList(kvp.first.as<std::string>()).set(LuaVal((double)entity.first), LuaVal::asLuaVal(kvp.second));
+				archetype->getComponentList(kvp.first.as<std::string>())->set(entity, LuaVal::asLuaVal(kvp.second));
 			}
 			return entity;
 		},
-		[worker](sol::table components, sol::table sharedComponents) -> std::pair<uint32_t, uint32_t> {
+		[worker](sol::table components, sol::table sharedComponents) -> uint32_t {
 			std::unordered_set<std::string> componentTypes;
 			for (auto kvp : components) {
 				componentTypes.insert(kvp.first.as<std::string>());
 			}
 			Archetype* archetype = worker->getWorld()->getArchetype(componentTypes, &LuaVal::fromTable(sharedComponents));
-			auto entity = archetype->createEntities(1);
+			std::vector<uint32_t> created = archetype->createEntities(1);
+			if (created.empty()) return 0;
+			uint32_t entity = created.front();
 			for (auto kvp : components) {
-				archetype->getComponentList(kvp.first.as<std::string>()).set(LuaVal((double)entity.first), LuaVal::asLuaVal(kvp.second));
+				archetype->getComponentList(kvp.first.as<std::string>())->set(entity, LuaVal::asLuaVal(kvp.second));
 			}
 			return entity;
 		}
@@ -0,0 +1,68 @@
+#include "FunctionCache.h"
+
+#include "LuaString.h"
+
+using namespace vecs;
+
+namespace {
+	const char* REGISTRY_KEY = "vecs.functionCache";
+}
+
+FunctionCache::FunctionCache(sol::state& lua) : lua(lua) {
+	// Stored as light userdata so LuaVal can find us from just the lua state
+	lua.registry()[REGISTRY_KEY] = (void*)this;
+}
+
+FunctionCache::~FunctionCache() {
+	clear();
+}
+
+FunctionCache* FunctionCache::fromState(lua_State* state) {
+	sol::object cache = sol::state_view(state).registry()[REGISTRY_KEY];
+	if (cache.get_type() != sol::type::lightuserdata)
+		return nullptr;
+	return (FunctionCache*)cache.as<void*>();
+}
+
+sol::protected_function FunctionCache::load(std::string_view bytecode, std::string& error) {
+	LuaString* interned = LuaString::intern(bytecode);
+	sol::protected_function function = load(interned, error);
+	interned->release();
+	return function;
+}
+
+sol::protected_function FunctionCache::load(LuaString* bytecode, std::string& error) {
+	auto it = functions.find(bytecode);
+	if (it != functions.end())
+		return it->second;
+
+	auto loadResult = lua.load(bytecode->get());
+	if (!loadResult.valid()) {
+		sol::error err = loadResult;
+		error = err.what();
+		return sol::protected_function();
+	}
+
+	if (functions.size() >= MAX_FUNCTIONS)
+		clear();
+	sol::protected_function function = loadResult;
+	bytecode->addReference();
+	functions.emplace(bytecode, function);
+	sources.emplace(function.pointer(), bytecode);
+	return function;
+}
+
+LuaString* FunctionCache::getSource(sol::reference const& function) const {
+	auto it = sources.find(function.pointer());
+	if (it == sources.end())
+		return nullptr;
+	it->second->addReference();
+	return it->second;
+}
+
+void FunctionCache::clear() {
+	for (auto& kvp : functions)
+		kvp.first->release();
+	functions.clear();
+	sources.clear();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#define SOL_DEFAULT_PASS_ON_ERROR 1
+#define SOL_ALL_SAFETIES_ON 1
+#include <sol\sol.hpp>
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace vecs {
+
+	// Forward Declarations
+	class LuaString;
+
+	// Functions get passed around as bytecode so any worker can run them, but undumping the bytecode and creating
+	// a new closure every time one runs adds up quickly with systems running every frame and jobs splitting into
+	// hundreds of parts. Each worker's lua state keeps one of these, so each distinct piece of bytecode is only
+	// loaded once and every later run reuses the same function.
+	// Since the function is reused so are its upvalues, which used to start out nil on every run
+	class FunctionCache {
+	public:
+		// If we ever have this many functions we start over, in case something keeps generating new code
+		static const size_t MAX_FUNCTIONS = 4096;
+
+		FunctionCache(sol::state& lua);
+		~FunctionCache();
+
+		// Returns the cache belonging to the state, or nullptr if it doesn't have one
+		static FunctionCache* fromState(lua_State* state);
+
+		// Returns the function for this bytecode, or an invalid function with error set if it couldn't be loaded
+		sol::protected_function load(std::string_view bytecode, std::string& error);
+		sol::protected_function load(LuaString* bytecode, std::string& error);
+		// Returns the bytecode a function we loaded came from, with a reference added for the caller,
+		// or nullptr if it didn't come from us. This lets functions go back into LuaVals without dumping them again
+		LuaString* getSource(sol::reference const& function) const;
+
+	private:
+		sol::state_view lua;
+		// We hold a reference on every key, so the bytecode stays interned while we're using it
+		std::unordered_map<LuaString*, sol::protected_function> functions;
+		// Maps each loaded function back to its bytecode, by the address of the function in the lua state
+		std::unordered_map<const void*, LuaString*> sources;
+
+		void clear();
+	};
+}
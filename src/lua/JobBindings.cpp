@@ -1,28 +1,41 @@
 #include "JobBindings.h"
 
 #include "../ecs/Archetype.h"
+#include "../ecs/ComponentList.h"
+#include "../ecs/EntityQuery.h"
 #include "../jobs/JobQueue.h"
 #include "../jobs/Worker.h"
 #include "../lua/LuaVal.h"
 
 using namespace vecs;
 
-Job* createParallel(Worker* worker, sol::function jobFunction, LuaVal* data, Archetype* archetype, double maxEntityCount, uint32_t start, uint32_t end) {
-	archetype->mutex.lock_shared();
-	// Find size of entities
-	auto it = archetype->entities.begin();
-	while (*it < start)
-		it++;
-
-	auto beginIt = it;
-	uint32_t numEntities = 0;
-	while (it != archetype->entities.end() && *it < end) {
-		it++;
-		numEntities++;
+// Returns where each job's range of rows ends, for jobs of at most maxEntityCount rows covering [start, end).
+// Jobs of at least a block get split on block boundaries, so no two jobs share a block
+std::vector<uint32_t> splitRows(uint32_t start, uint32_t end, double maxEntityCount) {
+	uint32_t numEntities = end > start ? end - start : 0;
+	uint32_t jobSize = numEntities == 0 ? 0 : ceil(numEntities / ceil(numEntities / maxEntityCount));
+	if (jobSize >= ComponentList::BLOCK_SIZE)
+		jobSize -= jobSize % ComponentList::BLOCK_SIZE;
+	std::vector<uint32_t> jobEnds;
+	for (uint32_t jobStart = start; jobStart < end;) {
+		uint32_t jobEnd = jobStart + jobSize;
+		if (jobSize >= ComponentList::BLOCK_SIZE)
+			jobEnd -= jobEnd % ComponentList::BLOCK_SIZE;
+		if (jobEnd <= jobStart || jobEnd > end)
+			jobEnd = std::min(jobStart + jobSize, end);
+		jobEnds.push_back(jobEnd);
+		jobStart = jobEnd;
 	}
-	it = beginIt;
+	return jobEnds;
+}
 
-	uint32_t numJobs = ceil(numEntities / maxEntityCount);
+// start and end are a range of rows [start, end) within the archetype
+Job* createParallel(Worker* worker, sol::function jobFunction, LuaVal* data, Archetype* archetype, double maxEntityCount, uint32_t start, uint32_t end) {
+	archetype->lock_shared();
+	// Rows are dense so we can find the number of entities without walking them
+	end = std::min(end, (uint32_t)archetype->entities.size());
+	std::vector<uint32_t> jobEnds = splitRows(start, end, maxEntityCount);
+	uint32_t numJobs = jobEnds.size();
 
 	// Create the root job
 	Job* rootJob = worker->allocateJob();
@@ -33,21 +46,13 @@ Job* createParallel(Worker* worker, sol::function jobFunction, LuaVal* data, Arc
 	rootJob->parent = nullptr;
 	rootJob->continuationCount = 0;
 
-	uint32_t i = 0;
 	World* world = worker->getWorld();
-	while (i < numEntities) {
-		// Calculate the number of entities to handle in this sub-job
-		uint32_t size = ceil(numEntities - i) / numJobs;
-		numJobs--;
-
+	uint32_t jobStart = start;
+	for (uint32_t jobEnd : jobEnds) {
 		ParallelData* parData = worker->allocateParallelData();
-		parData->start = *it;
-		// I was getting occasional crashes with de-referencing *it
-		// when using std::advance(it, size);
-		for (int i = 0; i < size && it != std::prev(archetype->entities.end()); i++)
-			it++;
-		parData->end = *it;
-		i += size;
+		parData->start = jobStart;
+		parData->end = jobEnd;
+		jobStart = jobEnd;
 
 		// Create the subjob
 		Job* job = worker->allocateJob();
@@ -55,7 +60,7 @@ Job* createParallel(Worker* worker, sol::function jobFunction, LuaVal* data, Arc
 		// Copy data to job
 		// TODO avoid creating so many allocations?
 		assert(data->type == LUA_TYPE_TABLE);
-		job->data = new LuaVal(std::get<LuaVal::MapType*>(data->value));
+		job->data = new LuaVal(data->as<LuaVal::MapType*>());
 		job->parent = rootJob;
 		job->extra = parData;
 		job->type = JOB_TYPE_PARALLEL;
@@ -66,9 +71,51 @@ Job* createParallel(Worker* worker, sol::function jobFunction, LuaVal* data, Arc
 
 		worker->pushJob(job);
 	}
-	archetype->mutex.unlock_shared();
+	archetype->unlock_shared();
+
+	return rootJob;
+}
+
+Job* vecs::JobBindings::createParallelEach(Worker* worker, EntityQuery* query, std::vector<std::string> componentTypes, sol::function jobFunction, LuaVal* data, double maxEntityCount) {
+	assert(data->type == LUA_TYPE_TABLE);
+	World* world = worker->getWorld();
+
+	// Create the root job. It can't finish until it's submitted itself, so we can count sub-jobs as we push them
+	Job* rootJob = worker->allocateJob();
+	rootJob->type = JOB_TYPE_DUMMY;
+	rootJob->world = world;
+	rootJob->unfinishedJobs = 1;
+	rootJob->persistent = false;
+	rootJob->parent = nullptr;
+	rootJob->continuationCount = 0;
 
-	// TODO do a binary split
+	sol::bytecode function = jobFunction.dump();
+	std::vector<ComponentList*> lists;
+	for (Archetype* archetype : *query->getArchetypes()) {
+		if (!EntityQuery::getComponentLists(archetype, componentTypes, lists)) continue;
+
+		archetype->lock_shared();
+		uint32_t jobStart = 0;
+		for (uint32_t jobEnd : splitRows(0, archetype->entities.size(), maxEntityCount)) {
+			EachData* eachData = new EachData{ archetype, componentTypes, jobStart, jobEnd };
+			jobStart = jobEnd;
+
+			Job* job = worker->allocateJob();
+			job->function = function;
+			job->data = new LuaVal(data->as<LuaVal::MapType*>());
+			job->parent = rootJob;
+			job->extra = eachData;
+			job->type = JOB_TYPE_EACH;
+			job->unfinishedJobs = 1;
+			job->persistent = false;
+			job->continuationCount = 0;
+			job->world = world;
+
+			rootJob->unfinishedJobs++;
+			worker->pushJob(job);
+		}
+		archetype->unlock_shared();
+	}
 
 	return rootJob;
 }
@@ -98,7 +145,7 @@ void vecs::JobBindings::setupState(sol::state& lua, Worker* worker) {
 				// Copy data to job
 				// TODO avoid creating so many allocations?
 				assert(data->type == LUA_TYPE_TABLE);
-				job->data = new LuaVal(std::get<LuaVal::MapType*>(data->value));
+				job->data = new LuaVal(data->as<LuaVal::MapType*>());
 				job->parent = nullptr;
 				job->type = JOB_TYPE_NORMAL;
 				job->unfinishedJobs = 1;
@@ -122,7 +169,7 @@ void vecs::JobBindings::setupState(sol::state& lua, Worker* worker) {
 		"createParallel", sol::overload(
 			[worker](sol::function jobFunction, LuaVal* data, Archetype* archetype, double maxEntityCount) -> Job* {
 				if (archetype->numEntities > 0)
-					return createParallel(worker, jobFunction, data, archetype, maxEntityCount, *archetype->entities.begin(), *archetype->entities.rbegin());
+					return createParallel(worker, jobFunction, data, archetype, maxEntityCount, 0, archetype->numEntities);
 				else {
 					Job* job = worker->allocateJob();
 					job->type = JOB_TYPE_DUMMY;
@@ -7,10 +7,17 @@
 namespace vecs {
 	
 	// Forward Declarations
+	class EntityQuery;
+	struct Job;
+	class LuaVal;
 	class Worker;
 
 	namespace JobBindings {
 
+		// Creates jobs that call jobFunction(data, entity, componentA, componentB, ...) for every entity in the
+		// query's archetypes with all the given component types, split into jobs of at most maxEntityCount entities
+		Job* createParallelEach(Worker* worker, EntityQuery* query, std::vector<std::string> componentTypes, sol::function jobFunction, LuaVal* data, double maxEntityCount);
+
 		void setupState(sol::state& lua, Worker* worker);
 	}
 }
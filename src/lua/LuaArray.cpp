@@ -0,0 +1,88 @@
+#include "LuaArray.h"
+
+#include "LuaVal.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <new>
+
+using namespace vecs;
+
+namespace {
+	template<typename T>
+	T clampTo(double value) {
+		// Converting an out of range double is undefined, so we clamp first. NaN becomes 0
+		if (value != value) return 0;
+		return (T)std::clamp(value, (double)std::numeric_limits<T>::min(), (double)std::numeric_limits<T>::max());
+	}
+}
+
+LuaArray* LuaArray::create(LuaType type, size_t size) {
+	assert(type == LUA_TYPE_FLOAT_ARRAY || type == LUA_TYPE_INT_ARRAY || type == LUA_TYPE_BYTE_ARRAY);
+	LuaArray* array = new LuaArray(type);
+	array->resize(size);
+	return array;
+}
+
+LuaArray::~LuaArray() {
+	::operator delete[](storage, std::align_val_t(ALIGNMENT));
+}
+
+void LuaArray::release() {
+	if (references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		delete this;
+}
+
+size_t LuaArray::getElementSize() const {
+	switch (type) {
+	case LUA_TYPE_FLOAT_ARRAY: return sizeof(float);
+	case LUA_TYPE_INT_ARRAY: return sizeof(int32_t);
+	default: return sizeof(uint8_t);
+	}
+}
+
+double LuaArray::get(size_t index) const {
+	assert(index < count);
+	switch (type) {
+	case LUA_TYPE_FLOAT_ARRAY: return ((const float*)storage)[index];
+	case LUA_TYPE_INT_ARRAY: return ((const int32_t*)storage)[index];
+	default: return storage[index];
+	}
+}
+
+void LuaArray::set(size_t index, double value) {
+	assert(index < count);
+	switch (type) {
+	case LUA_TYPE_FLOAT_ARRAY: ((float*)storage)[index] = (float)value; break;
+	case LUA_TYPE_INT_ARRAY: ((int32_t*)storage)[index] = clampTo<int32_t>(value); break;
+	default: storage[index] = clampTo<uint8_t>(value); break;
+	}
+}
+
+void LuaArray::push(double value) {
+	if (count == capacity)
+		reserve(std::max<size_t>(capacity * 2, ALIGNMENT));
+	count++;
+	set(count - 1, value);
+}
+
+void LuaArray::resize(size_t size) {
+	reserve(size);
+	if (size > count)
+		std::memset(storage + count * getElementSize(), 0, (size - count) * getElementSize());
+	count = size;
+}
+
+void LuaArray::reserve(size_t amount) {
+	if (amount <= capacity) return;
+	// Rounded up so the end of the last SIMD vector is still ours
+	size_t bytes = (amount * getElementSize() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	unsigned char* grown = (unsigned char*)::operator new[](bytes, std::align_val_t(ALIGNMENT));
+	if (count > 0)
+		std::memcpy(grown, storage, count * getElementSize());
+	::operator delete[](storage, std::align_val_t(ALIGNMENT));
+	storage = grown;
+	capacity = bytes / getElementSize();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+
+namespace vecs {
+
+	// Forward Declarations
+	enum LuaType : uint8_t;
+
+	// A contiguous array of floats, 32 bit ints or bytes, for big flat arrays like vertices and noise sets that would
+	// otherwise take a table entry per number. LuaVals holding the same array share it by reference count, and
+	// like tables any changes are seen through all of them.
+	// Storage is aligned and padded to 64 bytes, so SIMD code like noise generation can fill it directly
+	class LuaArray {
+	public:
+		static constexpr size_t ALIGNMENT = 64;
+
+		// Returns a new array of size zeroed elements, with a reference already added for the caller.
+		// type is LUA_TYPE_FLOAT_ARRAY, LUA_TYPE_INT_ARRAY or LUA_TYPE_BYTE_ARRAY
+		static LuaArray* create(LuaType type, size_t size = 0);
+
+		LuaArray(const LuaArray&) = delete;
+		LuaArray& operator=(const LuaArray&) = delete;
+
+		void addReference() { references.fetch_add(1, std::memory_order_relaxed); }
+		// Deletes the array once nothing references it
+		void release();
+
+		LuaType getType() const { return type; }
+		size_t getElementSize() const;
+		size_t size() const { return count; }
+		void* data() { return storage; }
+		const void* data() const { return storage; }
+
+		// Elements are read and written as doubles, converted from and to our element type.
+		// Ints and bytes are clamped to their range
+		double get(size_t index) const;
+		void set(size_t index, double value);
+		void push(double value);
+		// New elements start as 0
+		void resize(size_t size);
+		void reserve(size_t capacity);
+
+		// Arrays are shared between workers like tables are, so hold this while reading or writing our elements
+		std::shared_mutex& getMutex() const { return mutex; }
+
+	private:
+		std::atomic<uint32_t> references;
+		LuaType type;
+		unsigned char* storage = nullptr;
+		size_t count = 0;
+		size_t capacity = 0;
+		mutable std::shared_mutex mutex;
+
+		LuaArray(LuaType type) : references(1), type(type) {}
+		~LuaArray();
+	};
+}
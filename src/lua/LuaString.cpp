@@ -0,0 +1,41 @@
+#include "LuaString.h"
+
+using namespace vecs;
+
+LuaString::Shard LuaString::shards[LuaString::NUM_SHARDS];
+
+LuaString* LuaString::intern(std::string_view contents) {
+	size_t hash = std::hash<std::string_view>{}(contents);
+	Shard& shard = shards[(hash >> 8) % NUM_SHARDS];
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	auto it = shard.strings.find(contents);
+	if (it != shard.strings.end()) {
+		// A string whose last reference was just released is about to be deleted, so it can't be brought back.
+		// We replace it instead, and its release will see it's no longer in the table
+		uint32_t references = it->second->references.load(std::memory_order_relaxed);
+		while (references > 0) {
+			if (it->second->references.compare_exchange_weak(references, references + 1, std::memory_order_relaxed))
+				return it->second;
+		}
+		shard.strings.erase(it);
+	}
+
+	LuaString* string = new LuaString(contents, hash);
+	// The key points into the string itself, which never changes and lives as long as the entry
+	shard.strings.emplace(string->contents, string);
+	return string;
+}
+
+void LuaString::release() {
+	if (references.fetch_sub(1, std::memory_order_acq_rel) != 1)
+		return;
+
+	Shard& shard = shards[(hash >> 8) % NUM_SHARDS];
+	shard.mutex.lock();
+	auto it = shard.strings.find(contents);
+	if (it != shard.strings.end() && it->second == this)
+		shard.strings.erase(it);
+	shard.mutex.unlock();
+	delete this;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace vecs {
+
+	// An immutable string shared by every LuaVal holding the same contents, used for both strings and function bytecode.
+	// Strings are interned so there's only ever one live LuaString for any contents, which means copying a LuaVal
+	// just bumps a reference count and comparing two strings just compares pointers.
+	// The interning table is split into shards, each with its own lock, so workers creating strings at the same
+	// time rarely wait on each other
+	class LuaString {
+	public:
+		static const uint32_t NUM_SHARDS = 64;
+
+		// Returns the string with these contents, with a reference already added for the caller
+		static LuaString* intern(std::string_view contents);
+
+		void addReference() { references.fetch_add(1, std::memory_order_relaxed); }
+		// Deletes the string once nothing references it
+		void release();
+
+		std::string const& get() const { return contents; }
+		size_t getHash() const { return hash; }
+
+	private:
+		struct Shard {
+			std::mutex mutex;
+			std::unordered_map<std::string_view, LuaString*> strings;
+		};
+
+		static Shard shards[NUM_SHARDS];
+
+		std::atomic<uint32_t> references;
+		size_t hash;
+		std::string contents;
+
+		LuaString(std::string_view contents, size_t hash) : references(1), hash(hash), contents(contents) {}
+	};
+}
@@ -0,0 +1,242 @@
+#include "LuaTable.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace vecs;
+
+LuaTable::LuaTable(std::initializer_list<value_type> const& values) {
+	for (auto& kvp : values)
+		emplace(kvp.first, kvp.second);
+}
+
+LuaTable::iterator LuaTable::fromIndex(size_t index) {
+	return iterator(this, std::min(index, array.size()));
+}
+
+LuaTable::iterator LuaTable::find(LuaVal const& key) {
+	size_t index;
+	if (getArrayIndex(key, index) && index < array.size())
+		return array[index].type == LUA_TYPE_NIL ? end() : iterator(this, index);
+	uint32_t entry = findEntry(key);
+	return entry == EMPTY ? end() : iterator(this, array.size() + entry);
+}
+
+LuaTable::const_iterator LuaTable::find(LuaVal const& key) const {
+	size_t index;
+	if (getArrayIndex(key, index) && index < array.size())
+		return array[index].type == LUA_TYPE_NIL ? end() : const_iterator(this, index);
+	uint32_t entry = findEntry(key);
+	return entry == EMPTY ? end() : const_iterator(this, array.size() + entry);
+}
+
+size_t LuaTable::count(LuaVal const& key) const {
+	return find(key) != end() ? 1 : 0;
+}
+
+LuaVal& LuaTable::operator[](LuaVal const& key) {
+	size_t index;
+	if (getArrayIndex(key, index) && index < array.size()) {
+		// Like std::map this counts as adding the key, so callers are expected to assign something that isn't nil
+		if (array[index].type == LUA_TYPE_NIL)
+			arrayCount++;
+		return array[index];
+	}
+	uint32_t entry = findEntry(key);
+	if (entry != EMPTY)
+		return entries[entry].value;
+	size_t position = insert(key, LuaVal());
+	if (position < array.size()) {
+		// Same as above, insert only counts values that aren't nil
+		arrayCount++;
+		return array[position];
+	}
+	return entries[position - array.size()].value;
+}
+
+std::pair<LuaTable::iterator, bool> LuaTable::emplace(LuaVal const& key, LuaVal const& value) {
+	// A nil value is a missing key, so there's nothing to add
+	if (value.type == LUA_TYPE_NIL)
+		return { end(), false };
+	iterator it = find(key);
+	if (it != end())
+		return { it, false };
+	return { iterator(this, insert(key, value)), true };
+}
+
+size_t LuaTable::erase(LuaVal const& key) {
+	size_t index;
+	if (getArrayIndex(key, index) && index < array.size()) {
+		if (array[index].type == LUA_TYPE_NIL)
+			return 0;
+		array[index] = LuaVal();
+		arrayCount--;
+		return 1;
+	}
+
+	uint32_t entry = findEntry(key);
+	if (entry == EMPTY)
+		return 0;
+	// The entry stays where it is so its slot keeps probes going past it, until the next rehash
+	entries[entry].key = LuaVal();
+	entries[entry].value = LuaVal();
+	erasedEntries++;
+	if (erasedEntries == entries.size()) {
+		entries.clear();
+		erasedEntries = 0;
+		std::fill(slots.begin(), slots.end(), EMPTY);
+	}
+	return 1;
+}
+
+void LuaTable::clear() {
+	array.clear();
+	arrayCount = 0;
+	entries.clear();
+	erasedEntries = 0;
+	slots.clear();
+}
+
+bool LuaTable::getArrayIndex(LuaVal const& key, size_t& index) {
+	if (key.type != LUA_TYPE_NUMBER)
+		return false;
+	double number = key.as<double>();
+	// Anything past this is going in the hash table anyways
+	if (!(number >= 0 && number < (double)UINT32_MAX) || number != std::floor(number))
+		return false;
+	index = (size_t)number;
+	return true;
+}
+
+uint32_t LuaTable::findEntry(LuaVal const& key) const {
+	if (slots.empty())
+		return EMPTY;
+	size_t mask = slots.size() - 1;
+	for (size_t i = LuaValHash(key) & mask;; i = (i + 1) & mask) {
+		uint32_t entry = slots[i];
+		if (entry == EMPTY)
+			return EMPTY;
+		// Erased entries have nil keys, and operator== doesn't take nil
+		if (entries[entry].key.type != LUA_TYPE_NIL && entries[entry].key == key)
+			return entry;
+	}
+}
+
+size_t LuaTable::insert(LuaVal const& key, LuaVal const& value) {
+	size_t index;
+	if (getArrayIndex(key, index)) {
+		if (index < array.size()) {
+			array[index] = value;
+			if (value.type != LUA_TYPE_NIL)
+				arrayCount++;
+			return index;
+		}
+		// Appending keeps the array going, and a table starting at 1 like lua's do leaves a gap at 0
+		if (index == array.size() || (index == 1 && array.empty())) {
+			array.resize(index);
+			array.push_back(value);
+			if (value.type != LUA_TYPE_NIL)
+				arrayCount++;
+
+			// Any keys that follow on from this one can move out of the hash table now
+			while (entries.size() > erasedEntries) {
+				uint32_t entry = findEntry(LuaVal((double)array.size()));
+				if (entry == EMPTY) break;
+				if (entries[entry].value.type != LUA_TYPE_NIL)
+					arrayCount++;
+				array.push_back(std::move(entries[entry].value));
+				entries[entry].key = LuaVal();
+				entries[entry].value = LuaVal();
+				erasedEntries++;
+			}
+			return index;
+		}
+	}
+
+	if ((entries.size() + 1) * 2 > slots.size()) {
+		rehash(1);
+		// Rehashing can grow the array to cover our key
+		if (getArrayIndex(key, index) && index < array.size()) {
+			array[index] = value;
+			if (value.type != LUA_TYPE_NIL)
+				arrayCount++;
+			return index;
+		}
+	}
+
+	uint32_t entry = (uint32_t)entries.size();
+	entries.push_back({ key, value });
+	size_t mask = slots.size() - 1;
+	size_t i = LuaValHash(key) & mask;
+	while (slots[i] != EMPTY)
+		i = (i + 1) & mask;
+	slots[i] = entry;
+	return array.size() + entry;
+}
+
+void LuaTable::rehash(size_t extraEntries) {
+	// Count how many integer keys we have below each power of two, same as lua's computesizes.
+	// Bucket 0 is key 0, and bucket b is keys [2^(b-1), 2^b)
+	size_t buckets[33] = {};
+	size_t integerKeys = 0;
+	auto countKey = [&](size_t index) {
+		size_t bucket = 0;
+		while (bucket < 32 && ((size_t)1 << bucket) <= index)
+			bucket++;
+		buckets[bucket]++;
+		integerKeys++;
+	};
+	for (size_t i = 0; i < array.size(); i++) {
+		if (array[i].type != LUA_TYPE_NIL)
+			countKey(i);
+	}
+	for (auto& entry : entries) {
+		size_t index;
+		if (entry.key.type != LUA_TYPE_NIL && getArrayIndex(entry.key, index))
+			countKey(index);
+	}
+
+	// The array should be the largest power of two that would be more than half full
+	size_t arraySize = 0;
+	size_t keysBelow = 0;
+	for (size_t bucket = 0; bucket < 33; bucket++) {
+		size_t size = (size_t)1 << bucket;
+		keysBelow += buckets[bucket];
+		if (keysBelow > size / 2)
+			arraySize = size;
+		// Past here there aren't enough keys left for any bigger size to be half full
+		if (size / 2 >= integerKeys) break;
+	}
+
+	if (arraySize > array.size()) {
+		array.resize(arraySize);
+		for (auto& entry : entries) {
+			size_t index;
+			if (entry.key.type != LUA_TYPE_NIL && getArrayIndex(entry.key, index) && index < arraySize) {
+				if (entry.value.type != LUA_TYPE_NIL)
+					arrayCount++;
+				array[index] = std::move(entry.value);
+				entry.key = LuaVal();
+				erasedEntries++;
+			}
+		}
+	}
+
+	// Drop erased entries, keeping the rest in the order they were added
+	if (erasedEntries > 0) {
+		entries.erase(std::remove_if(entries.begin(), entries.end(), [](Entry const& entry) { return entry.key.type == LUA_TYPE_NIL; }), entries.end());
+		erasedEntries = 0;
+	}
+
+	size_t capacity = 4;
+	while (capacity < (entries.size() + extraEntries) * 2)
+		capacity *= 2;
+	slots.assign(capacity, EMPTY);
+	size_t mask = capacity - 1;
+	for (uint32_t entry = 0; entry < entries.size(); entry++) {
+		size_t i = LuaValHash(entries[entry].key) & mask;
+		while (slots[i] != EMPTY)
+			i = (i + 1) & mask;
+		slots[i] = entry;
+	}
+}
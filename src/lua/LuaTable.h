@@ -0,0 +1,147 @@
+#pragma once
+
+#include "LuaVal.h"
+
+#include <cstdint>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+namespace vecs {
+
+	// Forward Declarations
+	class ComponentList;
+
+	// The table type used by LuaVal, laid out like lua's own tables: integer keys from 0 up are stored in a plain
+	// array indexed by the key, and everything else goes in a hash table. The hash table keeps its entries in one
+	// dense array in the order they were added, with a separate open addressing index of where each key's entry is,
+	// so lookups never allocate or chase pointers and iteration just walks two arrays.
+	// Keys move into the array when it grows, like lua's rehash: the array is sized to the largest power of two
+	// that would be more than half full, so sparse integer keys (e.g. chunk blocks) stay in the hash table.
+	// Iteration visits the array in key order, then the hash table in the order keys were added.
+	// Nil values in the array are treated as missing keys
+	class LuaTable {
+	public:
+		typedef std::pair<const LuaVal, LuaVal> value_type;
+
+		// What iterators point to. For array entries the key is created by the iterator, since it isn't stored
+		struct KeyValue {
+			LuaVal const& first;
+			LuaVal& second;
+		};
+
+		template<typename Table>
+		class Iterator {
+		public:
+			Iterator() : table(nullptr), index(0) {}
+			Iterator(Table* table, size_t index) : table(table), index(index) { skipEmpty(); }
+
+			KeyValue operator*() const {
+				if (index < table->array.size()) {
+					key = LuaVal((double)index);
+					return { key, const_cast<LuaVal&>(table->array[index]) };
+				}
+				auto& entry = table->entries[index - table->array.size()];
+				return { entry.key, const_cast<LuaVal&>(entry.value) };
+			}
+
+			// Lets it->first work even though we don't have a KeyValue to point to
+			struct Arrow {
+				KeyValue keyValue;
+				KeyValue* operator->() { return &keyValue; }
+			};
+			Arrow operator->() const { return Arrow{ **this }; }
+
+			Iterator& operator++() {
+				index++;
+				skipEmpty();
+				return *this;
+			}
+			Iterator operator++(int) {
+				Iterator old = *this;
+				++*this;
+				return old;
+			}
+
+			bool operator==(Iterator const& other) const { return index == other.index; }
+			bool operator!=(Iterator const& other) const { return index != other.index; }
+
+			// Position in the array followed by the hash table's entries
+			size_t getIndex() const { return index; }
+
+		private:
+			Table* table;
+			size_t index;
+			mutable LuaVal key;
+
+			void skipEmpty() {
+				size_t arraySize = table->array.size();
+				size_t end = arraySize + table->entries.size();
+				while (index < end && (index < arraySize ? table->array[index].type : table->entries[index - arraySize].key.type) == LUA_TYPE_NIL)
+					index++;
+			}
+		};
+
+		typedef Iterator<LuaTable> iterator;
+		typedef Iterator<const LuaTable> const_iterator;
+
+		LuaTable() {}
+		LuaTable(std::initializer_list<value_type> const& values);
+
+		iterator begin() { return iterator(this, 0); }
+		iterator end() { return iterator(this, array.size() + entries.size()); }
+		const_iterator begin() const { return const_iterator(this, 0); }
+		const_iterator end() const { return const_iterator(this, array.size() + entries.size()); }
+		// Starts at the array entry at index, or the start of the hash table if index is past the array
+		iterator fromIndex(size_t index);
+		// The array part, for walking integer keys in order. Nil values are missing keys
+		std::vector<LuaVal> const& getArray() const { return array; }
+
+		iterator find(LuaVal const& key);
+		const_iterator find(LuaVal const& key) const;
+		size_t count(LuaVal const& key) const;
+		// Inserts nil if the key isn't in the table, same as std::map
+		LuaVal& operator[](LuaVal const& key);
+		// Returns whether the value was inserted, which it isn't if the key is already in the table or the value is nil
+		std::pair<iterator, bool> emplace(LuaVal const& key, LuaVal const& value);
+		size_t erase(LuaVal const& key);
+		void clear();
+
+		size_t size() const { return arrayCount + entries.size() - erasedEntries; }
+		bool empty() const { return size() == 0; }
+
+		// The component list and entity we were last stored as a component of, so writes through us can mark the
+		// entity's row as changed. Set by the list and guarded by our table lock. It may be out of date if we've
+		// since been replaced or removed, so the list checks we're still in the entity's row before marking it
+		ComponentList* owner = nullptr;
+		uint32_t ownerEntity = 0;
+
+	private:
+		static constexpr uint32_t EMPTY = UINT32_MAX;
+
+		struct Entry {
+			LuaVal key;
+			LuaVal value;
+		};
+
+		std::vector<LuaVal> array;
+		// Number of non-nil values in array
+		size_t arrayCount = 0;
+
+		// Erased entries have their key set to nil, and are removed once they're half the entries
+		std::vector<Entry> entries;
+		size_t erasedEntries = 0;
+		// Open addressing with linear probing into entries. Its size is a power of two at least twice the number of entries
+		std::vector<uint32_t> slots;
+
+		// Returns true if the key belongs in the array part, setting index to where
+		static bool getArrayIndex(LuaVal const& key, size_t& index);
+
+		// Returns the index of the key's entry, or EMPTY if it isn't in the hash table
+		uint32_t findEntry(LuaVal const& key) const;
+		// Adds a key that isn't in the table yet, returning its position as an iterator index. Only non-nil values are counted
+		size_t insert(LuaVal const& key, LuaVal const& value);
+		// Grows the array to fit the integer keys we have, and rebuilds the slots with room for extraEntries more
+		void rehash(size_t extraEntries);
+	};
+}
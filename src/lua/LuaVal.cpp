@@ -1,21 +1,90 @@
 #include "LuaVal.h"
 
+#include "../ecs/ComponentList.h"
 #include "../engine/Debugger.h"
+#include "FunctionCache.h"
+#include "LuaValStream.h"
+#include "../util/StripedMutex.h"
+
+#include <algorithm>
+#include <cmath>
 
 using namespace vecs;
 
+namespace {
+	// Guards the contents of every table, so workers can read and write them at the same time
+	StripedMutex tableLocks;
+
+	// Copies a table's pairs out under its lock, for walking it while calling things that may lock other tables
+	std::vector<std::pair<LuaVal, LuaVal>> copyPairs(LuaVal::MapType* map) {
+		std::shared_lock<std::shared_mutex> lock(tableLocks.get(map));
+		std::vector<std::pair<LuaVal, LuaVal>> pairs;
+		pairs.reserve(map->size());
+		for (auto kvp : *map)
+			pairs.emplace_back(kvp.first, kvp.second);
+		return pairs;
+	}
+
+	// Writes to a component's table count as writes to its row. Called after the table is unlocked, with the
+	// owner read while it was locked, so the row is stamped after the write lands
+	void markOwnerChanged(LuaVal::MapType const* map, ComponentList* owner, uint32_t entity) {
+		if (owner != nullptr)
+			owner->markChanged(entity, map);
+	}
+}
+
 void vecs::LuaValBindings::setupState(sol::state& lua) {
 	lua.new_usertype<LuaVal>("luaVal", sol::factories(&LuaVal::asLuaVal),
 		"asTable", &LuaVal::asTable,
 		"asLua", &LuaVal::asLua,
 		"iterate", &LuaVal::iterate,
 		"iterate_range", &LuaVal::iterate_range,
+		"push", &LuaVal::push_lua,
+		// Arrays of numbers, optionally starting with size zeroes
+		"floatArray", [](sol::optional<double> size) { return LuaVal::newArray(LUA_TYPE_FLOAT_ARRAY, (size_t)size.value_or(0)); },
+		"intArray", [](sol::optional<double> size) { return LuaVal::newArray(LUA_TYPE_INT_ARRAY, (size_t)size.value_or(0)); },
+		"byteArray", [](sol::optional<double> size) { return LuaVal::newArray(LUA_TYPE_BYTE_ARRAY, (size_t)size.value_or(0)); },
+		// Values as binary strings, for storing or sending them somewhere
+		"encode", [](LuaVal const& value) { return LuaValWriter::encode(value); },
+		"decode", [](std::string_view data) {
+			try {
+				return LuaValReader::decode(data);
+			} catch (std::exception const& e) {
+				Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] Unable to decode value: " + std::string(e.what()));
+				return LuaVal();
+			}
+		},
 		sol::meta_function::index, &LuaVal::get_lua,
 		sol::meta_function::new_index, &LuaVal::set_lua,
 		sol::meta_function::length, &LuaVal::getLength
 	);
 }
 
+LuaVal::LuaVal(std::initializer_list<std::pair<const LuaVal, LuaVal>> const& l) : type(LUA_TYPE_TABLE) {
+	store(new MapType(l));
+}
+
+LuaVal::LuaVal(sol::function f) : type(LUA_TYPE_FUNCTION) {
+	// Functions that came out of a worker's cache already have their bytecode interned, so they go back without a dump
+	FunctionCache* functions = FunctionCache::fromState(f.lua_state());
+	LuaString* source = functions != nullptr ? functions->getSource(f) : nullptr;
+	store(source != nullptr ? source : LuaString::intern(f.dump().as_string_view()));
+}
+
+LuaVal LuaVal::fromBytecode(std::string_view bytecode) {
+	LuaVal function;
+	function.type = LUA_TYPE_FUNCTION;
+	function.store(LuaString::intern(bytecode));
+	return function;
+}
+
+LuaVal LuaVal::newArray(LuaType type, size_t size) {
+	LuaArray* array = LuaArray::create(type, size);
+	LuaVal value(array);
+	array->release();
+	return value;
+}
+
 LuaVal LuaVal::asLuaVal(sol::object const& v) {
 	switch (v.get_type()) {
 	case sol::type::boolean:
@@ -28,7 +97,7 @@ LuaVal LuaVal::asLuaVal(sol::object const& v) {
 	case sol::type::number:
 		return LuaVal(v.as<double>());
 	case sol::type::string:
-		return LuaVal(v.as<std::string>());
+		return LuaVal(v.as<std::string_view>());
 	case sol::type::table:
 		return fromTable(v);
 	case sol::type::userdata:
@@ -41,15 +110,49 @@ LuaVal LuaVal::asLuaVal(sol::object const& v) {
 }
 
 LuaVal LuaVal::fromTable(sol::table const& tb) {
-	LuaVal v({});
-	for (auto it : tb)
-		v.set_lua(it.first, it.second);
-	return v;
+	// Nothing else can see the new table until we return it, so it's filled in directly
+	// instead of taking its lock and checking for an owner for every key
+	MapType* map = new MapType();
+	for (auto it : tb) {
+		LuaVal key = asLuaVal(it.first);
+		LuaVal value = asLuaVal(it.second);
+		if (key.type != LUA_TYPE_NIL && value.type != LUA_TYPE_NIL)
+			(*map)[std::move(key)] = std::move(value);
+	}
+	return LuaVal(map);
+}
+
+LuaVal LuaVal::clone() const {
+	if (type == LUA_TYPE_MAT4)
+		return LuaVal(as<glm::mat4*>());
+	if (isArray()) {
+		LuaArray* array = as<LuaArray*>();
+		std::shared_lock<std::shared_mutex> lock(array->getMutex());
+		LuaVal copy = newArray(type, array->size());
+		std::memcpy(copy.as<LuaArray*>()->data(), array->data(), array->size() * array->getElementSize());
+		return copy;
+	}
+	if (type != LUA_TYPE_TABLE)
+		return *this;
+	MapType* copy = new MapType();
+	for (auto& kvp : copyPairs(as<MapType*>()))
+		copy->emplace(kvp.first, kvp.second.clone());
+	return LuaVal(copy);
+}
+
+std::shared_mutex& LuaVal::getTableLock() const {
+	assert(type == LUA_TYPE_TABLE);
+	return tableLocks.get(as<MapType*>());
+}
+
+std::shared_mutex& LuaVal::getTableLock(MapType const* table) {
+	return tableLocks.get(table);
 }
 
 LuaVal LuaVal::get(std::string const& key) const {
 	assert(type == LUA_TYPE_TABLE);
-	auto& map = *std::get<MapType*>(value);
+	auto& map = *as<MapType*>();
+	std::shared_lock<std::shared_mutex> lock(getTableLock());
 	auto it = map.find(key);
 	if (it == map.end())
 		return LuaVal();
@@ -57,56 +160,152 @@ LuaVal LuaVal::get(std::string const& key) const {
 }
 
 sol::object LuaVal::get_lua(sol::object const& key, sol::this_state const& s) const {
-	assert(type == LUA_TYPE_TABLE);
 	sol::state_view lua(s);
-	auto& map = *std::get<MapType*>(value);
+	if (isArray()) {
+		// Arrays are indexed from 1 in lua, like tables
+		LuaArray* array = as<LuaArray*>();
+		double index = key.get_type() == sol::type::number ? key.as<double>() - 1 : -1;
+		std::shared_lock<std::shared_mutex> lock(array->getMutex());
+		if (!(index >= 0 && index < array->size()))
+			return sol::make_object(lua, sol::lua_nil);
+		return sol::make_object(lua, array->get((size_t)index));
+	}
+	assert(type == LUA_TYPE_TABLE);
+	auto& map = *as<MapType*>();
 	auto klv = asLuaVal(key);
-	auto it = map.find(klv);
-	if (it == map.end())
-		return sol::make_object(lua, sol::lua_nil);
-	auto& val = it->second;
+	// Copied out so the lock isn't held while lua loads functions or creates tables
+	LuaVal val;
+	{
+		std::shared_lock<std::shared_mutex> lock(getTableLock());
+		auto it = map.find(klv);
+		if (it == map.end())
+			return sol::make_object(lua, sol::lua_nil);
+		val = it->second;
+	}
 	return val.asObject(s);
 }
 
 void LuaVal::set(LuaVal const& key, LuaVal const& val) const {
 	assert(type == LUA_TYPE_TABLE);
 	assert(key.type != LUA_TYPE_NIL);
-	if (val.type == LUA_TYPE_NIL)
-		std::get<MapType*>(value)->erase(key);
-	else
-		(*std::get<MapType*>(value))[std::move(key)] = std::move(val);
+	MapType* map = as<MapType*>();
+	ComponentList* owner;
+	uint32_t entity;
+	{
+		std::unique_lock<std::shared_mutex> lock(getTableLock());
+		if (val.type == LUA_TYPE_NIL)
+			map->erase(key);
+		else
+			(*map)[std::move(key)] = std::move(val);
+		owner = map->owner;
+		entity = map->ownerEntity;
+	}
+	markOwnerChanged(map, owner, entity);
 }
 
 void LuaVal::set_nil(LuaVal const& key) const {
 	assert(type == LUA_TYPE_TABLE);
-	std::get<MapType*>(value)->erase(key);
+	MapType* map = as<MapType*>();
+	ComponentList* owner;
+	uint32_t entity;
+	{
+		std::unique_lock<std::shared_mutex> lock(getTableLock());
+		map->erase(key);
+		owner = map->owner;
+		entity = map->ownerEntity;
+	}
+	markOwnerChanged(map, owner, entity);
 }
 
 void LuaVal::set_lua(sol::object const& key, sol::object const& val) const {
+	if (isArray()) {
+		LuaArray* array = as<LuaArray*>();
+		double index = key.get_type() == sol::type::number ? key.as<double>() - 1 : -1;
+		if (val.get_type() != sol::type::number || index != std::floor(index)) {
+			Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] Arrays can only hold numbers at integer indices");
+			return;
+		}
+		std::unique_lock<std::shared_mutex> lock(array->getMutex());
+		// Setting the index one past the end appends, same as with tables
+		if (index >= 0 && index < array->size())
+			array->set((size_t)index, val.as<double>());
+		else if (index == array->size())
+			array->push(val.as<double>());
+		else
+			Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] Array index " + std::to_string((int64_t)index + 1) + " is out of range");
+		return;
+	}
 	assert(type == LUA_TYPE_TABLE);
+	// Converted before locking, since converting a lua table fills in a new table of its own
 	auto kk = asLuaVal(key);
 	auto vv = asLuaVal(val);
 	assert(kk.type != LUA_TYPE_NIL);
-	if (vv.type == LUA_TYPE_NIL)
-		std::get<MapType*>(value)->erase(kk);
-	else
-		(*std::get<MapType*>(value))[std::move(kk)] = std::move(vv);
+	MapType* map = as<MapType*>();
+	ComponentList* owner;
+	uint32_t entity;
+	{
+		std::unique_lock<std::shared_mutex> lock(getTableLock());
+		if (vv.type == LUA_TYPE_NIL)
+			map->erase(kk);
+		else
+			(*map)[std::move(kk)] = std::move(vv);
+		owner = map->owner;
+		entity = map->ownerEntity;
+	}
+	markOwnerChanged(map, owner, entity);
 }
 
 bool LuaVal::contains(LuaVal const& key) const {
 	assert(type == LUA_TYPE_TABLE);
-	auto table = std::get<MapType*>(value);
+	auto table = as<MapType*>();
+	std::shared_lock<std::shared_mutex> lock(getTableLock());
 	return table->find(key) != table->end();
 }
 
 int LuaVal::getLength() const {
+	if (isArray()) {
+		std::shared_lock<std::shared_mutex> lock(as<LuaArray*>()->getMutex());
+		return (int)as<LuaArray*>()->size();
+	}
 	assert(type == LUA_TYPE_TABLE);
-	return std::get<MapType*>(value)->size();
+	std::shared_lock<std::shared_mutex> lock(getTableLock());
+	return as<MapType*>()->size();
+}
+
+void LuaVal::push(double value) const {
+	assert(isArray());
+	std::unique_lock<std::shared_mutex> lock(as<LuaArray*>()->getMutex());
+	as<LuaArray*>()->push(value);
+}
+
+void LuaVal::push_lua(sol::variadic_args values) const {
+	if (!isArray()) {
+		Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] Only arrays can be pushed to");
+		return;
+	}
+	// Everything's pushed under one lock, so a vertex's numbers all go in together
+	LuaArray* array = as<LuaArray*>();
+	std::unique_lock<std::shared_mutex> lock(array->getMutex());
+	for (auto value : values) {
+		if (value.get_type() == sol::type::number)
+			array->push(value.as<double>());
+		else
+			Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] Arrays can only hold numbers");
+	}
 }
 
 void LuaVal::clear() const {
 	assert(type == LUA_TYPE_TABLE);
-	std::get<MapType*>(value)->clear();
+	MapType* map = as<MapType*>();
+	ComponentList* owner;
+	uint32_t entity;
+	{
+		std::unique_lock<std::shared_mutex> lock(getTableLock());
+		map->clear();
+		owner = map->owner;
+		entity = map->ownerEntity;
+	}
+	markOwnerChanged(map, owner, entity);
 }
 
 bool LuaVal::operator<(LuaVal const&b) const {
@@ -121,70 +320,73 @@ bool LuaVal::operator<(LuaVal const&b) const {
 	// we can't just do value < b.value because some types can't be directly compared
 	switch (type) {
 	case LUA_TYPE_STRING:
-		return std::get<std::string>(value) < std::get<std::string>(b.value);
+		return as<std::string>() < b.as<std::string>();
 	case LUA_TYPE_BOOL:
-		return std::get<bool>(value) < std::get<bool>(b.value);
+		return as<bool>() < b.as<bool>();
 	case LUA_TYPE_NUMBER:
-		return std::get<double>(value) < std::get<double>(b.value);
+		return as<double>() < b.as<double>();
 	case LUA_TYPE_FUNCTION:
-		return std::get<sol::bytecode>(value).as_string_view() < std::get<sol::bytecode>(b.value).as_string_view();
+		return getBytecode() < b.getBytecode();
 	case LUA_TYPE_VEC2:
-		return glm::all(glm::lessThan(std::get<glm::vec2>(value), std::get<glm::vec2>(b.value)));
+		return glm::all(glm::lessThan(as<glm::vec2>(), b.as<glm::vec2>()));
 	case LUA_TYPE_VEC3:
-		return glm::all(glm::lessThan(std::get<glm::vec3>(value), std::get<glm::vec3>(b.value)));
+		return glm::all(glm::lessThan(as<glm::vec3>(), b.as<glm::vec3>()));
 	case LUA_TYPE_VEC4:
-		return glm::all(glm::lessThan(std::get<glm::vec4>(value), std::get<glm::vec4>(b.value)));
+		return glm::all(glm::lessThan(as<glm::vec4>(), b.as<glm::vec4>()));
 	default:
 		return false;
 	}
 }
 
-// TODO use hashes to make this faster
 bool LuaVal::operator==(LuaVal const& b) const {
-	// check type ourselves since it'll probably be faster than std::variant handling it
+	// values of different types are never equal
 	if (type != b.type) return false;
 	// handle this based on type
 	// we can't just do value == b.value because some types can't be directly compared
 	assert(type != LUA_TYPE_NIL);
 	switch (type) {
-	case LUA_TYPE_STRING: return std::get<std::string>(value) == std::get<std::string>(b.value);
+	// strings are interned, so equal strings are the same LuaString
+	case LUA_TYPE_STRING: return getInterned() == b.getInterned();
 	case LUA_TYPE_TABLE: {
-		LuaVal::MapType aMap = *std::get<LuaVal::MapType*>(value);
-		LuaVal::MapType bMap = *std::get<LuaVal::MapType*>(b.value);
+		LuaVal::MapType const& aMap = *as<LuaVal::MapType*>();
+		LuaVal::MapType const& bMap = *b.as<LuaVal::MapType*>();
+		if (&aMap == &bMap) return true;
 		if (aMap.size() != bMap.size()) return false;
 		for (auto kvp : aMap) {
-			if (bMap.count(kvp.first) == 0) return false;
-			if (kvp.second != bMap[kvp.first]) return false;
+			auto it = bMap.find(kvp.first);
+			if (it == bMap.end()) return false;
+			if (kvp.second != it->second) return false;
 		}
 		return true;
 	}
-	case LUA_TYPE_BOOL: return std::get<bool>(value) == std::get<bool>(b.value);
-	case LUA_TYPE_NUMBER: return std::get<double>(value) == std::get<double>(b.value);
-	case LUA_TYPE_FUNCTION:
-		return std::get<sol::bytecode>(value).as_string_view() == std::get<sol::bytecode>(b.value).as_string_view();
-	case LUA_TYPE_ARCHETYPE: return std::get<Archetype*>(value) == std::get<Archetype*>(b.value);
-	case LUA_TYPE_QUERY: return std::get<EntityQuery*>(value) == std::get<EntityQuery*>(b.value);
-	case LUA_TYPE_WORLD_LOAD_STATUS: return std::get<WorldLoadStatus*>(value) == std::get<WorldLoadStatus*>(b.value);
-	case LUA_TYPE_RENDERER: return std::get<SubRenderer*>(value) == std::get<SubRenderer*>(b.value);
-	case LUA_TYPE_JOB: return std::get<Job*>(value) == std::get<Job*>(b.value);
+	case LUA_TYPE_BOOL: return as<bool>() == b.as<bool>();
+	case LUA_TYPE_NUMBER: return as<double>() == b.as<double>();
+	case LUA_TYPE_FUNCTION: return getInterned() == b.getInterned();
+	case LUA_TYPE_ARCHETYPE: return as<Archetype*>() == b.as<Archetype*>();
+	case LUA_TYPE_QUERY: return as<EntityQuery*>() == b.as<EntityQuery*>();
+	case LUA_TYPE_WORLD_LOAD_STATUS: return as<WorldLoadStatus*>() == b.as<WorldLoadStatus*>();
+	case LUA_TYPE_RENDERER: return as<SubRenderer*>() == b.as<SubRenderer*>();
+	case LUA_TYPE_JOB: return as<Job*>() == b.as<Job*>();
 	case LUA_TYPE_VEC2:
-		return glm::all(glm::equal(std::get<glm::vec2>(value), std::get<glm::vec2>(b.value)));
+		return glm::all(glm::equal(as<glm::vec2>(), b.as<glm::vec2>()));
 	case LUA_TYPE_VEC3:
-		return glm::all(glm::equal(std::get<glm::vec3>(value), std::get<glm::vec3>(b.value)));
+		return glm::all(glm::equal(as<glm::vec3>(), b.as<glm::vec3>()));
 	case LUA_TYPE_VEC4:
-		return glm::all(glm::equal(std::get<glm::vec4>(value), std::get<glm::vec4>(b.value)));
-	case LUA_TYPE_MAT4:
-		// there is no glm::lessThan for matrix types, so they're just always false
-		// TODO find a way to compare them
-		return false;
-	case LUA_TYPE_FRUSTUM: return std::get<Frustum*>(value) == std::get<Frustum*>(b.value);
-	case LUA_TYPE_NOISE: return std::get<HastyNoise::NoiseSIMD*>(value) == std::get<HastyNoise::NoiseSIMD*>(b.value);
-	case LUA_TYPE_MODEL: return std::get<Model*>(value) == std::get<Model*>(b.value);
-	case LUA_TYPE_TEXTURE: return std::get<Texture*>(value) == std::get<Texture*>(b.value);
-	case LUA_TYPE_BUFFER: return std::get<Buffer*>(value) == std::get<Buffer*>(b.value);
-	case LUA_TYPE_TEXT_FILTER: return std::get<ImGuiTextFilter*>(value) == std::get<ImGuiTextFilter*>(b.value);
-	case LUA_TYPE_FONT: return std::get<ImFont*>(value) == std::get<ImFont*>(b.value);
-	case LUA_TYPE_PIXELS: return std::get<unsigned char*>(value) == std::get<unsigned char*>(b.value);
+		return glm::all(glm::equal(as<glm::vec4>(), b.as<glm::vec4>()));
+	case LUA_TYPE_MAT4: return *as<glm::mat4*>() == *b.as<glm::mat4*>();
+	case LUA_TYPE_FRUSTUM: return as<Frustum*>() == b.as<Frustum*>();
+	case LUA_TYPE_NOISE: return as<HastyNoise::NoiseSIMD*>() == b.as<HastyNoise::NoiseSIMD*>();
+	case LUA_TYPE_MODEL: return as<Model*>() == b.as<Model*>();
+	case LUA_TYPE_TEXTURE: return as<Texture*>() == b.as<Texture*>();
+	case LUA_TYPE_BUFFER: return as<Buffer*>() == b.as<Buffer*>();
+	case LUA_TYPE_TEXT_FILTER: return as<ImGuiTextFilter*>() == b.as<ImGuiTextFilter*>();
+	case LUA_TYPE_FONT: return as<ImFont*>() == b.as<ImFont*>();
+	case LUA_TYPE_PIXELS: return as<unsigned char*>() == b.as<unsigned char*>();
+	// Arrays are compared by identity, since comparing their contents could take a while
+	case LUA_TYPE_FLOAT_ARRAY:
+	case LUA_TYPE_INT_ARRAY:
+	case LUA_TYPE_BYTE_ARRAY:
+		return as<LuaArray*>() == b.as<LuaArray*>();
 	default: return false;
 	}
 }
@@ -198,100 +400,187 @@ std::string LuaVal::toString() const {
 	case LUA_TYPE_NIL:
 		return "nil";
 	case LUA_TYPE_STRING:
-		return std::get<std::string>(value);
+		return as<std::string>();
 	case LUA_TYPE_BOOL:
-		return std::get<bool>(value) ? "true" : "false";
+		return as<bool>() ? "true" : "false";
 	case LUA_TYPE_NUMBER:
-		return std::to_string(std::get<double>(value));
+		return std::to_string(as<double>());
 	// TODO cases for userdata
 	default:
 		return "Userdata";
 	}
 }
 
-std::tuple<sol::object, LuaVal::MapType::iterator> LuaVal::iterate(sol::this_state const& s) const {
+std::tuple<sol::object, sol::object> LuaVal::iterate(sol::this_state const& s) const {
 	assert(type == LUA_TYPE_TABLE);
-	auto func = [s, end = std::get<MapType*>(value)->end()](MapType::iterator& it)->std::tuple<sol::object, sol::object> {
-		if (it == end) {
+	MapType* map = as<MapType*>();
+	auto func = [s, map](MapType::iterator& it)->std::tuple<sol::object, sol::object> {
+		// Each step locks on its own, so other workers can write in between. Rehashing may have moved entries
+		// since the last step, so we find our place again from the index rather than trusting the iterator
+		LuaVal key, value;
+		{
+			std::shared_lock<std::shared_mutex> lock(tableLocks.get(map));
+			MapType::iterator current(map, std::min(it.getIndex(), map->end().getIndex()));
+			if (current != map->end()) {
+				key = current->first;
+				value = current->second;
+				it = MapType::iterator(map, current.getIndex() + 1);
+			}
+		}
+		if (key.type == LUA_TYPE_NIL) {
 			sol::state_view lua(s);
 			return { sol::make_object(lua, sol::lua_nil), sol::make_object(lua, sol::lua_nil) };
 		}
-		auto oldit = it++;
-		return std::make_tuple(oldit->first.asObject(s), oldit->second.asObject(s));
+		return std::make_tuple(key.asObject(s), value.asObject(s));
+	};
+	sol::state_view lua(s);
+	std::shared_lock<std::shared_mutex> lock(getTableLock());
+	return std::make_tuple(sol::make_object(lua, func), sol::make_object(lua, map->begin()));
+}
+
+namespace {
+	// Integer keys in the array are walked by index, and the keys in range from the hash table are sorted up front,
+	// so merging the two gives every key in order
+	struct RangeState {
+		size_t index;
+		size_t arrayEnd;
+		std::vector<LuaVal> hashKeys;
+		size_t hashIndex;
 	};
-	return std::make_tuple(sol::make_object(sol::state_view(s), func), std::get<MapType*>(value)->begin());
+
+	// Where the array's keys reach the bound, for keys of any type
+	size_t getArrayBound(LuaVal const& bound, size_t arraySize) {
+		if (bound.type != LUA_TYPE_NUMBER)
+			return bound.type < LUA_TYPE_NUMBER ? 0 : arraySize;
+		double number = std::ceil(bound.as<double>());
+		return number <= 0 ? 0 : (size_t)std::min(number, (double)arraySize);
+	}
 }
 
-std::tuple<sol::object, LuaVal::MapType::iterator> LuaVal::iterate_range(LuaVal start, LuaVal end, sol::this_state const& s) const {
+std::tuple<sol::object, sol::object> LuaVal::iterate_range(LuaVal start, LuaVal end, sol::this_state const& s) const {
 	assert(type == LUA_TYPE_TABLE);
-	LuaVal::MapType* map = std::get<MapType*>(value);
+	MapType* map = as<MapType*>();
+	std::shared_lock<std::shared_mutex> lock(getTableLock());
+	size_t arraySize = map->getArray().size();
+
+	RangeState state;
+	state.index = getArrayBound(start, arraySize);
+	state.arrayEnd = std::max(state.index, getArrayBound(end, arraySize));
+	for (auto it = map->fromIndex(arraySize); it != map->end(); it++) {
+		if (!(it->first < start) && it->first < end)
+			state.hashKeys.push_back(it->first);
+	}
+	std::sort(state.hashKeys.begin(), state.hashKeys.end());
+	state.hashIndex = 0;
+	lock.unlock();
 
-	LuaVal::MapType::iterator beginIter = map->begin();
-	while (beginIter != map->end() && beginIter->first < start)
-		beginIter++;
+	auto func = [s, map](RangeState& state)->std::tuple<sol::object, sol::object> {
+		// Same as iterate, each step locks on its own and copies what it returns out
+		std::shared_lock<std::shared_mutex> lock(tableLocks.get(map));
+		auto& array = map->getArray();
+		size_t arrayEnd = std::min(state.arrayEnd, array.size());
+		while (state.index < arrayEnd && array[state.index].type == LUA_TYPE_NIL)
+			state.index++;
 
-	auto func = [s, end, mEnd = map->end()](MapType::iterator& it)->std::tuple<sol::object, sol::object> {
-		if (it != mEnd && it->first < end) {
-			auto oldit = it++;
-			return std::make_tuple(oldit->first.asObject(s), oldit->second.asObject(s));
+		bool hashLeft = state.hashIndex < state.hashKeys.size();
+		if (state.index < arrayEnd && (!hashLeft || LuaVal((double)state.index) < state.hashKeys[state.hashIndex])) {
+			size_t index = state.index++;
+			LuaVal value = array[index];
+			lock.unlock();
+			return std::make_tuple(sol::make_object(sol::state_view(s), (double)index), value.asObject(s));
+		}
+		if (hashLeft) {
+			LuaVal& key = state.hashKeys[state.hashIndex++];
+			auto it = map->find(key);
+			LuaVal value = it == map->end() ? LuaVal() : it->second;
+			lock.unlock();
+			return std::make_tuple(key.asObject(s), value.asObject(s));
 		}
+		lock.unlock();
 		sol::state_view lua(s);
-		return { sol::make_object(lua, sol::lua_nil), sol::make_object(lua, sol::lua_nil) };		
+		return { sol::make_object(lua, sol::lua_nil), sol::make_object(lua, sol::lua_nil) };
 	};
-	return std::make_tuple(sol::make_object(sol::state_view(s), func), beginIter);
+	sol::state_view lua(s);
+	return std::make_tuple(sol::make_object(lua, func), sol::make_object(lua, std::move(state)));
 }
 
 sol::object LuaVal::asObject(sol::this_state const& s) const {
 	sol::state_view lua(s);
 	switch (type) {
 	case LUA_TYPE_NIL: return sol::make_object(lua, sol::lua_nil);
-	case LUA_TYPE_STRING: return sol::make_object(lua, std::get<std::string>(value));
+	case LUA_TYPE_STRING: return sol::make_object(lua, as<std::string>());
 	case LUA_TYPE_TABLE: return sol::make_object(lua, *this);
-	case LUA_TYPE_BOOL: return sol::make_object(lua, std::get<bool>(value));
-	case LUA_TYPE_NUMBER: return sol::make_object(lua, std::get<double>(value));
-	case LUA_TYPE_FUNCTION: return lua.load(std::get<sol::bytecode>(value).as_string_view());
-	case LUA_TYPE_ARCHETYPE: return sol::make_object(lua, std::get<Archetype*>(value));
-	case LUA_TYPE_QUERY: return sol::make_object(lua, std::get<EntityQuery*>(value));
-	case LUA_TYPE_WORLD_LOAD_STATUS: return sol::make_object(lua, std::get<WorldLoadStatus*>(value));
-	case LUA_TYPE_RENDERER: return sol::make_object(lua, std::get<SubRenderer*>(value));
-	case LUA_TYPE_JOB: return sol::make_object(lua, std::get<Job*>(value));
-	case LUA_TYPE_VEC2: return sol::make_object(lua, std::get<glm::vec2>(value));
-	case LUA_TYPE_VEC3: return sol::make_object(lua, std::get<glm::vec3>(value));
-	case LUA_TYPE_VEC4: return sol::make_object(lua, std::get<glm::vec4>(value));
-	case LUA_TYPE_MAT4: return sol::make_object(lua, std::get<glm::mat4*>(value));
-	case LUA_TYPE_FRUSTUM: return sol::make_object(lua, std::get<Frustum*>(value));
-	case LUA_TYPE_NOISE: return sol::make_object(lua, std::get<HastyNoise::NoiseSIMD*>(value));
-	case LUA_TYPE_MODEL: return sol::make_object(lua, std::get<Model*>(value));
-	case LUA_TYPE_TEXTURE: return sol::make_object(lua, std::get<Texture*>(value));
-	case LUA_TYPE_BUFFER: return sol::make_object(lua, std::get<Buffer*>(value));
-	case LUA_TYPE_TEXT_FILTER: return sol::make_object(lua, std::get<ImGuiTextFilter*>(value));
-	case LUA_TYPE_FONT: return sol::make_object(lua, std::get<ImFont*>(value));
-	case LUA_TYPE_PIXELS: return sol::make_object(lua, std::get<unsigned char*>(value));
+	case LUA_TYPE_BOOL: return sol::make_object(lua, as<bool>());
+	case LUA_TYPE_NUMBER: return sol::make_object(lua, as<double>());
+	case LUA_TYPE_FUNCTION: {
+		// Worker states have a cache, so reading the same function out of a component doesn't load it every time
+		FunctionCache* functions = FunctionCache::fromState(s);
+		if (functions != nullptr) {
+			std::string error;
+			sol::protected_function function = functions->load(getInterned(), error);
+			if (function.valid())
+				return sol::make_object(lua, function);
+		}
+		return lua.load(getBytecode());
+	}
+	case LUA_TYPE_ARCHETYPE: return sol::make_object(lua, as<Archetype*>());
+	case LUA_TYPE_QUERY: return sol::make_object(lua, as<EntityQuery*>());
+	case LUA_TYPE_WORLD_LOAD_STATUS: return sol::make_object(lua, as<WorldLoadStatus*>());
+	case LUA_TYPE_RENDERER: return sol::make_object(lua, as<SubRenderer*>());
+	case LUA_TYPE_JOB: return sol::make_object(lua, as<Job*>());
+	case LUA_TYPE_VEC2: return sol::make_object(lua, as<glm::vec2>());
+	case LUA_TYPE_VEC3: return sol::make_object(lua, as<glm::vec3>());
+	case LUA_TYPE_VEC4: return sol::make_object(lua, as<glm::vec4>());
+	case LUA_TYPE_MAT4: return sol::make_object(lua, as<glm::mat4*>());
+	case LUA_TYPE_FRUSTUM: return sol::make_object(lua, as<Frustum*>());
+	case LUA_TYPE_NOISE: return sol::make_object(lua, as<HastyNoise::NoiseSIMD*>());
+	case LUA_TYPE_MODEL: return sol::make_object(lua, as<Model*>());
+	case LUA_TYPE_TEXTURE: return sol::make_object(lua, as<Texture*>());
+	case LUA_TYPE_BUFFER: return sol::make_object(lua, as<Buffer*>());
+	case LUA_TYPE_TEXT_FILTER: return sol::make_object(lua, as<ImGuiTextFilter*>());
+	case LUA_TYPE_FONT: return sol::make_object(lua, as<ImFont*>());
+	case LUA_TYPE_PIXELS: return sol::make_object(lua, as<unsigned char*>());
+	// Arrays are indexed through us, like tables
+	case LUA_TYPE_FLOAT_ARRAY:
+	case LUA_TYPE_INT_ARRAY:
+	case LUA_TYPE_BYTE_ARRAY:
+		return sol::make_object(lua, *this);
 	}
 	return sol::make_object(lua, sol::lua_nil);
 }
 
+namespace {
+	sol::object arrayAsTable(LuaArray* array, sol::this_state const& s) {
+		sol::state_view lua(s);
+		std::shared_lock<std::shared_mutex> lock(array->getMutex());
+		auto tbl = lua.create_table((int)array->size(), 0);
+		for (size_t i = 0; i < array->size(); i++)
+			tbl.raw_set(i + 1, array->get(i));
+		return tbl;
+	}
+}
+
 sol::object LuaVal::asTable(sol::this_state const& s) const {
+	if (isArray())
+		return arrayAsTable(as<LuaArray*>(), s);
 	if (type == LUA_TYPE_TABLE) {
 		sol::state_view lua(s);
 		auto tbl = lua.create_table();
-		for (auto& it : *std::get<MapType*>(value)) {
-			it.first;
+		for (auto& it : copyPairs(as<MapType*>()))
 			tbl.raw_set(it.first.asObject(s), it.second.asObject(s));
-		}
 		return tbl;
 	}
 	return asObject(s);
 }
 
 sol::object LuaVal::asLua(sol::this_state const& s) const {
+	if (isArray())
+		return arrayAsTable(as<LuaArray*>(), s);
 	if (type == LUA_TYPE_TABLE) {
 		sol::state_view lua(s);
 		auto tbl = lua.create_table();
-		for (auto& it : *std::get<MapType*>(value)) {
-			it.first;
+		for (auto& it : copyPairs(as<MapType*>()))
 			tbl.raw_set(it.first.asLua(s), it.second.asLua(s));
-		}
 		return tbl;
 	}
 	return asObject(s);
@@ -324,7 +613,70 @@ LuaVal LuaVal::parseUserdata(sol::object const& v) {
 	return LuaVal();
 }
 
-inline size_t vecs::LuaValHash(LuaVal const& k) {
-	// TODO handle non-pointer values
-	return std::hash<void*>{}(std::get<void*>(k.value));
+// Mixes a value's hash into seed, same as boost::hash_combine
+static void hashCombine(size_t& seed, size_t hash) {
+	seed ^= hash + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+static size_t hashFloats(float const* values, int count) {
+	size_t seed = 0;
+	for (int i = 0; i < count; i++)
+		// Add 0 so -0.0 and 0.0, which compare equal, hash the same
+		hashCombine(seed, std::hash<float>{}(values[i] + 0.0f));
+	return seed;
+}
+
+// Hashes are structural, so values that are equal according to operator== have the same hash
+size_t vecs::LuaValHash(LuaVal const& k) {
+	size_t seed = std::hash<int>{}(k.type);
+	switch (k.type) {
+	case LUA_TYPE_NIL:
+		break;
+	case LUA_TYPE_STRING:
+		hashCombine(seed, k.getInterned()->getHash());
+		break;
+	case LUA_TYPE_TABLE: {
+		// Equal tables can have their keys in different orders, so each pair's hash is summed
+		size_t tableHash = 0;
+		for (auto kvp : *k.as<LuaVal::MapType*>()) {
+			size_t pairHash = LuaValHash(kvp.first);
+			hashCombine(pairHash, LuaValHash(kvp.second));
+			tableHash += pairHash;
+		}
+		hashCombine(seed, tableHash);
+		break;
+	}
+	case LUA_TYPE_BOOL:
+		hashCombine(seed, std::hash<bool>{}(k.as<bool>()));
+		break;
+	case LUA_TYPE_NUMBER:
+		hashCombine(seed, std::hash<double>{}(k.as<double>() + 0.0));
+		break;
+	case LUA_TYPE_FUNCTION:
+		hashCombine(seed, k.getInterned()->getHash());
+		break;
+	case LUA_TYPE_VEC2: {
+		glm::vec2 vec = k.as<glm::vec2>();
+		hashCombine(seed, hashFloats(&vec[0], 2));
+		break;
+	}
+	case LUA_TYPE_VEC3: {
+		glm::vec3 vec = k.as<glm::vec3>();
+		hashCombine(seed, hashFloats(&vec[0], 3));
+		break;
+	}
+	case LUA_TYPE_VEC4: {
+		glm::vec4 vec = k.as<glm::vec4>();
+		hashCombine(seed, hashFloats(&vec[0], 4));
+		break;
+	}
+	case LUA_TYPE_MAT4:
+		hashCombine(seed, hashFloats(&(*k.as<glm::mat4*>())[0][0], 16));
+		break;
+	default:
+		// The remaining types are all compared by pointer
+		hashCombine(seed, std::hash<void const*>{}(k.as<void*>()));
+		break;
+	}
+	return seed;
 }
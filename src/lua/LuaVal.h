@@ -9,12 +9,19 @@
 #include "../rendering/SubRenderer.h"
 #include "../rendering/Model.h"
 #include "../rendering/Texture.h"
+#include "LuaArray.h"
+#include "LuaString.h"
 
 #define SOL_DEFAULT_PASS_ON_ERROR 1
 #define SOL_ALL_SAFETIES_ON 1
 #include <sol\sol.hpp>
 
-#include <map>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <shared_mutex>
+#include <string_view>
+#include <type_traits>
 
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
@@ -24,7 +31,7 @@
 
 namespace vecs {
 
-	enum LuaType {
+	enum LuaType : uint8_t {
 		LUA_TYPE_NIL,
 		LUA_TYPE_STRING,
 		LUA_TYPE_TABLE,
@@ -49,49 +56,28 @@ namespace vecs {
 		LUA_TYPE_BUFFER,
 		LUA_TYPE_TEXT_FILTER,
 		LUA_TYPE_FONT,
-		LUA_TYPE_PIXELS
+		LUA_TYPE_PIXELS,
+		// contiguous arrays of numbers, see LuaArray
+		LUA_TYPE_FLOAT_ARRAY,
+		LUA_TYPE_INT_ARRAY,
+		LUA_TYPE_BYTE_ARRAY
 	};
 
 	// Forward Declarations
+	class LuaTable;
 	class LuaVal;
 
 	class LuaVal {
 	public:
 		// type definition we use to store tables
-		typedef std::map<LuaVal, LuaVal> MapType;
-
-		// stores what type of value we have
-		LuaType type;
-		// type-safe version of a union, stores our actual value
-		std::variant<
-			double,
-			bool,
-			std::string,
-			sol::bytecode,
-			MapType*,
-			Archetype*,
-			EntityQuery*,
-			WorldLoadStatus*,
-			SubRenderer*,
-			Job*,
-			glm::vec2,
-			glm::vec3,
-			glm::vec4,
-			glm::mat4*,
-			Frustum*,
-			HastyNoise::NoiseSIMD*,
-			Model*,
-			Texture*,
-			Buffer*,
-			ImGuiTextFilter*,
-			ImFont*,
-			unsigned char*,
-			void*
-		> value;
+		typedef LuaTable MapType;
 
 		// static functions for creating LuaVals from existing lua objects
 		static LuaVal asLuaVal(sol::object const& v);
 		static LuaVal fromTable(sol::table const& tb);
+		static LuaVal fromBytecode(std::string_view bytecode);
+		// type is LUA_TYPE_FLOAT_ARRAY, LUA_TYPE_INT_ARRAY or LUA_TYPE_BYTE_ARRAY
+		static LuaVal newArray(LuaType type, size_t size = 0);
 
 		// get and set based on key, for indexing values
 		LuaVal get(std::string const& key) const;
@@ -101,54 +87,166 @@ namespace vecs {
 		void set_lua(sol::object const& key, sol::object const& val) const;
 		bool contains(LuaVal const& key) const;
 		int getLength() const;
+		// Appends each number to an array
+		void push(double value) const;
+		void push_lua(sol::variadic_args values) const;
+		bool isArray() const { return type == LUA_TYPE_FLOAT_ARRAY || type == LUA_TYPE_INT_ARRAY || type == LUA_TYPE_BYTE_ARRAY; }
 		template<typename T, typename std::enable_if<std::is_enum<T>::value>::type * = nullptr>
 		T getEnum() const {
-			return static_cast<T>((int)std::get<double>(value));
+			return static_cast<T>((int)as<double>());
 		}
 		void clear() const;
 
+		// Returns our value as T, which has to match our type. Strings are returned by reference
+		// e.g. as<double>(), as<std::string>(), as<glm::vec3>(), as<LuaVal::MapType*>()
+		template<typename T>
+		std::conditional_t<std::is_same_v<T, std::string>, std::string const&, T> as() const {
+			if constexpr (std::is_same_v<T, std::string>) {
+				assert(type == LUA_TYPE_STRING);
+				return load<LuaString*>()->get();
+			} else if constexpr (std::is_same_v<T, glm::vec4>) {
+				assert(type == LUA_TYPE_VEC4);
+				return load<SharedVec4*>()->value;
+			} else {
+				static_assert(std::is_trivially_copyable_v<T> && sizeof(T) <= 12, "Type isn't stored in a LuaVal");
+				return load<T>();
+			}
+		}
+		std::string_view getBytecode() const {
+			assert(type == LUA_TYPE_FUNCTION);
+			return load<LuaString*>()->get();
+		}
+		// The interned string behind a string or function, which is the same for every equal value
+		LuaString* getInterned() const {
+			assert(type == LUA_TYPE_STRING || type == LUA_TYPE_FUNCTION);
+			return load<LuaString*>();
+		}
+
 		bool operator<(LuaVal const& b) const;
 		bool operator==(LuaVal const& b) const;
 		bool operator!=(LuaVal const& b) const;
 		std::string toString() const;
 
 		// utility functions
-		std::tuple<sol::object, MapType::iterator> iterate(sol::this_state const& s) const;
-		std::tuple<sol::object, MapType::iterator> iterate_range(LuaVal start, LuaVal end, sol::this_state const& s) const;
+		// Copies tables recursively, so the copy doesn't share any tables with us
+		LuaVal clone() const;
+		// Tables lock themselves in the functions above, so they can be shared between workers. Code walking a
+		// table's MapType directly should hold this, shared for reading, and not lock any other table meanwhile
+		std::shared_mutex& getTableLock() const;
+		static std::shared_mutex& getTableLock(MapType const* table);
+		std::tuple<sol::object, sol::object> iterate(sol::this_state const& s) const;
+		std::tuple<sol::object, sol::object> iterate_range(LuaVal start, LuaVal end, sol::this_state const& s) const;
 		sol::object asObject(sol::this_state const& s) const;
 		sol::object asTable(sol::this_state const& s) const;
 		sol::object asLua(sol::this_state const& s) const;
 
 		// constructors for various types
 		LuaVal() : type(LUA_TYPE_NIL) {}
-		LuaVal(std::string s) : value(s), type(LUA_TYPE_STRING) {}
-		LuaVal(bool b) : value(b), type(LUA_TYPE_BOOL) {}
-		LuaVal(double d) : value(d), type(LUA_TYPE_NUMBER) {}
-		LuaVal(sol::function f) : value(f.dump()), type(LUA_TYPE_FUNCTION) {}
-		LuaVal(MapType* t) : value(t), type(LUA_TYPE_TABLE) {}
-		LuaVal(std::initializer_list<MapType::value_type> const& l) : value(new MapType(l)), type(LUA_TYPE_TABLE) {}
-		LuaVal(Archetype* a) : value(a), type(LUA_TYPE_ARCHETYPE) {}
-		LuaVal(EntityQuery* q) : value(q), type(LUA_TYPE_QUERY) {}
-		LuaVal(WorldLoadStatus* w) : value(w), type(LUA_TYPE_WORLD_LOAD_STATUS) {}
-		LuaVal(SubRenderer* s) : value(s), type(LUA_TYPE_RENDERER) {}
-		LuaVal(Job* j) : value(j), type(LUA_TYPE_JOB) {}
-		LuaVal(glm::vec2 v) : value(v), type(LUA_TYPE_VEC2) {}
-		LuaVal(glm::vec3 v) : value(v), type(LUA_TYPE_VEC3) {}
-		LuaVal(glm::vec4 v) : value(v), type(LUA_TYPE_VEC4) {}
-		LuaVal(glm::mat4* v) : value(new glm::mat4(*v)), type(LUA_TYPE_MAT4) {}
-		LuaVal(Frustum* f) : value(new Frustum(*f)), type(LUA_TYPE_FRUSTUM) {}
-		LuaVal(HastyNoise::NoiseSIMD* n) : value(n), type(LUA_TYPE_NOISE) {}
-		LuaVal(Model* m) : value(m), type(LUA_TYPE_MODEL) {}
-		LuaVal(Texture* t) : value(t), type(LUA_TYPE_TEXTURE) {}
-		LuaVal(Buffer* b) : value(new Buffer(*b)), type(LUA_TYPE_BUFFER) {}
-		LuaVal(ImGuiTextFilter* f) : value(new ImGuiTextFilter(*f)), type(LUA_TYPE_TEXT_FILTER) {}
-		LuaVal(ImFont* f) : value(f), type(LUA_TYPE_FONT) {}
-		LuaVal(unsigned char* p) : value(p), type(LUA_TYPE_PIXELS) {}
+		LuaVal(std::string const& s) : type(LUA_TYPE_STRING) { store(LuaString::intern(s)); }
+		LuaVal(std::string_view s) : type(LUA_TYPE_STRING) { store(LuaString::intern(s)); }
+		LuaVal(bool b) : type(LUA_TYPE_BOOL) { store(b); }
+		LuaVal(double d) : type(LUA_TYPE_NUMBER) { store(d); }
+		LuaVal(sol::function f);
+		LuaVal(MapType* t) : type(LUA_TYPE_TABLE) { store(t); }
+		LuaVal(std::initializer_list<std::pair<const LuaVal, LuaVal>> const& l);
+		LuaVal(Archetype* a) : type(LUA_TYPE_ARCHETYPE) { store(a); }
+		LuaVal(EntityQuery* q) : type(LUA_TYPE_QUERY) { store(q); }
+		LuaVal(WorldLoadStatus* w) : type(LUA_TYPE_WORLD_LOAD_STATUS) { store(w); }
+		LuaVal(SubRenderer* s) : type(LUA_TYPE_RENDERER) { store(s); }
+		LuaVal(Job* j) : type(LUA_TYPE_JOB) { store(j); }
+		LuaVal(glm::vec2 v) : type(LUA_TYPE_VEC2) { store(v); }
+		LuaVal(glm::vec3 v) : type(LUA_TYPE_VEC3) { store(v); }
+		LuaVal(glm::vec4 v) : type(LUA_TYPE_VEC4) { store(new SharedVec4{ { 1 }, v }); }
+		LuaVal(glm::mat4* v) : type(LUA_TYPE_MAT4) { store(new glm::mat4(*v)); }
+		LuaVal(Frustum* f) : type(LUA_TYPE_FRUSTUM) { store(new Frustum(*f)); }
+		LuaVal(HastyNoise::NoiseSIMD* n) : type(LUA_TYPE_NOISE) { store(n); }
+		LuaVal(Model* m) : type(LUA_TYPE_MODEL) { store(m); }
+		LuaVal(Texture* t) : type(LUA_TYPE_TEXTURE) { store(t); }
+		LuaVal(Buffer* b) : type(LUA_TYPE_BUFFER) { store(new Buffer(*b)); }
+		LuaVal(ImGuiTextFilter* f) : type(LUA_TYPE_TEXT_FILTER) { store(new ImGuiTextFilter(*f)); }
+		LuaVal(ImFont* f) : type(LUA_TYPE_FONT) { store(f); }
+		LuaVal(unsigned char* p) : type(LUA_TYPE_PIXELS) { store(p); }
+		LuaVal(LuaArray* a) : type(a->getType()) { store(a); a->addReference(); }
+
+		// Copies only touch a reference count at most, since strings, bytecode, vec4s and arrays are shared
+		LuaVal(LuaVal const& other) : type(other.type) {
+			std::memcpy(data, other.data, sizeof(data));
+			addReference();
+		}
+		LuaVal(LuaVal&& other) noexcept : type(other.type) {
+			std::memcpy(data, other.data, sizeof(data));
+			other.type = LUA_TYPE_NIL;
+		}
+		LuaVal& operator=(LuaVal const& other) {
+			if (this != &other) {
+				other.addReference();
+				release();
+				type = other.type;
+				std::memcpy(data, other.data, sizeof(data));
+			}
+			return *this;
+		}
+		LuaVal& operator=(LuaVal&& other) noexcept {
+			if (this != &other) {
+				release();
+				type = other.type;
+				std::memcpy(data, other.data, sizeof(data));
+				other.type = LUA_TYPE_NIL;
+			}
+			return *this;
+		}
+		~LuaVal() { release(); }
+
+	private:
+		// vec4s don't fit in data, so they're kept out of line and shared between copies like strings are
+		struct SharedVec4 {
+			std::atomic<uint32_t> references;
+			glm::vec4 value;
+		};
+
+		// Our actual value. Numbers, bools, vec2s, vec3s and pointers are stored directly, and strings and
+		// bytecode as interned LuaStrings. 12 bytes fits a vec3 while keeping us at 16 bytes with the type
+		alignas(8) unsigned char data[12];
+	public:
+		// stores what type of value we have
+		LuaType type;
 
 	private:
+		template<typename T>
+		T load() const {
+			T value;
+			std::memcpy(&value, data, sizeof(T));
+			return value;
+		}
+		template<typename T>
+		void store(T const& value) {
+			std::memcpy(data, &value, sizeof(T));
+		}
+
+		void addReference() const {
+			if (type == LUA_TYPE_STRING || type == LUA_TYPE_FUNCTION)
+				load<LuaString*>()->addReference();
+			else if (type == LUA_TYPE_VEC4)
+				load<SharedVec4*>()->references.fetch_add(1, std::memory_order_relaxed);
+			else if (isArray())
+				load<LuaArray*>()->addReference();
+		}
+		void release() {
+			if (type == LUA_TYPE_STRING || type == LUA_TYPE_FUNCTION)
+				load<LuaString*>()->release();
+			else if (type == LUA_TYPE_VEC4) {
+				SharedVec4* vec = load<SharedVec4*>();
+				if (vec->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+					delete vec;
+			} else if (isArray())
+				load<LuaArray*>()->release();
+		}
+
 		static LuaVal parseUserdata(sol::object const& v);
 	};
 
+	static_assert(sizeof(LuaVal) == 16, "LuaVal should stay 16 bytes");
+
 	namespace LuaValBindings {
 
 		void setupState(sol::state& lua);
@@ -157,6 +255,9 @@ namespace vecs {
 	size_t LuaValHash(vecs::LuaVal const& k);
 }
 
+// LuaTable needs LuaVal to be complete, so it's included after it
+#include "LuaTable.h"
+
 namespace std {
 
 	template <>
@@ -0,0 +1,288 @@
+#include "LuaValStream.h"
+
+#include "LuaVal.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+using namespace vecs;
+
+namespace {
+	const char MAGIC[4] = { 'V', 'L', 'U', 'A' };
+	// Written instead of a table we've already written, followed by that table's index
+	const uint8_t TABLE_REFERENCE = 0xFF;
+	// Written instead of a string or bytecode we've already written, followed by its index
+	const uint8_t STRING_REFERENCE = 0xFE;
+	// A table with its array part written separately from its other keys
+	const uint8_t ARRAY_TABLE = 0xFD;
+}
+
+std::string LuaValWriter::encode(LuaVal const& value) {
+	std::ostringstream out(std::ios::binary);
+	LuaValWriter writer(out);
+	writer.writeHeader();
+	writer.writeValue(value);
+	return out.str();
+}
+
+void LuaValWriter::writeHeader() {
+	out.write(MAGIC, sizeof(MAGIC));
+	write((uint32_t)VERSION);
+}
+
+void LuaValWriter::writeString(std::string_view string) {
+	write((uint32_t)string.size());
+	out.write(string.data(), string.size());
+}
+
+void LuaValWriter::writeValue(LuaVal const& value) {
+	switch (value.type) {
+	case LUA_TYPE_STRING:
+	case LUA_TYPE_FUNCTION: {
+		// Interned strings are the same LuaString wherever they appear, so they're easy to spot repeating
+		auto it = stringIndices.find(value.getInterned());
+		if (it != stringIndices.end()) {
+			write(STRING_REFERENCE);
+			write(it->second);
+			break;
+		}
+		stringIndices.emplace(value.getInterned(), (uint32_t)stringIndices.size());
+		write((uint8_t)value.type);
+		writeString(value.getInterned()->get());
+		break;
+	}
+	case LUA_TYPE_BOOL:
+		write((uint8_t)value.type);
+		write((uint8_t)value.as<bool>());
+		break;
+	case LUA_TYPE_NUMBER:
+		write((uint8_t)value.type);
+		write(value.as<double>());
+		break;
+	case LUA_TYPE_VEC2:
+		write((uint8_t)value.type);
+		write(value.as<glm::vec2>());
+		break;
+	case LUA_TYPE_VEC3:
+		write((uint8_t)value.type);
+		write(value.as<glm::vec3>());
+		break;
+	case LUA_TYPE_VEC4:
+		write((uint8_t)value.type);
+		write(value.as<glm::vec4>());
+		break;
+	case LUA_TYPE_MAT4:
+		write((uint8_t)value.type);
+		write(*value.as<glm::mat4*>());
+		break;
+	case LUA_TYPE_ARCHETYPE: {
+		auto it = archetypeIndices.find(value.as<Archetype*>());
+		if (it == archetypeIndices.end()) {
+			write((uint8_t)LUA_TYPE_NIL);
+			break;
+		}
+		write((uint8_t)value.type);
+		write(it->second);
+		break;
+	}
+	case LUA_TYPE_TABLE:
+		writeTable(value);
+		break;
+	case LUA_TYPE_FLOAT_ARRAY:
+	case LUA_TYPE_INT_ARRAY:
+	case LUA_TYPE_BYTE_ARRAY: {
+		LuaArray* array = value.as<LuaArray*>();
+		std::shared_lock<std::shared_mutex> lock(array->getMutex());
+		write((uint8_t)value.type);
+		write((uint32_t)array->size());
+		out.write((const char*)array->data(), array->size() * array->getElementSize());
+		break;
+	}
+	default:
+		// Pointers to engine objects can't be restored
+		write((uint8_t)LUA_TYPE_NIL);
+		break;
+	}
+}
+
+void LuaValWriter::writeTable(LuaVal const& value) {
+	LuaVal::MapType* table = value.as<LuaVal::MapType*>();
+	auto it = tableIndices.find(table);
+	if (it != tableIndices.end()) {
+		write(TABLE_REFERENCE);
+		write(it->second);
+		return;
+	}
+	tableIndices.emplace(table, (uint32_t)tableIndices.size());
+
+	// Copied out under the table's lock, since other workers may be writing it while we save, and writing its
+	// values may lock the tables inside it
+	size_t start = 0;
+	std::vector<LuaVal> array;
+	std::vector<std::pair<LuaVal, LuaVal>> pairs;
+	{
+		std::shared_lock<std::shared_mutex> lock(LuaVal::getTableLock(table));
+		// Trim the nils off either end of the array part, which leaves out the gap at 0 in tables starting at 1
+		std::vector<LuaVal> const& tableArray = table->getArray();
+		size_t end = tableArray.size();
+		while (start < end && tableArray[start].type == LUA_TYPE_NIL)
+			start++;
+		while (end > start && tableArray[end - 1].type == LUA_TYPE_NIL)
+			end--;
+		array.assign(tableArray.begin() + start, tableArray.begin() + end);
+		for (auto hashIt = table->fromIndex(tableArray.size()); hashIt != table->end(); ++hashIt)
+			pairs.emplace_back(hashIt->first, hashIt->second);
+	}
+	bool numbers = std::all_of(array.begin(), array.end(), [](LuaVal const& value) { return value.type == LUA_TYPE_NUMBER; });
+
+	write(ARRAY_TABLE);
+	write((uint32_t)start);
+	write((uint32_t)array.size());
+	// Arrays of just numbers, like vertices, go in one block so reading them back doesn't read each one's type
+	write((uint8_t)numbers);
+	for (auto& element : array) {
+		if (numbers)
+			write(element.as<double>());
+		else
+			writeValue(element);
+	}
+
+	write((uint32_t)pairs.size());
+	for (auto& pair : pairs) {
+		writeValue(pair.first);
+		writeValue(pair.second);
+	}
+}
+
+LuaValReader::~LuaValReader() {}
+
+LuaVal LuaValReader::decode(std::string_view data) {
+	LuaValReader reader(data.data(), data.size());
+	reader.readHeader();
+	return reader.readValue();
+}
+
+uint32_t LuaValReader::readHeader() {
+	for (char c : MAGIC)
+		if (read<char>() != c)
+			throw std::runtime_error("Data isn't an encoded value");
+	uint32_t version = read<uint32_t>();
+	if (version == 0 || version > LuaValWriter::VERSION)
+		throw std::runtime_error("Value is version " + std::to_string(version) + " but only up to version " + std::to_string(LuaValWriter::VERSION) + " is supported");
+	return version;
+}
+
+std::string_view LuaValReader::readString() {
+	uint32_t length = read<uint32_t>();
+	return std::string_view(take(length), length);
+}
+
+LuaVal LuaValReader::readValue() {
+	uint8_t type = read<uint8_t>();
+	switch (type) {
+	case LUA_TYPE_NIL:
+		return LuaVal();
+	case LUA_TYPE_STRING:
+		// Interned straight from the buffer, so a string we already have is never copied
+		strings.push_back(LuaVal(readString()));
+		return strings.back();
+	case LUA_TYPE_BOOL:
+		return LuaVal(read<uint8_t>() != 0);
+	case LUA_TYPE_NUMBER:
+		return LuaVal(read<double>());
+	case LUA_TYPE_FUNCTION:
+		strings.push_back(LuaVal::fromBytecode(readString()));
+		return strings.back();
+	case STRING_REFERENCE: {
+		uint32_t index = read<uint32_t>();
+		if (index >= strings.size())
+			throw std::runtime_error("Reference to a string that doesn't exist");
+		return strings[index];
+	}
+	case LUA_TYPE_VEC2:
+		return LuaVal(read<glm::vec2>());
+	case LUA_TYPE_VEC3:
+		return LuaVal(read<glm::vec3>());
+	case LUA_TYPE_VEC4:
+		return LuaVal(read<glm::vec4>());
+	case LUA_TYPE_MAT4: {
+		glm::mat4 matrix = read<glm::mat4>();
+		return LuaVal(&matrix);
+	}
+	case LUA_TYPE_ARCHETYPE: {
+		uint32_t index = read<uint32_t>();
+		if (index >= archetypes.size() || archetypes[index] == nullptr)
+			return LuaVal();
+		return LuaVal(archetypes[index]);
+	}
+	case LUA_TYPE_FLOAT_ARRAY:
+	case LUA_TYPE_INT_ARRAY:
+	case LUA_TYPE_BYTE_ARRAY: {
+		uint32_t size = read<uint32_t>();
+		LuaVal array = LuaVal::newArray((LuaType)type);
+		LuaArray* elements = array.as<LuaArray*>();
+		// Elements are copied out of the buffer in one go. Borrowing the buffer instead would tie the array to
+		// the snapshot's mapping, which is closed once loading finishes
+		const char* data = take((size_t)size * elements->getElementSize());
+		elements->resize(size);
+		std::memcpy(elements->data(), data, (size_t)size * elements->getElementSize());
+		return array;
+	}
+	case LUA_TYPE_TABLE:
+		return readTable(false);
+	case ARRAY_TABLE:
+		return readTable(true);
+	case TABLE_REFERENCE: {
+		uint32_t index = read<uint32_t>();
+		if (index >= tables.size())
+			throw std::runtime_error("Reference to a table that doesn't exist");
+		return LuaVal((LuaVal::MapType*)tables[index]);
+	}
+	default:
+		throw std::runtime_error("Unknown value type " + std::to_string(type));
+	}
+}
+
+LuaVal LuaValReader::readTable(bool hasArray) {
+	LuaVal::MapType* table = new LuaVal::MapType();
+	tables.push_back(table);
+	LuaVal result(table);
+
+	if (hasArray) {
+		uint32_t start = read<uint32_t>();
+		uint32_t length = read<uint32_t>();
+		bool numbers = read<uint8_t>() != 0;
+		if (numbers) {
+			// Check the whole block is there up front, then copy each number straight out of the buffer
+			const char* block = take((size_t)length * sizeof(double));
+			for (uint32_t i = 0; i < length; i++) {
+				double number;
+				std::memcpy(&number, block + i * sizeof(double), sizeof(double));
+				table->emplace(LuaVal((double)start + i), LuaVal(number));
+			}
+		} else {
+			for (uint32_t i = 0; i < length; i++) {
+				LuaVal value = readValue();
+				if (value.type != LUA_TYPE_NIL)
+					table->emplace(LuaVal((double)start + i), std::move(value));
+			}
+		}
+	}
+
+	uint32_t size = read<uint32_t>();
+	for (uint32_t i = 0; i < size; i++) {
+		LuaVal key = readValue();
+		LuaVal value = readValue();
+		table->emplace(std::move(key), std::move(value));
+	}
+	return result;
+}
+
+const char* LuaValReader::take(size_t amount) {
+	if ((size_t)(end - position) < amount)
+		throw std::runtime_error("Data ends unexpectedly");
+	const char* start = position;
+	position += amount;
+	return start;
+}
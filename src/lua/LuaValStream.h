@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace vecs {
+
+	// Forward Declarations
+	class Archetype;
+	class LuaString;
+	class LuaVal;
+
+	// Writes LuaVals in a compact binary form. Each value is its LuaType as a byte followed by its contents.
+	// Tables that appear more than once are only written once, and later appearances refer back to it,
+	// so shared and cyclic tables survive being written and read back. Strings and bytecode are deduplicated
+	// the same way. The array part of a table is written without its keys, and arrays of only numbers are
+	// written as one block of doubles. Typed arrays are written as their raw elements. Values that only make
+	// sense while the engine is running (buffers, textures, renderers and so on) are written as nil
+	class LuaValWriter {
+	public:
+		// Bumped whenever the encoding changes. Readers handle every older version, since each one only added to the last
+		static const uint32_t VERSION = 3;
+
+		// Archetypes are written as an index into this, since their pointers mean nothing once we're closed.
+		// Archetypes that aren't in it are written as nil
+		std::unordered_map<Archetype*, uint32_t> archetypeIndices;
+
+		LuaValWriter(std::ostream& out) : out(out) {}
+
+		// Encodes a single value with our own header, for values that get stored or sent on their own
+		static std::string encode(LuaVal const& value);
+
+		template<typename T>
+		void write(T const& value) {
+			out.write((const char*)&value, sizeof(T));
+		}
+		// Files with their own header don't need this, but lone values should start with it
+		void writeHeader();
+		void writeString(std::string_view string);
+		void writeValue(LuaVal const& value);
+
+	private:
+		std::ostream& out;
+		std::unordered_map<void*, uint32_t> tableIndices;
+		std::unordered_map<LuaString*, uint32_t> stringIndices;
+
+		void writeTable(LuaVal const& value);
+	};
+
+	// Reads values written by LuaValWriter out of a buffer, throwing std::runtime_error if the buffer is malformed.
+	// Values are always copied out (strings are interned, number blocks and typed arrays memcpy'd into their own
+	// storage), so nothing read borrows the buffer and it can be freed or unmapped as soon as we're done
+	class LuaValReader {
+	public:
+		// Archetype indices are looked up in this. Indices out of range or null entries are read as nil
+		std::vector<Archetype*> archetypes;
+
+		LuaValReader(const char* data, size_t size) : position(data), end(data + size) {}
+		~LuaValReader();
+
+		// Decodes a value written by LuaValWriter::encode, throwing std::runtime_error if it's malformed
+		static LuaVal decode(std::string_view data);
+
+		template<typename T>
+		T read() {
+			T value;
+			std::memcpy(&value, take(sizeof(T)), sizeof(T));
+			return value;
+		}
+		// Returns the version from the header written by writeHeader
+		uint32_t readHeader();
+		// The view points into our buffer, so it's only valid as long as the buffer is
+		std::string_view readString();
+		LuaVal readValue();
+
+		size_t remaining() const { return end - position; }
+
+	private:
+		const char* position;
+		const char* end;
+		std::vector<void*> tables;
+		std::vector<LuaVal> strings;
+
+		const char* take(size_t amount);
+		LuaVal readTable(bool hasArray);
+	};
+}
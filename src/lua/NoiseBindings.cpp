@@ -1,5 +1,8 @@
 #include "NoiseBindings.h"
 
+#include "../engine/Debugger.h"
+#include "LuaVal.h"
+
 #include <hastyNoise/hastyNoise.h>
 
 void vecs::NoiseBindings::setupState(sol::state& lua, size_t fastestSimd) {
@@ -47,6 +50,18 @@ void vecs::NoiseBindings::setupState(sol::state& lua, size_t fastestSimd) {
 			noise.FillSet(buffer, chunkX * chunkSize, chunkY * chunkSize, chunkZ * chunkSize, chunkSize, chunkSize, chunkSize);
 			return sol::as_table(std::vector<float>(buffer, buffer + chunkSize * chunkSize * chunkSize));
 		},
+		// Same as getNoiseSet but fills a float array in place, without a noise buffer or a table in between.
+		// Arrays are aligned and padded for SIMD, so the noise can be written straight into them
+		"fillArray", [](HastyNoise::NoiseSIMD& noise, LuaVal const& array, int chunkX, int chunkY, int chunkZ, const int chunkSize) {
+			if (array.type != LUA_TYPE_FLOAT_ARRAY) {
+				Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] Noise can only fill float arrays");
+				return;
+			}
+			LuaArray* floats = array.as<LuaArray*>();
+			std::unique_lock<std::shared_mutex> lock(floats->getMutex());
+			floats->resize(chunkSize * chunkSize * chunkSize);
+			noise.FillSet((float*)floats->data(), chunkX * chunkSize, chunkY * chunkSize, chunkZ * chunkSize, chunkSize, chunkSize, chunkSize);
+		},
 		"setAxisScales", &HastyNoise::NoiseSIMD::SetAxisScales,
 		"setCellularReturnType", &HastyNoise::NoiseSIMD::SetCellularReturnType,
 		"setCellularJitter", &HastyNoise::NoiseSIMD::SetCellularJitter,
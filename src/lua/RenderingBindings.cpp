@@ -2,6 +2,7 @@
 
 #include "../ecs/World.h"
 #include "../engine/Device.h"
+#include "../lua/LuaVal.h"
 #include "../rendering/Model.h"
 #include "../rendering/SecondaryCommandBuffer.h"
 #include "../rendering/SubRenderer.h"
@@ -18,6 +19,59 @@ struct SubTexture {
 	std::string filename;
 };
 
+namespace {
+	// Reads the numbers in a LuaVal table or array directly, so saved chunks don't need to become lua tables just to be uploaded
+	template<typename T>
+	std::vector<T> getNumbers(vecs::LuaVal const& array) {
+		std::vector<T> numbers;
+		if (array.isArray()) {
+			vecs::LuaArray* elements = array.as<vecs::LuaArray*>();
+			std::shared_lock<std::shared_mutex> lock(elements->getMutex());
+			numbers.reserve(elements->size());
+			for (size_t i = 0; i < elements->size(); i++)
+				numbers.push_back((T)elements->get(i));
+			return numbers;
+		}
+		if (array.type != vecs::LUA_TYPE_TABLE)
+			return numbers;
+		vecs::LuaVal::MapType* table = array.as<vecs::LuaVal::MapType*>();
+		std::shared_lock<std::shared_mutex> lock(array.getTableLock());
+		numbers.reserve(table->size());
+		// Same as converting a lua table, we go from 1 until the first missing index
+		for (size_t i = 1;; i++) {
+			auto it = table->find(vecs::LuaVal((double)i));
+			if (it == table->end() || it->second.type != vecs::LUA_TYPE_NUMBER)
+				break;
+			numbers.push_back((T)it->second.as<double>());
+		}
+		return numbers;
+	}
+
+	template<typename T>
+	void setData(vecs::Worker* worker, vecs::Device* device, vecs::Buffer* buffer, std::vector<T> const& data) {
+		vecs::Buffer staging = device->createStagingBuffer(data.size() * sizeof(T));
+		staging.copyTo((void*)data.data(), data.size() * sizeof(T));
+		device->copyBuffer(&staging, buffer, worker);
+		device->cleanupBuffer(staging);
+	}
+
+	// Arrays already holding T are copied straight into the staging buffer, anything else is converted first
+	template<typename T>
+	void setData(vecs::Worker* worker, vecs::Device* device, vecs::Buffer* buffer, vecs::LuaVal const& data, vecs::LuaType arrayType) {
+		if (data.type != arrayType) {
+			setData(worker, device, buffer, getNumbers<T>(data));
+			return;
+		}
+		vecs::LuaArray* array = data.as<vecs::LuaArray*>();
+		std::shared_lock<std::shared_mutex> lock(array->getMutex());
+		vecs::Buffer staging = device->createStagingBuffer(array->size() * sizeof(T));
+		staging.copyTo(array->data(), array->size() * sizeof(T));
+		lock.unlock();
+		device->copyBuffer(&staging, buffer, worker);
+		device->cleanupBuffer(staging);
+	}
+}
+
 void vecs::RenderingBindings::setupState(sol::state& lua, Worker* worker, Device* device) {
 	lua.new_enum("shaderStages",
 		"Vertex", VK_SHADER_STAGE_VERTEX_BIT,
@@ -247,17 +301,21 @@ void vecs::RenderingBindings::setupState(sol::state& lua, Worker* worker, Device
 				return buffer;
 			}
 		),
-		"setDataInts", [worker, device](Buffer* buffer, std::vector<int> data) {
-			Buffer staging = device->createStagingBuffer(data.size() * sizeof(int));
-			staging.copyTo(data.data(), data.size() * sizeof(int));
-			device->copyBuffer(&staging, buffer, worker);
-			device->cleanupBuffer(staging);
-		},
-		"setDataFloats", [worker, device](Buffer* buffer, std::vector<float> data) {
-			Buffer staging = device->createStagingBuffer(data.size() * sizeof(float));
-			staging.copyTo(data.data(), data.size() * sizeof(float));
-			device->copyBuffer(&staging, buffer, worker);
-			device->cleanupBuffer(staging);
-		}
+		"setDataInts", sol::overload(
+			[worker, device](Buffer* buffer, LuaVal const& data) {
+				setData<int32_t>(worker, device, buffer, data, LUA_TYPE_INT_ARRAY);
+			},
+			[worker, device](Buffer* buffer, std::vector<int> data) {
+				setData(worker, device, buffer, data);
+			}
+		),
+		"setDataFloats", sol::overload(
+			[worker, device](Buffer* buffer, LuaVal const& data) {
+				setData<float>(worker, device, buffer, data, LUA_TYPE_FLOAT_ARRAY);
+			},
+			[worker, device](Buffer* buffer, std::vector<float> data) {
+				setData(worker, device, buffer, data);
+			}
+		)
 	);
 }
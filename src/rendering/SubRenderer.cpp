@@ -22,7 +22,7 @@ SubRenderer::SubRenderer(LuaVal* config, Worker* worker, Device* device, Rendere
 
     LuaVal preInit = config->get("preInit");
     if (preInit.type == LUA_TYPE_FUNCTION) {
-        sol::load_result loadResult = worker->lua.load(std::get<sol::bytecode>(preInit.value).as_string_view());
+        sol::load_result loadResult = worker->lua.load(preInit.getBytecode());
         if (!loadResult.valid()) {
             sol::error err = loadResult;
             Debugger::addLog(DEBUG_LEVEL_ERROR, "[LUA] " + std::string(err.what()));
@@ -351,7 +351,7 @@ void SubRenderer::createShaderStages() {
 
     if (shaders.type != LUA_TYPE_TABLE) return;
 
-    for (auto kvp : *std::get<LuaVal::MapType*>(shaders.value)) {
+    for (auto kvp : *shaders.as<LuaVal::MapType*>()) {
         if (kvp.first.type != LUA_TYPE_STRING) {
             Debugger::addLog(DEBUG_LEVEL_WARN, "Attempted to load shader with non-string filename key");
             continue;
@@ -360,7 +360,7 @@ void SubRenderer::createShaderStages() {
             Debugger::addLog(DEBUG_LEVEL_WARN, "Attempted to load shader with non-numeric value");
             continue;
         }
-        std::string name = std::get<std::string>(kvp.first.value);
+        std::string name = kvp.first.as<std::string>();
         VkShaderStageFlagBits stage = kvp.second.getEnum<VkShaderStageFlagBits>();
         VkShaderModule shaderModule = getCompiledShader(&device->logical, name);
         shaderModules.emplace_back(shaderModule);
@@ -434,7 +434,7 @@ void SubRenderer::createMultisampling() {
 
 void SubRenderer::createDepthStencil() {
     LuaVal depthTest = config->get("performDepthTest");
-    VkBool32 performDepthTest = depthTest.type == LUA_TYPE_BOOL ? std::get<bool>(depthTest.value) : VK_TRUE;
+    VkBool32 performDepthTest = depthTest.type == LUA_TYPE_BOOL ? depthTest.as<bool>() : VK_TRUE;
 
     // Describe the depth and stencil buffer
     depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
@@ -488,7 +488,7 @@ void SubRenderer::createDynamicStates() {
 
 void SubRenderer::createPushConstantRanges() {
     LuaVal sizeVal = config->get("pushConstantsSize");
-    uint32_t size = sizeVal.type == LUA_TYPE_NUMBER ? (uint32_t)std::get<double>(sizeVal.value) : 0;
+    uint32_t size = sizeVal.type == LUA_TYPE_NUMBER ? (uint32_t)sizeVal.as<double>() : 0;
 
     if (size > 0) {
         VkPushConstantRange pushConstantRange = {};
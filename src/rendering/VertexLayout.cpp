@@ -10,7 +10,7 @@ VertexLayout::VertexLayout(LuaVal config) {
         Debugger::addLog(DEBUG_LEVEL_ERROR, "Vertex layout must be a table");
         return;
     }
-    LuaVal::MapType* configMap = std::get<LuaVal::MapType*>(config.value);
+    LuaVal::MapType* configMap = config.as<LuaVal::MapType*>();
     // Calculate numFloats and attribute descriptions
     attributeDescriptions.reserve(configMap->size());
     for (auto kvp : *configMap) {
@@ -23,7 +23,7 @@ VertexLayout::VertexLayout(LuaVal config) {
             continue;
         }
 
-        uint8_t location = std::get<double>(kvp.first.value);
+        uint8_t location = kvp.first.as<double>();
         VertexComponent component = kvp.second.getEnum<VertexComponent>();
         components.insert({ location, component });
 
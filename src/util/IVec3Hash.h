@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+namespace vecs {
+
+	// Hashes integer grid positions like chunk, region or cell coordinates, for use as unordered_map keys.
+	// Each axis is multiplied by a different large prime so neighbouring positions don't collide
+	struct IVec3Hash {
+		size_t operator()(glm::ivec3 const& position) const {
+			return ((size_t)position.x * 73856093) ^ ((size_t)position.y * 19349663) ^ ((size_t)position.z * 83492791);
+		}
+	};
+}
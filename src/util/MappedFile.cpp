@@ -0,0 +1,81 @@
+#include "MappedFile.h"
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace vecs;
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::open(std::filesystem::path const& path) {
+	close();
+
+#ifdef WIN32
+	HANDLE fileHandle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle(fileHandle);
+		return false;
+	}
+	HANDLE mappingHandle = CreateFileMappingW(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mappingHandle == nullptr) {
+		CloseHandle(fileHandle);
+		return false;
+	}
+	void* view = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr) {
+		CloseHandle(mappingHandle);
+		CloseHandle(fileHandle);
+		return false;
+	}
+	file = fileHandle;
+	mapping = mappingHandle;
+	start = (const char*)view;
+	length = (size_t)fileSize.QuadPart;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps the file alive, so we don't need the descriptor anymore
+	::close(fd);
+	if (view == MAP_FAILED)
+		return false;
+	start = (const char*)view;
+	length = (size_t)info.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::close() {
+	if (start == nullptr) return;
+
+#ifdef WIN32
+	UnmapViewOfFile(start);
+	CloseHandle(mapping);
+	CloseHandle(file);
+	mapping = nullptr;
+	file = nullptr;
+#else
+	munmap((void*)start, length);
+#endif
+	start = nullptr;
+	length = 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+namespace vecs {
+
+	// A read-only view of a whole file mapped into memory, so reading it doesn't copy it into a buffer first
+	// and pages we never touch are never read from disk. The mapping is released when this is destroyed, so
+	// anything that needs to outlive it (like decoded LuaVals) has to be copied out
+	class MappedFile {
+	public:
+		MappedFile() {}
+		~MappedFile();
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		// Returns false if the file couldn't be opened or mapped. Empty files can't be mapped either
+		bool open(std::filesystem::path const& path);
+		void close();
+
+		const char* data() const { return start; }
+		size_t size() const { return length; }
+
+	private:
+		const char* start = nullptr;
+		size_t length = 0;
+
+#ifdef WIN32
+		void* file = nullptr;
+		void* mapping = nullptr;
+#endif
+	};
+}
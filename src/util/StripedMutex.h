@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <shared_mutex>
+
+namespace vecs {
+
+	// A fixed set of reader/writer locks shared between many small objects, picked by the object's address.
+	// Giving every table or component row its own mutex would cost more memory than most of them hold, while
+	// one lock for all of them would have every writer block everyone. Objects that land on the same stripe
+	// just contend a little more than they need to.
+	// Only hold a stripe while touching the object itself. Two objects can share a stripe, so locking one
+	// while holding another can deadlock
+	class StripedMutex {
+	public:
+		static const uint32_t STRIPE_BITS = 8;
+		static const uint32_t NUM_STRIPES = 1u << STRIPE_BITS;
+
+		std::shared_mutex& get(const void* address) {
+			// Fibonacci hashing, so neighbouring addresses like the rows of a block end up on different stripes
+			uint64_t hash = (uint64_t)((uintptr_t)address >> 4) * 0x9E3779B97F4A7C15ull;
+			return stripes[hash >> (64 - STRIPE_BITS)];
+		}
+
+	private:
+		std::shared_mutex stripes[NUM_STRIPES];
+	};
+}